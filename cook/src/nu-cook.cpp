@@ -0,0 +1,479 @@
+// offline scene cooker. converts a glTF/GLB file into the binary scene cache that
+// vkutil::load_gltf maps instead of parsing and decoding the source on every launch.
+//
+// usage: nu-cook [--no-optimize] <scene.gltf|scene.glb> [output]
+//
+// meshes are welded, reordered for the vertex cache, overdraw and vertex fetch and get their lod chains
+// and meshlets unless --no-optimize is given. images are block compressed unless --no-compress is given:
+// bc5 for normal maps, bc1 for opaque color and bc7 for everything else
+
+#include "mesh_optimizer.h"
+#include "scene_cache.h"
+#include "texture_codec.h"
+#include "vertex_format.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/parser.hpp>
+#include <fastgltf/tools.hpp>
+#include <fastgltf/util.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+// how the materials sample an image, decides what it is compressed to
+constexpr uint32_t IMAGE_USAGE_COLOR = 1;
+constexpr uint32_t IMAGE_USAGE_NORMAL = 2;
+constexpr uint32_t IMAGE_USAGE_DATA = 4;
+
+struct CookedMeshData {
+	std::vector<CookedVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<CookedSurface> surfaces;
+	std::vector<Meshlet> meshlets;
+	uint32_t baseIndexCount{ 0 };
+};
+
+static void parallel_for(size_t count, const std::function<void(size_t)>& task)
+{
+	size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+	std::atomic<size_t> next{ 0 };
+
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			task(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; i++) {
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+static std::optional<TextureData> decode_bytes(const uint8_t* bytes, size_t size)
+{
+	TextureData texture;
+	if (texcodec::is_ktx2(bytes, size)) {
+		if (!texcodec::load_ktx2(bytes, size, texture)) {
+			return {};
+		}
+		return texture;
+	}
+
+	int width, height, nrChannels;
+	unsigned char* data = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &nrChannels, 4);
+	if (data == nullptr) {
+		return {};
+	}
+
+	texcodec::build_mips(data, width, height, texture);
+	stbi_image_free(data);
+	return texture;
+}
+
+static std::optional<TextureData> decode_image(const fastgltf::Asset& asset, const fastgltf::Image& image)
+{
+	std::optional<TextureData> texture;
+
+	std::visit(
+		fastgltf::visitor{
+			[](auto&) {},
+			[&](const fastgltf::sources::URI& filePath) {
+				const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
+				std::ifstream file(path, std::ios::binary);
+				std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				if (!bytes.empty()) {
+					texture = decode_bytes(bytes.data(), bytes.size());
+				}
+			},
+			[&](const fastgltf::sources::Vector& vector) {
+				texture = decode_bytes(vector.bytes.data(), vector.bytes.size());
+			},
+			[&](const fastgltf::sources::BufferView& view) {
+				auto& bufferView = asset.bufferViews[view.bufferViewIndex];
+				auto& buffer = asset.buffers[bufferView.bufferIndex];
+
+				std::visit(
+					fastgltf::visitor{
+						[](auto&) {},
+						[&](const fastgltf::sources::Vector& vector) {
+							texture = decode_bytes(vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
+						}
+					},
+					buffer.data
+				);
+			},
+		},
+		image.data
+	);
+
+	return texture;
+}
+
+// bc5 drops two channels, so only an image nothing but normal maps sample gets it
+static TextureFormat compressed_format(uint32_t usage, const TextureData& texture)
+{
+	if (usage == IMAGE_USAGE_NORMAL) {
+		return TextureFormat::BC5;
+	}
+	if (usage == IMAGE_USAGE_COLOR && !texcodec::has_alpha(texture)) {
+		return TextureFormat::BC1;
+	}
+	return TextureFormat::BC7;
+}
+
+// must produce the same streams as import_mesh in vk_loader.cpp
+static void cook_mesh(const fastgltf::Asset& gltf, const fastgltf::Mesh& mesh, bool optimize, CookedMeshData& out)
+{
+	std::vector<uint32_t>& indices = out.indices;
+	std::vector<CookedVertex>& vertices = out.vertices;
+
+	for (auto&& p : mesh.primitives) {
+		CookedSurface newSurface{};
+		newSurface.startIndex = (uint32_t)indices.size();
+		newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+		newSurface.lods[0] = MeshLod{ newSurface.startIndex, newSurface.count, 0.0f, 0, 0 };
+		newSurface.lodCount = 1;
+		newSurface.materialIndex = (int32_t)p.materialIndex.value_or(0);
+
+		size_t initial_vtx = vertices.size();
+
+		fastgltf::iterateAccessor<std::uint32_t>(gltf, gltf.accessors[p.indicesAccessor.value()], [&](std::uint32_t idx) {
+			indices.push_back(idx + initial_vtx);
+		});
+
+		// attributes are gathered at full precision first and packed once all of them are in
+		const fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
+		std::vector<glm::vec3> positions(posAccessor.count);
+		std::vector<glm::vec3> normals(posAccessor.count, glm::vec3(1.0f, 0.0f, 0.0f));
+		std::vector<glm::vec2> uvs(posAccessor.count, glm::vec2(0.0f));
+		std::vector<glm::vec4> colors(posAccessor.count, glm::vec4(1.0f));
+
+		fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
+			positions[index] = v;
+		});
+
+		auto normalAttribute = p.findAttribute("NORMAL");
+		if (normalAttribute != p.attributes.end()) {
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normalAttribute).second], [&](glm::vec3 v, size_t index) {
+				normals[index] = v;
+			});
+		}
+
+		auto uvAttribute = p.findAttribute("TEXCOORD_0");
+		if (uvAttribute != p.attributes.end()) {
+			fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uvAttribute).second], [&](glm::vec2 v, size_t index) {
+				uvs[index] = v;
+			});
+		}
+
+		auto colorAttribute = p.findAttribute("COLOR_0");
+		if (colorAttribute != p.attributes.end()) {
+			fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colorAttribute).second], [&](glm::vec4 v, size_t index) {
+				colors[index] = v;
+			});
+		}
+
+		vertices.reserve(vertices.size() + positions.size());
+		for (size_t i = 0; i < positions.size(); i++) {
+			PackedVertex packed = vertexformat::pack(positions[i], normals[i], uvs[i], colors[i]);
+			vertices.push_back(CookedVertex{ { packed.position.x, packed.position.y, packed.position.z }, packed.normal, packed.uv, packed.color });
+		}
+
+		glm::vec3 minPos = positions[0];
+		glm::vec3 maxPos = positions[0];
+		for (const glm::vec3& position : positions) {
+			minPos = glm::min(minPos, position);
+			maxPos = glm::max(maxPos, position);
+		}
+
+		glm::vec3 origin = (maxPos + minPos) / 2.0f;
+		glm::vec3 extents = (maxPos - minPos) / 2.0f;
+		memcpy(newSurface.origin, &origin, sizeof(origin));
+		memcpy(newSurface.extents, &extents, sizeof(extents));
+		newSurface.sphereRadius = glm::length(extents);
+
+		out.surfaces.push_back(newSurface);
+	}
+
+	out.baseIndexCount = (uint32_t)indices.size();
+	if (optimize) {
+		meshopt::optimize_mesh(indices, vertices, out.surfaces);
+		meshopt::generate_lods(indices, vertices, out.surfaces);
+		meshopt::generate_meshlets(indices, vertices, out.surfaces, out.meshlets);
+	}
+}
+
+// with KHR_texture_basisu imageIndex is the ktx2 image, the original source is only used when that failed to load
+static int32_t texture_image(const fastgltf::Texture& texture, const std::vector<CookedImage>& images)
+{
+	size_t image = texture.imageIndex.value();
+	if (images[image].width == 0 && texture.fallbackImageIndex.has_value()) {
+		image = texture.fallbackImageIndex.value();
+	}
+	return (int32_t)image;
+}
+
+template<typename Info>
+static int32_t texture_image(const fastgltf::Asset& gltf, const std::optional<Info>& info, const std::vector<CookedImage>& images)
+{
+	if (!info.has_value()) {
+		return SCENE_CACHE_NONE;
+	}
+	return texture_image(gltf.textures[info->textureIndex], images);
+}
+
+template<typename Info>
+static int32_t texture_sampler(const fastgltf::Asset& gltf, const std::optional<Info>& info)
+{
+	if (!info.has_value()) {
+		return SCENE_CACHE_NONE;
+	}
+	return (int32_t)gltf.textures[info->textureIndex].samplerIndex.value();
+}
+
+int main(int argc, char* argv[])
+{
+	bool optimize = true;
+	bool compress = true;
+	std::vector<std::string_view> paths;
+	for (int i = 1; i < argc; i++) {
+		if (std::string_view(argv[i]) == "--no-optimize") {
+			optimize = false;
+		}
+		else if (std::string_view(argv[i]) == "--no-compress") {
+			compress = false;
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+
+	if (paths.empty()) {
+		std::cerr << "usage: nu-cook [--no-optimize] [--no-compress] <scene.gltf|scene.glb> [output]" << std::endl;
+		return 1;
+	}
+
+	std::filesystem::path sourcePath = paths[0];
+	std::filesystem::path cachePath = paths.size() > 1 ? std::filesystem::path(paths[1]) : scenecache::cache_path(sourcePath);
+
+	CookedScene scene;
+	if (!scenecache::source_stamp(sourcePath, scene.sourceSize, scene.sourceWriteTime)
+		|| !scenecache::source_hash(sourcePath, scene.sourceHash)) {
+		std::cerr << "Failed to read " << sourcePath << std::endl;
+		return 1;
+	}
+
+	fastgltf::Parser parser{ fastgltf::Extensions::KHR_mesh_quantization | fastgltf::Extensions::KHR_texture_basisu };
+
+	constexpr auto gltfOptions =
+		fastgltf::Options::DontRequireValidAssetMember |
+		fastgltf::Options::AllowDouble |
+		fastgltf::Options::LoadGLBBuffers |
+		fastgltf::Options::LoadExternalBuffers;
+
+	fastgltf::GltfDataBuffer data;
+	data.loadFromFile(sourcePath);
+
+	fastgltf::Asset gltf;
+
+	auto type = fastgltf::determineGltfFileType(&data);
+	if (type == fastgltf::GltfType::glTF) {
+		auto load = parser.loadGLTF(&data, std::filesystem::absolute(sourcePath).parent_path(), gltfOptions);
+		if (!load) {
+			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
+			return 1;
+		}
+		gltf = std::move(load.get());
+	}
+	else if (type == fastgltf::GltfType::GLB) {
+		auto load = parser.loadBinaryGLTF(&data, std::filesystem::absolute(sourcePath).parent_path(), gltfOptions);
+		if (!load) {
+			std::cerr << "Failed to load glTF: " << fastgltf::to_underlying(load.error()) << std::endl;
+			return 1;
+		}
+		gltf = std::move(load.get());
+	}
+	else {
+		std::cerr << "Failed to determine glTF container" << std::endl;
+		return 1;
+	}
+
+	for (const fastgltf::Sampler& sampler : gltf.samplers) {
+		CookedSampler cooked;
+		cooked.magFilter = fastgltf::to_underlying(sampler.magFilter.value_or(fastgltf::Filter::Linear));
+		cooked.minFilter = fastgltf::to_underlying(sampler.minFilter.value_or(fastgltf::Filter::Linear));
+		scene.samplers.push_back(cooked);
+	}
+
+	std::vector<uint32_t> imageUsage(gltf.images.size(), 0);
+	auto use_texture = [&](size_t textureIndex, uint32_t usage) {
+		const fastgltf::Texture& texture = gltf.textures[textureIndex];
+		imageUsage[texture.imageIndex.value()] |= usage;
+		if (texture.fallbackImageIndex.has_value()) {
+			imageUsage[texture.fallbackImageIndex.value()] |= usage;
+		}
+	};
+	for (const fastgltf::Material& mat : gltf.materials) {
+		if (mat.pbrData.baseColorTexture.has_value()) {
+			use_texture(mat.pbrData.baseColorTexture->textureIndex, IMAGE_USAGE_COLOR);
+		}
+		if (mat.pbrData.metallicRoughnessTexture.has_value()) {
+			use_texture(mat.pbrData.metallicRoughnessTexture->textureIndex, IMAGE_USAGE_DATA);
+		}
+		if (mat.normalTexture.has_value()) {
+			use_texture(mat.normalTexture->textureIndex, IMAGE_USAGE_NORMAL);
+		}
+	}
+
+	std::vector<std::optional<TextureData>> images(gltf.images.size());
+	std::vector<CookedMeshData> meshes(gltf.meshes.size());
+
+	parallel_for(gltf.images.size() + gltf.meshes.size(), [&](size_t i) {
+		if (i < gltf.images.size()) {
+			images[i] = decode_image(gltf, gltf.images[i]);
+			// ktx2 images that already were block compressed are kept as they are
+			if (compress && images[i].has_value()) {
+				texcodec::compress(*images[i], compressed_format(imageUsage[i], *images[i]));
+			}
+		}
+		else {
+			size_t meshIndex = i - gltf.images.size();
+			cook_mesh(gltf, gltf.meshes[meshIndex], optimize, meshes[meshIndex]);
+		}
+	});
+
+	for (size_t i = 0; i < images.size(); i++) {
+		// a zero sized image tells the loader to fall back to the error texture
+		CookedImage cooked{};
+		if (images[i].has_value()) {
+			TextureData& texture = *images[i];
+			cooked.width = texture.width;
+			cooked.height = texture.height;
+			cooked.mipLevels = texture.mipLevels;
+			cooked.format = (uint32_t)texture.format;
+			cooked.texelOffset = scene.texels.size();
+			cooked.texelSize = texture.texels.size();
+			scene.texels.insert(scene.texels.end(), texture.texels.begin(), texture.texels.end());
+			scene.texels.resize((scene.texels.size() + 15) & ~size_t(15));
+		}
+		else {
+			std::cout << "gltf failed to load texture " << gltf.images[i].name << std::endl;
+		}
+		scene.images.push_back(cooked);
+		images[i].reset();
+	}
+
+	for (const fastgltf::Material& mat : gltf.materials) {
+		CookedMaterial cooked{};
+		cooked.nameOffset = scene.add_string(mat.name);
+		cooked.passType = mat.alphaMode == fastgltf::AlphaMode::Blend ? 1 : 0;
+
+		for (int c = 0; c < 4; c++) {
+			cooked.colorFactors[c] = mat.pbrData.baseColorFactor[c];
+		}
+		cooked.metalRoughFactors[0] = mat.pbrData.metallicFactor;
+		cooked.metalRoughFactors[1] = mat.pbrData.roughnessFactor;
+		cooked.doubleSided = mat.doubleSided ? 1 : 0;
+
+		cooked.colorImage = texture_image(gltf, mat.pbrData.baseColorTexture, scene.images);
+		cooked.colorSampler = texture_sampler(gltf, mat.pbrData.baseColorTexture);
+		cooked.metalRoughImage = texture_image(gltf, mat.pbrData.metallicRoughnessTexture, scene.images);
+		cooked.metalRoughSampler = texture_sampler(gltf, mat.pbrData.metallicRoughnessTexture);
+		cooked.normalImage = texture_image(gltf, mat.normalTexture, scene.images);
+		cooked.normalSampler = texture_sampler(gltf, mat.normalTexture);
+
+		scene.materials.push_back(cooked);
+	}
+
+	for (size_t m = 0; m < meshes.size(); m++) {
+		CookedMeshData& data = meshes[m];
+
+		CookedMesh cooked{};
+		cooked.nameOffset = scene.add_string(gltf.meshes[m].name);
+		cooked.firstSurface = (uint32_t)scene.surfaces.size();
+		cooked.surfaceCount = (uint32_t)data.surfaces.size();
+		cooked.baseIndexCount = data.baseIndexCount;
+		cooked.firstVertex = scene.vertices.size();
+		cooked.vertexCount = data.vertices.size();
+		cooked.firstIndex = scene.indices.size();
+		cooked.indexCount = data.indices.size();
+		cooked.firstMeshlet = scene.meshlets.size();
+		cooked.meshletCount = data.meshlets.size();
+
+		scene.surfaces.insert(scene.surfaces.end(), data.surfaces.begin(), data.surfaces.end());
+		scene.vertices.insert(scene.vertices.end(), data.vertices.begin(), data.vertices.end());
+		scene.indices.insert(scene.indices.end(), data.indices.begin(), data.indices.end());
+		scene.meshlets.insert(scene.meshlets.end(), data.meshlets.begin(), data.meshlets.end());
+		scene.meshes.push_back(cooked);
+
+		data = {};
+	}
+
+	for (const fastgltf::Node& node : gltf.nodes) {
+		CookedNode cooked{};
+		cooked.nameOffset = scene.add_string(node.name);
+		cooked.meshIndex = node.meshIndex.has_value() ? (int32_t)*node.meshIndex : SCENE_CACHE_NONE;
+		cooked.parentIndex = SCENE_CACHE_NONE;
+
+		glm::mat4 localTransform;
+		std::visit(
+			fastgltf::visitor{
+				[&](const fastgltf::Node::TransformMatrix& matrix) {
+					localTransform = glm::make_mat4(matrix.data());
+				},
+				[&](const fastgltf::Node::TRS& transform) {
+					glm::vec3 tl(transform.translation[0], transform.translation[1], transform.translation[2]);
+					glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1], transform.rotation[2]);
+					glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+					glm::mat4 tm = glm::translate(glm::mat4(1.0f), tl);
+					glm::mat4 rm = glm::toMat4(rot);
+					glm::mat4 sm = glm::scale(glm::mat4(1.0f), sc);
+
+					localTransform = tm * rm * sm;
+				}
+			},
+			node.transform
+		);
+		memcpy(cooked.localTransform, &localTransform, sizeof(localTransform));
+
+		scene.nodes.push_back(cooked);
+	}
+
+	for (size_t i = 0; i < gltf.nodes.size(); i++) {
+		for (auto& c : gltf.nodes[i].children) {
+			scene.nodes[c].parentIndex = (int32_t)i;
+		}
+	}
+
+	if (!scenecache::write(cachePath, scene)) {
+		return 1;
+	}
+
+	std::cout << "Cooked " << sourcePath << " -> " << cachePath << ": "
+		<< scene.meshes.size() << " meshes, "
+		<< scene.images.size() << " images, "
+		<< scene.nodes.size() << " nodes" << std::endl;
+
+	return 0;
+}
@@ -1,14 +1,48 @@
 #pragma once
 
-#include <functional>
-#include <deque>
+#include <volk.h>
+#include <vk_mem_alloc.h>
+#include <vector>
+#include <cstdint>
 
+// vulkan objects waiting for the gpu to be done with them. each push carries a retire value (a frame number
+// or timeline value) and flush destroys everything tagged at or below the value known to be complete.
+// one array per handle type, so once they have grown nothing here allocates
 class nuDeletionQueue {
     public:
-        void push_function(std::function<void()>&& function); // inefficient at scale...
-        void flush();
-        
+        void init(VkDevice device, VmaAllocator allocator);
+
+        void push_buffer(VkBuffer buffer, VmaAllocation allocation, uint64_t retireValue);
+        void push_image(VkImage image, VmaAllocation allocation, uint64_t retireValue);
+        void push_image_view(VkImageView imageView, uint64_t retireValue);
+        void push_sampler(VkSampler sampler, uint64_t retireValue);
+        void push_swapchain(VkSwapchainKHR swapchain, uint64_t retireValue);
+        void push_descriptor_pool(VkDescriptorPool pool, uint64_t retireValue);
+        void push_command_pool(VkCommandPool pool, uint64_t retireValue);
+        void push_accel_struct(VkAccelerationStructureKHR accel, uint64_t retireValue);
+
+        // views before images, images and accel structs before buffers, pools last
+        void flush(uint64_t completedValue);
+        void flush_all();
+
     private:
-        std::deque<std::function<void()>> _deletionQueue;
+        template<typename T>
+        struct Retiring {
+            T handle;
+            VmaAllocation allocation;
+            uint64_t retireValue;
+        };
+
+        VkDevice _device{ VK_NULL_HANDLE };
+        VmaAllocator _allocator{ VK_NULL_HANDLE };
+
+        std::vector<Retiring<VkImageView>> _imageViews;
+        std::vector<Retiring<VkSwapchainKHR>> _swapchains;
+        std::vector<Retiring<VkImage>> _images;
+        std::vector<Retiring<VkAccelerationStructureKHR>> _accelStructs;
+        std::vector<Retiring<VkBuffer>> _buffers;
+        std::vector<Retiring<VkSampler>> _samplers;
+        std::vector<Retiring<VkDescriptorPool>> _descriptorPools;
+        std::vector<Retiring<VkCommandPool>> _commandPools;
 
 };
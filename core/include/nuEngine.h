@@ -3,6 +3,7 @@
 #include <volk.h>
 #include <vulkan/vulkan_core.h>
 #include <vk_mem_alloc.h>
+#include <vector>
 
 #include "nuWindow.h"
 #include "nuDeletionQueue.h"
@@ -29,9 +30,11 @@ class nuEngine {
 
         VkSwapchainKHR _swapchain;
         VkFormat _swapchainImageFormat;
-        VkImage _swapchainImages[2];
-        VkImageView _swapchainImageViews[2];
+        std::vector<VkImage> _swapchainImages;
+        std::vector<VkImageView> _swapchainImageViews;
         VkExtent2D _swapchainExtent;
+        VkPresentModeKHR _presentMode{ VK_PRESENT_MODE_FIFO_KHR };
+        uint32_t _swapchainImageCount{ 3 };
         nuDeletionQueue _swapchainDeletionQueue;
 
 
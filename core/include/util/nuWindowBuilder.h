@@ -15,6 +15,10 @@ class nuWindowBuilder {
 
     public:
         nuWindowBuilder(VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface, VkExtent2D windowExtent, nuDeletionQueue* deletionQueue);
+        // fifo when the surface doesn't support it
+        nuWindowBuilder& setPresentMode(VkPresentModeKHR presentMode);
+        // a minimum, the driver may create more
+        nuWindowBuilder& setMinImageCount(uint32_t imageCount);
         nuSwapchainBuild_ret buildSwapchain();
 
 
@@ -24,6 +28,8 @@ class nuWindowBuilder {
         VkDevice _device;
         VkSurfaceKHR _surface;
         VkExtent2D _windowExtent;
+        VkPresentModeKHR _presentMode{ VK_PRESENT_MODE_FIFO_KHR };
+        uint32_t _minImageCount{ 3 };
         nuDeletionQueue* _deletionQueue;
 
 };
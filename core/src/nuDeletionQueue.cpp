@@ -1,13 +1,84 @@
 #include "nuDeletionQueue.h"
 
-void nuDeletionQueue::push_function(std::function<void()>&& function) {
-    _deletionQueue.push_back(function);
-}
+#include <algorithm>
 
-void nuDeletionQueue::flush() {
-    for (auto it = _deletionQueue.rbegin() ; it != _deletionQueue.rend() ; it++) {
-        (*it)();
+// destroys the retired entries newest first and drops them, the vector keeps its capacity
+template<typename T, typename Destroy>
+static void retire(std::vector<T>& entries, uint64_t completedValue, Destroy&& destroy) {
+    for (auto it = entries.rbegin() ; it != entries.rend() ; it++) {
+        if (it->retireValue <= completedValue) {
+            destroy(*it);
+        }
     }
 
-    _deletionQueue.clear();
+    std::erase_if(entries, [&](const T& entry) { return entry.retireValue <= completedValue; });
+}
+
+void nuDeletionQueue::init(VkDevice device, VmaAllocator allocator) {
+    _device = device;
+    _allocator = allocator;
+}
+
+void nuDeletionQueue::push_buffer(VkBuffer buffer, VmaAllocation allocation, uint64_t retireValue) {
+    _buffers.push_back({ buffer, allocation, retireValue });
+}
+
+void nuDeletionQueue::push_image(VkImage image, VmaAllocation allocation, uint64_t retireValue) {
+    _images.push_back({ image, allocation, retireValue });
+}
+
+void nuDeletionQueue::push_image_view(VkImageView imageView, uint64_t retireValue) {
+    _imageViews.push_back({ imageView, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::push_sampler(VkSampler sampler, uint64_t retireValue) {
+    _samplers.push_back({ sampler, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::push_swapchain(VkSwapchainKHR swapchain, uint64_t retireValue) {
+    _swapchains.push_back({ swapchain, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::push_descriptor_pool(VkDescriptorPool pool, uint64_t retireValue) {
+    _descriptorPools.push_back({ pool, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::push_command_pool(VkCommandPool pool, uint64_t retireValue) {
+    _commandPools.push_back({ pool, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::push_accel_struct(VkAccelerationStructureKHR accel, uint64_t retireValue) {
+    _accelStructs.push_back({ accel, VK_NULL_HANDLE, retireValue });
+}
+
+void nuDeletionQueue::flush(uint64_t completedValue) {
+    retire(_imageViews, completedValue, [&](const auto& entry) {
+        vkDestroyImageView(_device, entry.handle, nullptr);
+    });
+    // the swapchain owns its images, only their views were ours
+    retire(_swapchains, completedValue, [&](const auto& entry) {
+        vkDestroySwapchainKHR(_device, entry.handle, nullptr);
+    });
+    retire(_images, completedValue, [&](const auto& entry) {
+        vmaDestroyImage(_allocator, entry.handle, entry.allocation);
+    });
+    retire(_accelStructs, completedValue, [&](const auto& entry) {
+        vkDestroyAccelerationStructureKHR(_device, entry.handle, nullptr);
+    });
+    retire(_buffers, completedValue, [&](const auto& entry) {
+        vmaDestroyBuffer(_allocator, entry.handle, entry.allocation);
+    });
+    retire(_samplers, completedValue, [&](const auto& entry) {
+        vkDestroySampler(_device, entry.handle, nullptr);
+    });
+    retire(_descriptorPools, completedValue, [&](const auto& entry) {
+        vkDestroyDescriptorPool(_device, entry.handle, nullptr);
+    });
+    retire(_commandPools, completedValue, [&](const auto& entry) {
+        vkDestroyCommandPool(_device, entry.handle, nullptr);
+    });
+}
+
+void nuDeletionQueue::flush_all() {
+    flush(UINT64_MAX);
 }
@@ -30,6 +30,8 @@ void nuEngine::init() {
         _asyncComputeQueueFamily = build.async_compute_queue_family;
     }
 
+    _swapchainDeletionQueue.init(_device, _allocator);
+
     init_swapchain();
 }
 
@@ -66,7 +68,9 @@ void nuEngine::run() {
 }
 
 void nuEngine::cleanup() {
+    vkDeviceWaitIdle(_device);
 
+    _swapchainDeletionQueue.flush_all();
 }
 
 void nuEngine::init_sdl() {
@@ -94,13 +98,14 @@ void nuEngine::init_sdl() {
 void nuEngine::init_swapchain()
 {
     nuWindowBuilder windowBuilder(_physicalDevice, _device, _surface, _windowExtent, &_swapchainDeletionQueue);
-    nuSwapchainBuild_ret build = windowBuilder.buildSwapchain();
+    nuSwapchainBuild_ret build = windowBuilder
+        .setPresentMode(_presentMode)
+        .setMinImageCount(_swapchainImageCount)
+        .buildSwapchain();
     _swapchain = build.swapchain;
     _swapchainImageFormat = build.swapchain_image_format;
-    _swapchainImages[0] = build.swapchain_images[0];
-    _swapchainImages[1] = build.swapchain_images[1];
-    _swapchainImageViews[0] = build.swapchain_image_views[0];
-    _swapchainImageViews[1] = build.swapchain_image_views[1];
+    _swapchainImages = build.swapchain_images;
+    _swapchainImageViews = build.swapchain_image_views;
     _swapchainExtent = build.swapchain_extent;
 }
 
@@ -9,6 +9,16 @@ nuWindowBuilder::nuWindowBuilder(VkPhysicalDevice physicalDevice, VkDevice devic
     _deletionQueue = deletionQueue;
 }
 
+nuWindowBuilder& nuWindowBuilder::setPresentMode(VkPresentModeKHR presentMode) {
+    _presentMode = presentMode;
+    return *this;
+}
+
+nuWindowBuilder& nuWindowBuilder::setMinImageCount(uint32_t imageCount) {
+    _minImageCount = imageCount;
+    return *this;
+}
+
 nuSwapchainBuild_ret nuWindowBuilder::buildSwapchain() {
     vkb::SwapchainBuilder swapBuilder{ _physicalDevice, _device, _surface };
 
@@ -16,7 +26,8 @@ nuSwapchainBuild_ret nuWindowBuilder::buildSwapchain() {
 
     vkb::Swapchain vkbSwapchain = swapBuilder
         .set_desired_format(VkSurfaceFormatKHR{ .format = _swapchainBuild.swapchain_image_format, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR })
-        .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+        .set_desired_present_mode(_presentMode)
+        .set_desired_min_image_count(_minImageCount)
         .set_desired_extent(_windowExtent.width, _windowExtent.height)
         .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
         .build()
@@ -27,5 +38,10 @@ nuSwapchainBuild_ret nuWindowBuilder::buildSwapchain() {
     _swapchainBuild.swapchain_images = vkbSwapchain.get_images().value();
     _swapchainBuild.swapchain_image_views = vkbSwapchain.get_image_views().value();
 
+    _deletionQueue->push_swapchain(_swapchainBuild.swapchain, 0);
+    for (VkImageView imageView : _swapchainBuild.swapchain_image_views) {
+        _deletionQueue->push_image_view(imageView, 0);
+    }
+
     return _swapchainBuild;
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// zones each thread keeps, older ones are overwritten
+constexpr uint32_t CPU_TRACE_EVENTS_PER_THREAD = 1 << 16;
+
+// scoped cpu zones recorded into one ring per thread and dumped as chrome trace json, which chrome://tracing
+// and ui.perfetto.dev open. while tracing is off a zone costs a relaxed load, while it is on two clock reads
+// and a write into the thread's own ring. building with AVI_DISABLE_TRACING compiles the zones out, timed
+// zones stay as plain timers
+namespace cputrace {
+	namespace detail {
+		extern std::atomic<bool> enabled;
+	}
+
+	inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+	void set_enabled(bool enabled);
+	// the thread's name in the trace, call it from the thread itself
+	void set_thread_name(const char* name);
+	// everything the rings still hold, threads may keep recording while it runs and a zone finished
+	// during the dump can come out torn
+	bool dump_chrome_trace(const std::string& path);
+
+	uint64_t now_ns();
+	// name has to outlive the dump, zones are named with string literals
+	void record(const char* name, uint64_t beginNs, uint64_t endNs);
+
+	class Zone {
+	public:
+		explicit Zone(const char* name) : _name(name), _beginNs(enabled() ? now_ns() : 0) {}
+		// timed whether tracing is on or not, the zone's length in milliseconds goes to elapsedMs when it ends
+		Zone(const char* name, float* elapsedMs) : _name(name), _elapsedMs(elapsedMs), _beginNs(now_ns()) {}
+		~Zone()
+		{
+			if (_beginNs == 0) {
+				return;
+			}
+
+			uint64_t endNs = now_ns();
+			if (_elapsedMs != nullptr) {
+				*_elapsedMs = (endNs - _beginNs) / 1e6f;
+			}
+#ifndef AVI_DISABLE_TRACING
+			if (enabled()) {
+				record(_name, _beginNs, endNs);
+			}
+#endif // AVI_DISABLE_TRACING
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		const char* _name;
+		float* _elapsedMs{ nullptr };
+		uint64_t _beginNs;
+	};
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifndef AVI_DISABLE_TRACING
+#define TRACE_ZONE(name) cputrace::Zone TRACE_CONCAT(traceZone, __LINE__)(name)
+#else
+#define TRACE_ZONE(name)
+#endif // AVI_DISABLE_TRACING
+#define TRACE_ZONE_TIMED(name, elapsedMs) cputrace::Zone TRACE_CONCAT(traceZone, __LINE__)(name, elapsedMs)
+
+#define TRACE_FUNCTION() TRACE_ZONE(__func__)
+#define TRACE_FUNCTION_TIMED(elapsedMs) TRACE_ZONE_TIMED(__func__, elapsedMs)
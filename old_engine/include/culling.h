@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+// clip space planes (-w <= x,y <= w, 0 <= z <= w) pulled out of a view-projection matrix.
+// normals point inwards, so a point is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum {
+	glm::vec4 planes[6];
+
+	static Frustum from_view_proj(const glm::mat4& viewProj);
+};
+
+// world space aabbs in structure-of-arrays form. the arrays are padded to a multiple of 8 so the
+// culling kernel can test 4 (sse) or 8 (avx) boxes per iteration without a scalar tail.
+// meant to be refilled every frame, clear() keeps the allocations around
+struct CullingBounds {
+public:
+	void clear();
+	void reserve(size_t count);
+	// origin/extents are the local space box, transform takes it to world space
+	void add(const glm::mat4& transform, const glm::vec3& origin, const glm::vec3& extents);
+
+	// appends the index of every box touching the frustum to visible, returns how many were culled
+	uint32_t cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+	uint32_t size() const { return count; }
+
+private:
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> extentX;
+	std::vector<float> extentY;
+	std::vector<float> extentZ;
+	uint32_t count{ 0 };
+};
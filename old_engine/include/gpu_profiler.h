@@ -0,0 +1,74 @@
+#pragma once
+#include "vk_types.h"
+
+#include <string>
+#include <vector>
+
+// timestamp pairs one frame can record, scopes past it are dropped
+constexpr uint32_t GPU_PROFILER_MAX_SCOPES = 32;
+// frames kept for the csv export
+constexpr uint32_t GPU_PROFILER_HISTORY = 600;
+
+struct GpuScopeTiming {
+	// has to outlive the profiler, scopes are named with string literals
+	const char* name;
+	uint32_t depth;
+	// relative to the first timestamp of the frame
+	float beginMs;
+	float endMs;
+};
+
+struct GpuFrameTimings {
+	uint64_t frameNumber{ 0 };
+	std::vector<GpuScopeTiming> scopes;
+};
+
+// named, nestable timestamp scopes on the graphics queue. every frame slot owns a range of one query pool,
+// reset from the host when the slot is reused and read back then without waiting, its previous frame is
+// complete by that point. so the timings shown are always the ones of the latest frame that finished
+class GpuProfiler {
+public:
+	// stays disabled and records nothing when the queue family has no timestamp support
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameSlots);
+	void destroy();
+
+	// only once the frame that last used the slot has completed
+	void begin_frame(uint32_t slot, uint64_t frameNumber);
+	// returns the scope to end, outside of any rendering pass that takes secondary command buffers
+	uint32_t begin_scope(VkCommandBuffer cmd, const char* name);
+	void end_scope(VkCommandBuffer cmd, uint32_t scope);
+
+	bool enabled() const { return _queryPool != VK_NULL_HANDLE; }
+	const GpuFrameTimings& latest() const { return _latest; }
+	// one line per scope of every frame in the history
+	bool export_csv(const std::string& path) const;
+
+private:
+	struct RecordedScope {
+		const char* name;
+		uint32_t depth;
+	};
+
+	struct Slot {
+		uint64_t frameNumber{ 0 };
+		std::vector<RecordedScope> scopes;
+	};
+
+	void read_back(Slot& slot, uint32_t slotIndex);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkQueryPool _queryPool{ VK_NULL_HANDLE };
+	// nanoseconds per tick
+	float _timestampPeriod{ 0.0f };
+	uint64_t _timestampMask{ 0 };
+
+	std::vector<Slot> _slots;
+	uint32_t _currentSlot{ 0 };
+	uint32_t _depth{ 0 };
+	std::vector<uint64_t> _results;
+
+	GpuFrameTimings _latest;
+	// ring of the last GPU_PROFILER_HISTORY frames, _historyNext is the oldest once it is full
+	std::vector<GpuFrameTimings> _history;
+	uint32_t _historyNext{ 0 };
+};
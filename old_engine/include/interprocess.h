@@ -5,13 +5,15 @@
 #include <boost/interprocess/containers/string.hpp>
 #include <boost/interprocess/allocators/allocator.hpp>
 #include <boost/unordered_map.hpp>
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <utility>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
-#include <unordered_map>
+#include <string>
+#include <vector>
 #include "vk_types.h"
 
 namespace bip = boost::interprocess;
@@ -22,14 +24,80 @@ typedef ShmemString HashKeyType;
 struct Transform {
     float array[16] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
 };
-typedef Transform HashMappedType;
-typedef std::pair<const ShmemString, Transform> HashValueType;
-typedef bip::allocator<HashValueType, bip::managed_shared_memory::segment_manager> HashMemAllocator;
-typedef boost::unordered_map<HashKeyType, HashMappedType, boost::hash<HashKeyType>, std::equal_to<HashKeyType>, HashMemAllocator> HashMap;
+static_assert(sizeof(Transform) == sizeof(glm::mat4));
+
+constexpr uint32_t SNAPSHOT_BUFFER_COUNT = 3;
+
+// triple buffer handoff between one producer and the renderer, neither side ever waits on the
+// other. the producer fills the buffer it owns and swaps it into the middle, the renderer swaps
+// the middle out for its own buffer whenever a newer frame is there. both sides only ever see
+// whole frames, generations tell which one
+struct SnapshotExchange {
+    static constexpr uint32_t FRESH_BIT = 4;
+    static constexpr uint32_t INDEX_MASK = 3;
+
+    // buffer waiting in the middle, FRESH_BIT while the renderer hasn't picked it up yet
+    std::atomic<uint32_t> middle;
+    // only touched by the producer, kept here so a restarted producer can pick up where it left off
+    uint32_t producerBuffer;
+    // frame each buffer holds, written before the buffer is handed over
+    uint64_t generations[SNAPSHOT_BUFFER_COUNT];
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+// shared memory layout, created by the renderer at startup:
+//   "SlotDirectory"    node name -> slot, published once and only read afterwards
+//   "SnapshotExchange" the handoff state above
+//   "Transforms"       SNAPSHOT_BUFFER_COUNT buffers of slot count world transforms back to back,
+//                      slot 0 of each is the camera basis
+// a producer resolves its names through the directory once and from then on writes by index
+typedef std::pair<const ShmemString, uint32_t> SlotValueType;
+typedef bip::allocator<SlotValueType, bip::managed_shared_memory::segment_manager> SlotMemAllocator;
+typedef boost::unordered_map<HashKeyType, uint32_t, boost::hash<HashKeyType>, std::equal_to<HashKeyType>, SlotMemAllocator> SlotDirectory;
 class Interprocess {
     public:
-        Interprocess(const std::unordered_map<std::string, std::shared_ptr<Node>> &nodeMap);
+        static constexpr uint32_t CAMERA_SLOT = 0;
+
+        // names get the slots after the camera in the order given, seeded with their current transform
+        Interprocess(const std::vector<std::pair<std::string, glm::mat4>> &publishedTransforms);
         void destroy();
+
+        uint32_t slot_count() const { return _slotCount; }
+        // swaps in the newest published frame, false when nothing arrived since the last call
+        bool acquire_transforms();
+        // the frame picked by the last acquire, stays untouched by the producer until the next one
+        const glm::mat4 *transforms() const;
+        uint64_t generation() const { return _exchange->generations[_readBuffer]; }
+
+        bip::managed_shared_memory _segment;
+        bip::offset_ptr<SlotDirectory> _directory;
+        bip::offset_ptr<SnapshotExchange> _exchange;
+        bip::offset_ptr<Transform> _transforms;
+        uint32_t _slotCount{ 0 };
+        uint32_t _readBuffer{ 0 };
+};
+
+// producer side of the exchange, for the process driving the transforms
+class TransformPublisher {
+    public:
+        static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+        // opens the segment the renderer created, false if it isn't there yet
+        bool open();
+
+        uint32_t slot(const char *name) const;
+        uint32_t slot_count() const { return _slotCount; }
+
+        // buffer to fill for the next frame, already holding the last published one
+        Transform *begin_frame();
+        void publish();
+
+    private:
         bip::managed_shared_memory _segment;
-        bip::offset_ptr<HashMap> _map;
+        SlotDirectory *_directory{ nullptr };
+        SnapshotExchange *_exchange{ nullptr };
+        Transform *_transforms{ nullptr };
+        uint32_t _slotCount{ 0 };
+        uint32_t _lastPublished{ 0 };
+        uint64_t _generation{ 0 };
 };
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// import time index and vertex reordering. nothing in here depends on vulkan, nu-cook runs the
+// same passes before writing the scene cache so a cooked scene pays for them once.
+//
+// the passes, in the order optimize_mesh runs them:
+//  - weld: vertices that are identical byte for byte are merged
+//  - vertex cache: triangles are reordered with tipsify (Sander et al. 2007) for a small fifo cache
+//  - overdraw: the resulting clusters are sorted so outward facing ones are drawn first
+//  - vertex fetch: vertices are renumbered in the order the index buffer first touches them
+//
+// generate_lods runs afterwards and appends simplified copies of every surface to the same index buffer,
+// generate_meshlets then splits every level into clusters the cull pass can reject one by one
+
+// lod 0 included
+constexpr uint32_t MAX_MESH_LODS = 4;
+// the usual mesh shader limits, small enough that a cluster's bounds and normal cone stay tight
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// one level of detail of a surface. error is how far, in object space, the level may be off from lod 0.
+// meshletCount is 0 until generate_meshlets ran, the level is then drawn as a whole
+struct MeshLod {
+	uint32_t startIndex;
+	uint32_t count;
+	float error;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+};
+
+// a run of triangles of one lod, contiguous in the index buffer so it can be drawn on its own.
+// center and radius bound it in object space, every triangle normal lies within the cone around coneAxis.
+// coneCutoff is the sine of the cone's half angle, 1 when the cone is too wide to ever be back facing.
+// layout matches Meshlet in cull.comp
+struct Meshlet {
+	float center[3];
+	float radius;
+	float coneAxis[3];
+	float coneCutoff;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t pad[2];
+};
+
+namespace meshopt {
+
+	// matches the post transform cache of current hardware closely enough, the ordering is not sensitive to it
+	constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+	// how much worse than the cache order a cluster may get when it is split for the overdraw pass
+	constexpr float OVERDRAW_THRESHOLD = 1.05f;
+	// a level that keeps more than this much of the previous one is not worth the indices
+	constexpr float LOD_MIN_REDUCTION = 0.85f;
+
+	// merges duplicate vertices in place and rewrites the indices, returns the new vertex count
+	size_t weld_vertices(uint32_t* indices, size_t indexCount, void* vertices, size_t vertexCount, size_t vertexSize);
+
+	// reorders the triangles of one index range. clusters receives the first triangle of every run that
+	// starts from an empty cache, which is where the overdraw pass may move things around
+	void optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& clusters);
+
+	// positions point at the first vertex's float3 position, vertexStride apart
+	void optimize_overdraw(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& clusters,
+		const uint8_t* positions, size_t vertexStride, size_t vertexCount, float threshold);
+
+	// renumbers the vertices in first use order and drops the unreferenced ones, returns the new vertex count
+	size_t optimize_vertex_fetch(uint32_t* indices, size_t indexCount, void* vertices, size_t vertexCount, size_t vertexSize);
+
+	// splits one index range into meshlets in its current order, a meshlet is closed when it is full, when
+	// the next triangle shares no vertex with it or when the triangle would widen its normal cone too much.
+	// the cache order keeps them compact, indexOffset is added to every firstIndex
+	void build_meshlets(const uint32_t* indices, size_t indexCount, uint32_t indexOffset,
+		const uint8_t* positions, size_t vertexStride, std::vector<Meshlet>& meshlets);
+
+	// quadric error edge collapse (Garland and Heckbert 1997) onto existing vertices, so no attribute is ever
+	// interpolated. vertices on open borders, non-manifold edges and attribute seams stay where they are.
+	// writes at most indexCount indices to destination and returns how many, error gets the object space distance
+	size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+		const uint8_t* positions, size_t vertexStride, size_t vertexCount, size_t targetIndexCount, float& error);
+
+	// every pass on one mesh. V needs a float3 position member, Surface a startIndex and count into indices.
+	// triangles never move between surfaces, so the surfaces and their bounds stay valid
+	template<typename V, typename Surface>
+	void optimize_mesh(std::vector<uint32_t>& indices, std::vector<V>& vertices, const std::vector<Surface>& surfaces)
+	{
+		if (vertices.empty() || indices.empty()) {
+			return;
+		}
+
+		vertices.resize(weld_vertices(indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(V)));
+
+		const uint8_t* positions = reinterpret_cast<const uint8_t*>(vertices.data()) + offsetof(V, position);
+		std::vector<uint32_t> clusters;
+		for (const Surface& surface : surfaces) {
+			uint32_t* surfaceIndices = indices.data() + surface.startIndex;
+			optimize_vertex_cache(surfaceIndices, surface.count, vertices.size(), clusters);
+			optimize_overdraw(surfaceIndices, surface.count, clusters, positions, sizeof(V), vertices.size(), OVERDRAW_THRESHOLD);
+		}
+
+		vertices.resize(optimize_vertex_fetch(indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(V)));
+	}
+
+	// fills surface.lods and surface.lodCount. every level is simplified from the one before to about half its
+	// triangles and appended to indices, lod 0 stays the surface's own range. expects welded vertices
+	template<typename V, typename Surface>
+	void generate_lods(std::vector<uint32_t>& indices, const std::vector<V>& vertices, std::vector<Surface>& surfaces)
+	{
+		const uint8_t* positions = reinterpret_cast<const uint8_t*>(vertices.data()) + offsetof(V, position);
+		std::vector<uint32_t> lodIndices;
+		std::vector<uint32_t> clusters;
+
+		for (Surface& surface : surfaces) {
+			surface.lods[0] = MeshLod{ surface.startIndex, surface.count, 0.0f, 0, 0 };
+			surface.lodCount = 1;
+
+			while (surface.lodCount < MAX_MESH_LODS) {
+				MeshLod previous = surface.lods[surface.lodCount - 1];
+				size_t target = previous.count / 6 * 3;
+
+				float error;
+				lodIndices.resize(previous.count);
+				size_t count = simplify(lodIndices.data(), indices.data() + previous.startIndex, previous.count,
+					positions, sizeof(V), vertices.size(), target, error);
+				if (count == 0 || count > previous.count * LOD_MIN_REDUCTION) {
+					break;
+				}
+
+				optimize_vertex_cache(lodIndices.data(), count, vertices.size(), clusters);
+				// each level is measured against the one before, the sum bounds the distance to lod 0
+				surface.lods[surface.lodCount++] = MeshLod{ (uint32_t)indices.size(), (uint32_t)count, previous.error + error, 0, 0 };
+				indices.insert(indices.end(), lodIndices.begin(), lodIndices.begin() + count);
+			}
+		}
+	}
+
+	// fills firstMeshlet/meshletCount of every lod of every surface, run it once the index buffer is final
+	template<typename V, typename Surface>
+	void generate_meshlets(const std::vector<uint32_t>& indices, const std::vector<V>& vertices, std::vector<Surface>& surfaces, std::vector<Meshlet>& meshlets)
+	{
+		const uint8_t* positions = reinterpret_cast<const uint8_t*>(vertices.data()) + offsetof(V, position);
+
+		for (Surface& surface : surfaces) {
+			for (uint32_t l = 0; l < surface.lodCount; l++) {
+				MeshLod& lod = surface.lods[l];
+				lod.firstMeshlet = (uint32_t)meshlets.size();
+				build_meshlets(indices.data() + lod.startIndex, lod.count, lod.startIndex, positions, sizeof(V), meshlets);
+				lod.meshletCount = (uint32_t)meshlets.size() - lod.firstMeshlet;
+			}
+		}
+	}
+
+}
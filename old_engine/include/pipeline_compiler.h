@@ -0,0 +1,65 @@
+#pragma once
+#include "vk_types.h"
+#include "vk_pipelines.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// builds graphics pipelines on its own threads so neither startup nor a new material variant waits
+// on the driver. compile() returns right away and the pipeline shows up in the MaterialPipeline once
+// it is done, until then draws go through the target's fallback.
+//
+// with VK_EXT_graphics_pipeline_library every builder is split into its vertex input, pre-raster,
+// fragment shader and fragment output parts. those are compiled once per distinct state and shared,
+// so a variant that only changes blending or depth writes reuses the compiled shaders and costs a
+// link. a fast link is published first and replaced by an optimized link in a second pass
+class PipelineCompiler {
+public:
+	void init(VkDevice device, VkPipelineCache cache, bool useLibraries, bool fastLinking, uint32_t threadCount);
+	// drops whatever is still queued, the pipelines already published stay with their targets
+	void destroy();
+
+	// the builder is copied, its shader modules have to live until wait_idle() or destroy()
+	void compile(const PipelineBuilder& builder, MaterialPipeline* target);
+	void wait_idle();
+
+	uint32_t pending_count();
+	bool uses_libraries() const { return _useLibraries; }
+
+private:
+	struct Job {
+		PipelineBuilder builder;
+		MaterialPipeline* target;
+		bool optimize;
+	};
+
+	void worker_loop();
+	void run_job(Job& job);
+	VkPipeline get_library(const PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT part);
+	void publish(MaterialPipeline* target, VkPipeline pipeline);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VkPipelineCache _cache{ VK_NULL_HANDLE };
+	bool _useLibraries{ false };
+	bool _fastLinking{ false };
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _jobAvailable;
+	std::condition_variable _idle;
+	std::deque<Job> _jobs;
+	// queued plus running
+	uint32_t _pending{ 0 };
+	bool _quit{ false };
+
+	// keyed by the bytes of the state each part depends on
+	std::mutex _libraryMutex;
+	std::unordered_map<std::string, VkPipeline> _libraries;
+	// replaced pipelines can still be referenced by frames in flight, they go away in destroy()
+	std::vector<VkPipeline> _retired;
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "mesh_optimizer.h"
+
+// on-disk layout of a cooked scene. written by nu-cook, mapped read-only by vkutil::load_gltf.
+// every table is 16 byte aligned and used in place, nothing in here depends on vulkan so the
+// cooker can build without it. bump SCENE_CACHE_VERSION whenever a struct here changes
+constexpr uint32_t SCENE_CACHE_MAGIC = 0x4353554e; // "NUSC"
+constexpr uint32_t SCENE_CACHE_VERSION = 6;
+constexpr const char* SCENE_CACHE_EXTENSION = ".nucache";
+constexpr int32_t SCENE_CACHE_NONE = -1;
+
+// same layout as PackedVertex in vertex_format.h, cooked scenes always use the compact format
+struct CookedVertex {
+	float position[3];
+	uint32_t normal;
+	uint32_t uv;
+	uint32_t color;
+};
+
+// filters are the raw glTF enum values, converted with vkutil::extract_filter on load
+struct CookedSampler {
+	uint32_t magFilter;
+	uint32_t minFilter;
+};
+
+// mip chain in format (a TextureFormat value), largest level first and tightly packed
+struct CookedImage {
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t format;
+	uint64_t texelOffset;
+	uint64_t texelSize;
+};
+
+struct CookedMaterial {
+	uint32_t nameOffset;
+	uint32_t passType; // MaterialPass value
+	int32_t colorImage;
+	int32_t colorSampler;
+	int32_t metalRoughImage;
+	int32_t metalRoughSampler;
+	int32_t normalImage;
+	int32_t normalSampler;
+	float colorFactors[4];
+	float metalRoughFactors[4];
+	uint32_t doubleSided;
+	uint32_t pad[3];
+};
+
+// startIndex/count is lod 0, the same range as lods[0]
+struct CookedSurface {
+	uint32_t startIndex;
+	uint32_t count;
+	int32_t materialIndex;
+	float sphereRadius;
+	float origin[4];
+	float extents[4];
+	uint32_t lodCount;
+	uint32_t pad[3];
+	MeshLod lods[MAX_MESH_LODS];
+};
+
+// firstVertex/firstIndex/firstMeshlet index into the scene wide streams, indices and the meshlets'
+// firstIndex are relative to the mesh, as are the lods' firstMeshlet.
+// the first baseIndexCount indices are lod 0 of every surface, the lower lods follow
+struct CookedMesh {
+	uint32_t nameOffset;
+	uint32_t firstSurface;
+	uint32_t surfaceCount;
+	uint32_t baseIndexCount;
+	uint64_t firstVertex;
+	uint64_t vertexCount;
+	uint64_t firstIndex;
+	uint64_t indexCount;
+	uint64_t firstMeshlet;
+	uint64_t meshletCount;
+};
+
+// nodes are stored in glTF order, children always reference their parent by index
+struct CookedNode {
+	uint32_t nameOffset;
+	int32_t meshIndex;
+	int32_t parentIndex;
+	uint32_t pad;
+	float localTransform[16];
+};
+
+struct SceneCacheSection {
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct SceneCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	// size and write time of the source file the cache was cooked from. the hash of its contents is only
+	// checked when the write time moved, so a checkout or copy that touches the file keeps the cache
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	uint64_t sourceHash;
+
+	SceneCacheSection samplers;
+	SceneCacheSection images;
+	SceneCacheSection materials;
+	SceneCacheSection surfaces;
+	SceneCacheSection meshes;
+	SceneCacheSection nodes;
+	SceneCacheSection vertices;
+	SceneCacheSection indices;
+	SceneCacheSection meshlets;
+	SceneCacheSection texels;
+	SceneCacheSection strings;
+};
+
+// everything the cooker collects before writing, mirrors the sections of the header
+struct CookedScene {
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	uint64_t sourceHash;
+
+	std::vector<CookedSampler> samplers;
+	std::vector<CookedImage> images;
+	std::vector<CookedMaterial> materials;
+	std::vector<CookedSurface> surfaces;
+	std::vector<CookedMesh> meshes;
+	std::vector<CookedNode> nodes;
+	std::vector<CookedVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint8_t> texels;
+	std::string strings;
+
+	uint32_t add_string(std::string_view str);
+};
+
+// read-only mapping of a cache file, only valid while the source it was cooked from is unchanged
+class SceneCacheView {
+public:
+	bool open(const std::filesystem::path& cachePath, const std::filesystem::path& sourcePath);
+
+	const SceneCacheHeader& header() const { return *_header; }
+	const char* string(uint32_t offset) const;
+	const uint8_t* texels(uint64_t offset) const;
+
+	template<typename T>
+	std::span<const T> section(const SceneCacheSection& section) const
+	{
+		return { reinterpret_cast<const T*>(_base + section.offset), section.count };
+	}
+
+private:
+	boost::interprocess::file_mapping _file;
+	boost::interprocess::mapped_region _region;
+	const uint8_t* _base{ nullptr };
+	const SceneCacheHeader* _header{ nullptr };
+};
+
+namespace scenecache {
+	std::filesystem::path cache_path(const std::filesystem::path& sourcePath);
+	bool source_stamp(const std::filesystem::path& sourcePath, uint64_t& size, int64_t& writeTime);
+	// 64 bit fnv-1a of the whole file
+	bool source_hash(const std::filesystem::path& sourcePath, uint64_t& hash);
+	bool write(const std::filesystem::path& cachePath, const CookedScene& scene);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// texture formats the scene cache and the ktx2 reader hand to the loader, mapped to a VkFormat there.
+// nothing in here depends on vulkan, nu-cook compresses with it before writing the scene cache
+enum class TextureFormat : uint32_t {
+	RGBA8 = 0,
+	// 4x4 blocks of 8 bytes, rgb with 1 bit alpha. the encoder only writes opaque blocks
+	BC1 = 1,
+	// 4x4 blocks of 16 bytes, two independent channels. used for normal maps, z is rebuilt in the shader
+	BC5 = 2,
+	// 4x4 blocks of 16 bytes, rgba
+	BC7 = 3,
+};
+
+// a mip chain, levels tightly packed and largest first
+struct TextureData {
+	TextureFormat format{ TextureFormat::RGBA8 };
+	uint32_t width{ 0 };
+	uint32_t height{ 0 };
+	uint32_t mipLevels{ 0 };
+	std::vector<uint8_t> texels;
+};
+
+namespace texcodec {
+
+	// 1 for rgba8, 4 for the block compressed formats
+	uint32_t block_extent(TextureFormat format);
+	// bytes per block, a texel counts as a block for rgba8
+	uint32_t block_bytes(TextureFormat format);
+	size_t level_size(TextureFormat format, uint32_t width, uint32_t height, uint32_t level);
+	// same chain length as VulkanEngine::create_image
+	uint32_t full_mip_count(uint32_t width, uint32_t height);
+
+	// rgba8 chain down to 1x1, each level a 2x2 box filter of the one above
+	void build_mips(const uint8_t* pixels, uint32_t width, uint32_t height, TextureData& out);
+	// true when a texel of the first level is not fully opaque
+	bool has_alpha(const TextureData& texture);
+	// re-encodes an rgba8 chain level by level, partial blocks at the edges repeat the last row and column
+	void compress(TextureData& texture, TextureFormat format);
+
+	bool is_ktx2(const uint8_t* data, size_t size);
+	// uncompressed containers of rgba8 or one of the bc formats above, basis and zstd supercompression
+	// are refused. a file without mips gets them built here when it is rgba8. prints why it failed
+	bool load_ktx2(const uint8_t* data, size_t size, TextureData& out);
+}
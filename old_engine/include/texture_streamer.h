@@ -0,0 +1,87 @@
+#pragma once
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "vk_types.h"
+
+class DeletionQueue;
+
+// levels up to this many texels on the longer side are always resident
+constexpr uint32_t STREAM_TAIL_SIZE = 64;
+// a texture no object was drawn with for this many frames only wants its tail
+constexpr uint64_t STREAM_IDLE_FRAMES = 240;
+// upper bound on the texel bytes queued by one update, a single texture may go over it
+constexpr VkDeviceSize STREAM_UPLOAD_BYTES_PER_FRAME = 32 * 1024 * 1024;
+
+// keeps the finer mips of a texture off the gpu until the cull pass reports that a material sampling it
+// covers enough pixels for them. a texture starts with only its tail resident and is replaced by a copy
+// with more or fewer levels whenever the estimate changes, the materials follow through the bindless table.
+// the resident total is kept under a budget by dropping levels of the textures unseen the longest first
+class TextureStreamer {
+public:
+	void init(VulkanEngine* engine, VkDeviceSize budget);
+	// destroys whatever was not removed, the device has to be idle
+	void destroy();
+
+	// texels holds mipLevels tightly packed levels of format, largest first, and has to stay valid while owner is held.
+	// the handle stays the same while the image behind it is replaced
+	uint32_t add_texture(std::shared_ptr<const void> owner, const uint8_t* texels, VkExtent3D extent, VkFormat format, uint32_t mipLevels);
+	// only call it once no frame in flight can sample the texture
+	void remove_texture(uint32_t handle);
+	// the image to build materials with right now
+	const AllocatedImage& image(uint32_t handle) const { return _textures[handle].image; }
+
+	// materialPixels is the cull pass readback, the largest on screen diameter in pixels of an object drawn with
+	// each material, or null when there is none. swaps in finished uploads, queues new ones and hands the images
+	// and bindless slots they replace to deletionQueue, tagged with retireValue
+	void update(const uint32_t* materialPixels, uint32_t materialCount, DeletionQueue& deletionQueue, uint64_t retireValue);
+
+	void set_budget(VkDeviceSize budget) { _budget = budget; }
+	VkDeviceSize budget() const { return _budget; }
+	// bytes of every texture at the levels it has or is being uploaded with
+	VkDeviceSize committed_bytes() const { return _committedBytes; }
+	uint32_t pending_count() const { return _pendingCount; }
+
+private:
+	struct StreamedTexture {
+		std::shared_ptr<const void> owner;
+		const uint8_t* texels{ nullptr };
+		VkExtent3D extent{};
+		VkFormat format{ VK_FORMAT_UNDEFINED };
+		uint32_t mipLevels{ 0 };
+		// the coarsest level the texture ever drops to
+		uint32_t tailMip{ 0 };
+
+		AllocatedImage image{};
+		uint32_t residentMip{ 0 };
+		// replacement in flight on the uploader, swapped in once uploadTicket completes
+		AllocatedImage pendingImage{};
+		uint32_t pendingMip{ 0 };
+		uint64_t uploadTicket{ 0 };
+		bool pending{ false };
+
+		uint32_t wantedMip{ 0 };
+		uint32_t requiredPixels{ 0 };
+		uint64_t lastSeenFrame{ 0 };
+		bool live{ false };
+	};
+
+	VkDeviceSize level_offset(const StreamedTexture& texture, uint32_t mip) const;
+	// levels mip and below
+	VkDeviceSize chain_size(const StreamedTexture& texture, uint32_t mip) const;
+	AllocatedImage upload_levels(StreamedTexture& texture, uint32_t mip, uint64_t& ticket);
+	void begin_replace(StreamedTexture& texture, uint32_t mip);
+	void finish_replace(uint32_t handle, DeletionQueue& deletionQueue, uint64_t retireValue);
+
+	VulkanEngine* _engine{ nullptr };
+	VkDeviceSize _budget{ 0 };
+	VkDeviceSize _committedBytes{ 0 };
+	uint32_t _pendingCount{ 0 };
+	uint64_t _frame{ 0 };
+
+	std::vector<StreamedTexture> _textures;
+	std::vector<uint32_t> _freeTextures;
+	// current image view to handle, the cull feedback reaches textures through the material table's views
+	std::unordered_map<VkImageView, uint32_t> _views;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+
+// every node of a scene in one flat store, parents always before their children. local and world
+// matrices sit in their own contiguous arrays and update() recomputes only what was marked dirty
+// in a single forward pass, a dirty parent drags its whole subtree along.
+class TransformHierarchy {
+public:
+	static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+	// parent has to be NO_PARENT or an index that was added earlier
+	uint32_t add(uint32_t parent, const glm::mat4& localTransform);
+	void clear();
+
+	void set_local(uint32_t index, const glm::mat4& localTransform);
+	// overwrites the world matrix directly for transforms driven from outside the scene. the node's
+	// children keep their world matrices until something above them is dirtied again
+	void set_world(uint32_t index, const glm::mat4& worldTransform);
+
+	const glm::mat4& local(uint32_t index) const { return localTransforms[index]; }
+	const glm::mat4& world(uint32_t index) const { return worldTransforms[index]; }
+	uint32_t parent(uint32_t index) const { return parents[index]; }
+	uint32_t size() const { return (uint32_t)parents.size(); }
+
+	// returns how many world matrices were recomputed
+	uint32_t update();
+
+	// order that puts every node after its parent, parentIndices uses -1 for roots.
+	// order[i] is the source index that ends up at position i
+	static std::vector<uint32_t> topological_order(std::span<const int32_t> parentIndices);
+
+private:
+	std::vector<uint32_t> parents;
+	std::vector<glm::mat4> localTransforms;
+	std::vector<glm::mat4> worldTransforms;
+	std::vector<uint8_t> dirty;
+	bool anyDirty{ false };
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/packing.hpp>
+
+// how a mesh's vertex buffer is laid out, read per object by pbr.vert
+constexpr uint32_t VERTEX_FORMAT_FULL = 0;
+constexpr uint32_t VERTEX_FORMAT_PACKED = 1;
+
+// half the size of Vertex. the position stays full float so blas builds and bounds read it in place,
+// the normal is octahedral encoded into two snorm16, the uv is two halves and the color rgba8.
+// nothing in here depends on vulkan, nu-cook writes these straight into the scene cache
+struct PackedVertex {
+	glm::vec3 position;
+	uint32_t normal;
+	uint32_t uv;
+	uint32_t color;
+};
+
+namespace vertexformat {
+
+	// anything non-zero works, the l1 normalization below makes it unit length again
+	inline uint32_t encode_normal(glm::vec3 n)
+	{
+		float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (length == 0.0f) {
+			return glm::packSnorm2x16(glm::vec2(0.0f));
+		}
+		n /= length;
+
+		glm::vec2 p(n.x, n.y);
+		if (n.z < 0.0f) {
+			// fold the lower hemisphere over the diagonals
+			p.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			p.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return glm::packSnorm2x16(p);
+	}
+
+	inline glm::vec3 decode_normal(uint32_t packed)
+	{
+		glm::vec2 e = glm::unpackSnorm2x16(packed);
+		glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+		float t = std::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return n / std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+	}
+
+	// colors are clamped to [0, 1]
+	inline PackedVertex pack(glm::vec3 position, glm::vec3 normal, glm::vec2 uv, glm::vec4 color)
+	{
+		PackedVertex v;
+		v.position = position;
+		v.normal = encode_normal(normal);
+		v.uv = glm::packHalf2x16(uv);
+		v.color = glm::packUnorm4x8(color);
+		return v;
+	}
+
+}
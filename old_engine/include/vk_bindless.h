@@ -0,0 +1,65 @@
+#pragma once
+#include <map>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "vk_types.h"
+
+constexpr uint32_t BINDLESS_TEXTURE_CAPACITY = 4096;
+constexpr uint32_t BINDLESS_MATERIAL_CAPACITY = 4096;
+// texture slot of removed materials in the cpu copy, never written to the gpu
+constexpr uint32_t BINDLESS_NO_TEXTURE = UINT32_MAX;
+
+// set 1 of the mesh pipelines: the constants of every material in one storage buffer and every texture
+// they sample in one combined image sampler array. a draw only carries its material index, so nothing
+// is rebound between materials and one indirect draw can cover any number of them.
+// slots are written with update after bind, loading a scene never waits on frames in flight
+class BindlessMaterialTable {
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkShaderStageFlags stages);
+	void destroy();
+
+	VkDescriptorSetLayout layout() const { return _layout; }
+	VkDescriptorSet set() const { return _set; }
+
+	// one slot per image and sampler pair, shared by every material that samples it
+	uint32_t acquire_texture(VkImageView view, VkSampler sampler);
+	void release_texture(uint32_t slot);
+	// null for free slots
+	VkImageView texture_view(uint32_t slot) const { return _textures[slot].view; }
+	// moves every material sampling view over to fresh slots showing newView. a slot frames in flight may
+	// sample can't be rewritten, so the old slots keep one reference each and are returned to the caller,
+	// who releases them once those frames have retired
+	std::vector<uint32_t> retarget_view(VkImageView view, VkImageView newView);
+
+	// takes over the texture references in data
+	uint32_t add_material(const GPUMaterialData& data);
+	// releases the material's textures too, only call it once no frame in flight can still draw with it
+	void remove_material(uint32_t index);
+	// cpu copy indexed like the gpu table, removed entries sample BINDLESS_NO_TEXTURE
+	std::span<const GPUMaterialData> materials() const { return _materials; }
+
+private:
+	struct TextureSlot {
+		VkImageView view;
+		VkSampler sampler;
+		uint32_t references;
+	};
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+
+	VkDescriptorSetLayout _layout{ VK_NULL_HANDLE };
+	VkDescriptorPool _pool{ VK_NULL_HANDLE };
+	VkDescriptorSet _set{ VK_NULL_HANDLE };
+
+	AllocatedBuffer _materialBuffer{};
+	// cpu copy, the mapped buffer may be write combined
+	std::vector<GPUMaterialData> _materials;
+	std::vector<uint32_t> _freeMaterials;
+
+	std::vector<TextureSlot> _textures;
+	std::vector<uint32_t> _freeTextures;
+	std::map<std::pair<VkImageView, VkSampler>, uint32_t> _textureLookup;
+};
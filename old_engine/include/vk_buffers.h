@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include "vk_types.h"
+
+// linear allocator over a persistently mapped buffer, meant to be owned by a FrameData and
+// reset once that frame's fence has signaled. hands out aligned sub-allocations for per-frame
+// uniform/storage data so a steady-state frame never touches vma.
+struct LinearBufferAllocator {
+public:
+	struct Allocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		void* data;
+	};
+
+	void init(VmaAllocator allocator, VkDeviceSize size, VkDeviceSize alignment, VkBufferUsageFlags usage);
+	void reset(VmaAllocator allocator);
+	void destroy(VmaAllocator allocator);
+
+	Allocation allocate(VmaAllocator allocator, VkDeviceSize size);
+
+	template<typename T>
+	Allocation push(VmaAllocator allocator, const T& value)
+	{
+		Allocation alloc = allocate(allocator, sizeof(T));
+		memcpy(alloc.data, &value, sizeof(T));
+		return alloc;
+	}
+
+	VkDeviceSize used() const { return head; }
+
+private:
+	AllocatedBuffer create_chunk(VmaAllocator allocator, VkDeviceSize size);
+
+	AllocatedBuffer buffer{};
+	// chunks created when a frame outgrew the main buffer, released on the next reset
+	std::vector<AllocatedBuffer> overflowChunks;
+	VkDeviceSize capacity{ 0 };
+	VkDeviceSize alignment{ 1 };
+	VkDeviceSize head{ 0 };
+	VkDeviceSize overflowHead{ 0 };
+	VkDeviceSize highWater{ 0 };
+	VkBufferUsageFlags usageFlags{ 0 };
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "vk_types.h"
+
+class BindlessMaterialTable;
+
+// gpu objects waiting until no submitted work uses them anymore. every push is tagged with a retire value,
+// the frame number that last used the object or an UploadService timeline value, and flush destroys what is
+// tagged at or below a value the caller knows to be complete. handles sit in one array per type and are
+// destroyed in plain loops, so once the arrays have grown to a frame's worth nothing in here allocates
+class DeletionQueue {
+public:
+	void init(VkDevice device, VmaAllocator allocator);
+
+	void push_buffer(const AllocatedBuffer& buffer, uint64_t retireValue);
+	// view and image
+	void push_image(const AllocatedImage& image, uint64_t retireValue);
+	// the acceleration structure and its buffer
+	void push_accel_struct(const AllocatedAS& accel, uint64_t retireValue);
+	void push_sampler(VkSampler sampler, uint64_t retireValue);
+	void push_descriptor_pool(VkDescriptorPool pool, uint64_t retireValue);
+	void push_command_pool(VkCommandPool pool, uint64_t retireValue);
+	// given back to the table instead of destroyed
+	void push_texture_slot(BindlessMaterialTable* table, uint32_t slot, uint64_t retireValue);
+
+	// teardown that is more than one handle. allocates, so it is meant for init time only. functions are
+	// not tagged and run in push order on flush_all, after the typed entries
+	void push_function(std::function<void()>&& function);
+
+	void flush(uint64_t completedValue);
+	// everything, for shutdown
+	void flush_all();
+
+private:
+	template<typename T>
+	struct Retiring {
+		T handle;
+		uint64_t retireValue;
+	};
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ VK_NULL_HANDLE };
+
+	std::vector<Retiring<std::pair<BindlessMaterialTable*, uint32_t>>> _textureSlots;
+	std::vector<Retiring<AllocatedImage>> _images;
+	std::vector<Retiring<AllocatedAS>> _accelStructs;
+	std::vector<Retiring<AllocatedBuffer>> _buffers;
+	std::vector<Retiring<VkSampler>> _samplers;
+	std::vector<Retiring<VkDescriptorPool>> _descriptorPools;
+	std::vector<Retiring<VkCommandPool>> _commandPools;
+	std::vector<std::function<void()>> _functions;
+};
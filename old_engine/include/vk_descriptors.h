@@ -7,8 +7,11 @@
 struct DescriptorLayoutBuilder {
 
 	std::vector<VkDescriptorSetLayoutBinding> bindings;
+	std::vector<VkDescriptorBindingFlags> bindingFlags;
 
 	void add_binding(uint32_t bind, VkDescriptorType type);
+	// arrays and descriptor indexing flags, an update after bind flag makes the whole layout need an update after bind pool
+	void add_binding(uint32_t bind, VkDescriptorType type, uint32_t count, VkDescriptorBindingFlags flags);
 	void clear();
 	VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages);
 };
@@ -5,13 +5,24 @@
 
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "vk_bindless.h"
+#include "vk_buffers.h"
+#include "vk_deletion.h"
+#include "vk_geometry.h"
+#include "vk_upload.h"
+#include "texture_streamer.h"
 #include "vk_loader.h"
 #include "vk_pipelines.h"
 #include "camera.h"
+#include "culling.h"
+#include "worker_pool.h"
+#include "pipeline_compiler.h"
+#include "gpu_profiler.h"
 #include "interprocess.h"
 
 #include <vk_mem_alloc.h>
 
+#include <chrono>
 #include <span>
 #include <string>
 #include <vector>
@@ -19,6 +30,7 @@
 #include <functional>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 
 #include <imgui.h>
 #include <imgui_impl_sdl2.h>
@@ -30,11 +42,28 @@ struct EngineStats {
 	float frame_time;
 	int triangle_count;
 	int draw_call_count;
+	int culled_count;
 	float scene_update_time;
 	float mesh_draw_time;
 	glm::vec3 camera_location;
 };
 
+// how the main loop paces frames. set before init or change from the stats window, draw picks changes up
+// at the start of the next frame
+struct FramePacingSettings {
+	// frames the cpu may record ahead of the gpu, 1 to MAX_FRAMES_IN_FLIGHT
+	uint32_t framesInFlight{ 2 };
+	// a minimum, the driver may create more
+	uint32_t swapchainImageCount{ 3 };
+	// falls back to fifo when the surface doesn't support it
+	VkPresentModeKHR presentMode{ VK_PRESENT_MODE_FIFO_KHR };
+	// frames per second the main loop sleeps down to, 0 for no limit
+	float frameRateLimit{ 0.0f };
+	// above 0 input is only sampled once at most this many milliseconds of gpu work are queued ahead of the
+	// new frame, trading throughput for latency. 0 lets the cpu run framesInFlight ahead
+	float latencyTargetMs{ 0.0f };
+};
+
 struct GUITransform {
 	float guiTransform[3];
 	float guiSunDir[3];
@@ -56,24 +85,22 @@ struct ComputeEffect {
 	ComputePushConstants data;
 };
 
-struct DeletionQueue {
-	
-	std::deque<std::function<void()>> deletors;
-
-	void push_function(std::function<void()>&& function) // inefficient at scale... store arrays of vulkan handles of various types, then delete from loop
-	{
-		deletors.push_back(function);
-	}
-
-	void flush()
-	{
-		for (auto func : deletors)
-		{
-			func();
-		}
-
-		deletors.clear();
-	}
+// output of the cull pass, grown on demand and reused by the frame slot that owns it
+struct IndirectDrawBuffers {
+	AllocatedBuffer draws;
+	AllocatedBuffer counts;
+	// counts copied back after the cull pass, read once the frame's fence has signaled
+	AllocatedBuffer countReadback;
+	uint32_t drawCapacity{ 0 };
+	uint32_t countCapacity{ 0 };
+	// what the last submit from this slot handed to the cull pass, an object drawn by meshlets takes one draw slot per meshlet
+	uint32_t objectCount{ 0 };
+	uint32_t drawSlotCount{ 0 };
+	uint32_t bucketCount{ 0 };
+	uint32_t cpuCulledCount{ 0 };
+	// BINDLESS_MATERIAL_CAPACITY pixel sizes from the cull pass, read back like the counts to drive texture streaming
+	AllocatedBuffer mipFeedback{};
+	AllocatedBuffer mipFeedbackReadback{};
 };
 
 struct FrameData {
@@ -81,33 +108,51 @@ struct FrameData {
 	VkCommandPool _commandPool;
 	VkCommandBuffer _mainCommandBuffer;
 	VkSemaphore _swapchainSemaphore;
-	VkSemaphore _renderSemaphore;
-	VkFence _renderFence;
-	DeletionQueue _deletionQueue;
 	DescriptorAllocatorGrowable _frameDescriptors;
-};
-
-struct MeshNode : public Node {
-
-	std::shared_ptr<MeshAsset> mesh;
-
-	virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx) override;
+	LinearBufferAllocator _frameBuffer;
+	IndirectDrawBuffers _indirect;
+	// one pool and secondary command buffer per record worker
+	std::vector<VkCommandPool> _recordPools;
+	std::vector<VkCommandBuffer> _recordCommandBuffers;
 };
 
 struct RenderObject {
 	uint32_t indexCount;
+	// in the index arena block indexBlock, not relative to the mesh
 	uint32_t firstIndex;
-	VkBuffer indexBuffer;
+	uint32_t indexBlock;
+	VkIndexType indexType;
 
 	MaterialInstance* material;
 	Bounds bounds;
 	glm::mat4 transform;
 	VkDeviceAddress vertexBufferAddress;
+	uint32_t vertexFormat;
+
+	// meshlets of the selected lod, meshletCount is 0 for meshes without them
+	VkDeviceAddress meshletBufferAddress;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
 };
 
 struct DrawContext {
 	std::vector<RenderObject> OpaqueSurfaces;
 	std::vector<RenderObject> TransparentSurfaces;
+
+	// lod selection, lodScale turns a world space length at distance 1 into pixels.
+	// with a threshold of 0 only lossless lods are picked
+	glm::vec3 cameraPosition{ 0.0f };
+	float lodScale{ 0.0f };
+	float lodErrorThreshold{ 0.0f };
+};
+
+// objects sharing a pipeline and an index arena block and type, drawn with one vkCmdDrawIndexedIndirectCount
+struct DrawBucket {
+	MaterialPipeline* pipeline;
+	uint32_t indexBlock;
+	VkIndexType indexType;
+	uint32_t drawOffset;
+	uint32_t maxDrawCount;
 };
 
 struct GLTFMetallic_Roughness {
@@ -115,14 +160,9 @@ struct GLTFMetallic_Roughness {
 	MaterialPipeline transparentPipeline;
 	VkPipelineLayout gltfPipelineLayout;
 
-	VkDescriptorSetLayout materialLayout;
-
-	struct MaterialConstants {
-		glm::vec4 colorFactors;
-		glm::vec4 metal_rough_factors;
-		//padding, we need it anyway for uniform buffers.. struct should be 256 bytes for gpu alignment
-		glm::vec4 extra[14];
-	};
+	// kept for the life of the material so variants can be compiled at any time
+	VkShaderModule meshVertShader{ VK_NULL_HANDLE };
+	VkShaderModule meshFragShader{ VK_NULL_HANDLE };
 
 	struct MaterialResources {
 		AllocatedImage colorImage;
@@ -131,16 +171,16 @@ struct GLTFMetallic_Roughness {
 		VkSampler metalRoughSampler;
 		AllocatedImage normalImage;
 		VkSampler normalSampler;
-		VkBuffer dataBuffer;
-		uint32_t dataBufferOffset;
+		glm::vec4 colorFactors;
+		glm::vec4 metalRoughFactors;
+		bool doubleSided{ false };
 	};
 
-	DescriptorWriter writer;
-
 	void build_pipelines(VulkanEngine* engine);
 	void clear_resources(VkDevice device);
 
-	MaterialInstance write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator);
+	// adds the material to the bindless table, the returned instance only carries its index
+	MaterialInstance write_material(BindlessMaterialTable& table, MaterialPass pass, const MaterialResources& resources);
 };
 
 struct BLASInput {
@@ -164,7 +204,30 @@ struct MeshInstance {
 	uint32_t meshIndex{0};
 };
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+// where one interprocess slot lands, -1 when the node has no ray tracing instance
+struct InterprocessBinding {
+	Node node;
+	int32_t instanceIndex{ -1 };
+};
+
+// frame slots created at init, FramePacingSettings::framesInFlight of them are used
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+constexpr VkDeviceSize FRAME_BUFFER_SIZE = 1024 * 1024;
+constexpr VkDeviceSize UPLOAD_STAGING_SIZE = 64 * 1024 * 1024;
+constexpr VkDeviceSize TEXTURE_STREAMING_BUDGET = 512 * 1024 * 1024;
+constexpr VkDeviceSize GEOMETRY_BLOCK_SIZE = 128 * 1024 * 1024;
+// below this many buckets per worker the extra secondary command buffers cost more than they save
+constexpr uint32_t RECORD_MIN_BUCKETS_PER_WORKER = 16;
+constexpr uint32_t RECORD_MAX_WORKERS = 8;
+// refits of the tlas before the next change rebuilds it from scratch
+constexpr uint32_t TLAS_REFITS_PER_REBUILD = 256;
+// relative to the working directory like the shaders, rewritten on every shutdown
+constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+constexpr uint32_t PIPELINE_COMPILE_THREADS = 2;
+// written by the export button in the stats window, relative to the working directory
+constexpr const char* GPU_TIMINGS_CSV_PATH = "gpu_timings.csv";
+// where F11 and shutdown write the cpu trace unless --trace names another file
+constexpr const char* CPU_TRACE_PATH = "cpu_trace.json";
 
 class VulkanEngine {
 public:
@@ -179,7 +242,9 @@ public:
 
 	static VulkanEngine& Get();
 
-	FrameData& get_current_frame() { return _frames[_frameNumber % FRAME_OVERLAP]; };
+	FrameData& get_current_frame() { return _frames[_frameNumber % _appliedPacing.framesInFlight]; };
+	// what _frameTimeline reaches once the frame being recorded has completed
+	uint64_t frame_signal_value() const { return (uint64_t)_frameNumber + 1; }
  
 	//initializes everything in the engine
 	void init(); 
@@ -192,7 +257,9 @@ public:
 
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 	void async_compute_submit(std::function<void(VkCommandBuffer cmd)>&& function);
-	GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+	// packs the vertices unless _compactVertices is off, indices are narrowed to 16 bit when they fit
+	GPUMeshBuffers uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const Meshlet> meshlets = {});
+	GPUMeshBuffers uploadMesh(std::span<const uint32_t> indices, std::span<const PackedVertex> vertices, std::span<const Meshlet> meshlets = {});
 
 	VkInstance _instance;
 	VkDebugUtilsMessengerEXT _debug_messenger;
@@ -207,14 +274,38 @@ public:
 
 	std::vector<VkImage> _swapchainImages;
 	std::vector<VkImageView> _swapchainImageViews;
+	// one per swapchain image, a present may still wait on it after the frame slot that signalled it is reused
+	std::vector<VkSemaphore> _presentSemaphores;
 	VkExtent2D _swapchainExtent;
 
-	FrameData _frames[FRAME_OVERLAP];
+	FramePacingSettings _pacing;
+	// what the swapchain and frame slots currently run with
+	FramePacingSettings _appliedPacing;
+	// every frame's submit signals frame_signal_value() on it
+	VkSemaphore _frameTimeline;
+	// main loop interval, smoothed, stands in for the gpu frame time of the latency target
+	float _frameIntervalMs{ 0.0f };
+	std::chrono::steady_clock::time_point _lastFrameStart{};
+	std::chrono::steady_clock::time_point _nextFrameDeadline{};
+
+	FrameData _frames[MAX_FRAMES_IN_FLIGHT];
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
 	VkQueue _asyncComputeQueue;
 	uint32_t _asyncComputeQueueFamily;
+	VkQueue _transferQueue;
+	uint32_t _transferQueueFamily;
+	// guards _graphicsQueue when the uploader has to share it
+	std::mutex _graphicsQueueMutex;
+	UploadService _uploader;
+	// vertices and meshlets, read through device addresses, and indices of every mesh
+	GeometryArena _vertexArena;
+	GeometryArena _indexArena;
+	// owns the images of textures loaded while _textureStreaming is set
+	TextureStreamer _textureStreamer;
 	DeletionQueue _mainDeletionQueue;
+	// objects the frames in flight may still use, tagged with frame_signal_value() and flushed against _frameTimeline
+	DeletionQueue _frameDeletionQueue;
 	VmaAllocator _allocator;
 
 	AllocatedImage _drawImage;
@@ -230,6 +321,12 @@ public:
 	VkPipeline _gradientPipeline;
 	VkPipelineLayout _gradientPipelineLayout;
 
+	// handed to every pipeline creation, persisted across runs
+	VkPipelineCache _pipelineCache{ VK_NULL_HANDLE };
+	PipelineCompiler _pipelineCompiler;
+	bool _pipelineLibrariesSupported{ false };
+	bool _pipelineLibraryFastLinking{ false };
+
 	VkFence _immFence;
 	VkCommandBuffer _immCommandBuffer;
 	VkCommandPool _immCommandPool;
@@ -263,18 +360,51 @@ public:
 	VkSampler _defaultSamplerNearest;
  
 	GLTFMetallic_Roughness _metalRoughMaterial;
+	// set 1 of every mesh pipeline, shared by all loaded scenes
+	BindlessMaterialTable _materialTable;
 
 	DrawContext _mainDrawContext;
+	CullingBounds _cullingBounds;
+
+	VkPipeline _cullPipeline;
+	VkPipelineLayout _cullPipelineLayout;
+	// off falls back to culling on the cpu, the compute pass then only compacts
+	bool _gpuCulling{ true };
+	// meshes loaded while this is set are stored as PackedVertex
+	bool _compactVertices{ true };
+	// welds, reorders and builds lod chains and meshlets for meshes imported straight from gltf, cooked scenes were already optimized by nu-cook
+	bool _optimizeMeshes{ true };
+	// textures loaded while this is set start with only their coarse mips and stream the rest in
+	bool _textureStreaming{ true };
+	// how many pixels a lod may be off by on screen before a finer one is drawn
+	float _lodErrorThreshold{ 1.0f };
+	// frustum and back face tests per meshlet on top of the per object test, needs gpu culling
+	bool _clusterCulling{ true };
+	std::vector<DrawBucket> _drawBuckets;
+	VkDeviceAddress _objectBufferAddress{ 0 };
+	// records draw_geometry's buckets into secondary command buffers, load_gltf borrows it to import scenes
+	WorkerPool _workers;
 
 	Camera _mainCamera;
 
 	std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> _loadedScenes;
 
 	EngineStats _stats;
+	// timestamp scopes around the passes of draw()
+	GpuProfiler _gpuProfiler;
+	std::string _cpuTracePath{ CPU_TRACE_PATH };
 
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR _rtProperties{};
 	VkPhysicalDeviceAccelerationStructurePropertiesKHR _asProperties{};
 	std::vector<AllocatedAS> _blas;
+	AllocatedAS _tlas;
+	AllocatedBuffer _tlasScratchBuffer;
+	VkDeviceAddress _tlasScratchAddress{0};
+	uint32_t _tlasInstanceCount{0};
+	bool _tlasNeedsBuild{ true };
+	// an instance transform changed since the last build or refit
+	bool _tlasDirty{ true };
+	uint32_t _tlasRefitCount{ 0 };
 	std::vector<MeshInstance> _instances;
 	std::unordered_map<std::string, uint32_t> _nodeNameToInstanceIndexMap;
 	VkDescriptorSetLayout _rtDescriptorSetLayout;
@@ -287,6 +417,7 @@ public:
 
 	GUITransform _guiTransform{};
 	std::shared_ptr<Interprocess> _interprocess;
+	std::vector<InterprocessBinding> _interprocessBindings;
 
 	std::shared_ptr<ImGuiIO> _io;
 
@@ -296,9 +427,18 @@ public:
 
 	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
     AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VmaAllocationCreateFlagBits allocFlags);
+    AllocatedBuffer create_device_buffer(size_t allocSize, VkBufferUsageFlags usage);
+	GPUMeshBuffers upload_mesh_buffers(std::span<const uint32_t> indices, const void* vertexData, size_t vertexBufferSize, uint32_t vertexFormat, std::span<const Meshlet> meshlets);
+	// only once no frame in flight draws the mesh anymore
+	void free_mesh_buffers(const GPUMeshBuffers& meshBuffers);
     void destroy_buffer(const AllocatedBuffer &buffer);
     AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+	// mipLevels levels instead of none or the full chain, a ktx2 file may stop early
+	AllocatedImage create_image_levels(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels);
+	// data holds level 0 in format, mipmapped generates the rest on the gpu and is ignored for block compressed formats
 	AllocatedImage create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+	// data already holds mipLevels levels, largest first and tightly packed in the format's blocks
+	AllocatedImage create_image_with_mips(const void* data, size_t dataSize, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels);
 	void destroy_image(const AllocatedImage& img);
 	AllocatedAS create_accel_struct(const VkAccelerationStructureCreateInfoKHR& accel);
 	void destroy_accel_struct(const AllocatedAS& accel);
@@ -312,6 +452,8 @@ private:
 	void init_async_compute_commands();
 	void init_sync_structures();
 	void init_async_compute_sync_structures();
+	void init_upload_service();
+	void init_geometry_arenas();
 	void init_descriptors();
 	void init_pipelines();
 	void init_background_pipelines();
@@ -319,12 +461,15 @@ private:
 	void init_default_data();
 	void init_renderables();
 	void init_post_process_pipelines();
+	void init_cull_pipeline();
 
 	void init_ray_tracing();
 	void cleanup_ray_tracing();
 	BLASInput mesh_to_vk_geometry(const MeshAsset &obj);
 	void create_bottom_level_as();
-	VkDescriptorSet create_top_level_as();
+	void create_top_level_as();
+	VkDescriptorSet update_top_level_as(VkCommandBuffer cmd);
+	void build_top_level_as(VkCommandBuffer cmd);
 	void create_rt_descriptor_set();
 
 	void init_interprocess();
@@ -333,10 +478,20 @@ private:
 	void create_swapchain(uint32_t width, uint32_t hegiht);
 	void destroy_swapchain();
 	void resize_swapchain();
+	// brings the swapchain and frame slots in line with _pacing
+	void apply_frame_pacing();
+	// blocks until frameNumber's submit has completed, returns right away for negative frames
+	void wait_for_frame(int64_t frameNumber);
+	// frame limiter and latency target, before the main loop samples input
+	void pace_frame();
 	
 	void draw_main(VkCommandBuffer cmd);
 	void draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView);
-	void draw_geometry(VkCommandBuffer cmd);
+	// the latest gpu timings as bars over the frame, for the stats window
+	void draw_gpu_timings();
+	void cull_geometry(VkCommandBuffer cmd);
+	void draw_geometry(VkCommandBuffer cmd, VkDescriptorSet rtDescriptorSet);
+	void record_draw_buckets(VkCommandBuffer cmd, uint32_t firstBucket, uint32_t lastBucket, VkDescriptorSet globalDescriptor, VkDescriptorSet rtDescriptorSet);
 
 
 	void update_scene();
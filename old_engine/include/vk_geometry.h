@@ -0,0 +1,61 @@
+#pragma once
+#include <map>
+#include <vector>
+
+#include "vk_types.h"
+
+// offsets and sizes only, nothing behind them. first fit over the free ranges sorted by offset,
+// a freed range merges with its free neighbours so the arena doesn't splinter as meshes come and go
+class FreeListAllocator {
+public:
+	static constexpr VkDeviceSize INVALID_OFFSET = ~VkDeviceSize(0);
+
+	void init(VkDeviceSize size);
+
+	// INVALID_OFFSET when no free range fits, alignment has to be a power of two
+	VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment);
+	// size as passed to allocate, the alignment padding in front stays a free range of its own
+	void free(VkDeviceSize offset, VkDeviceSize size);
+
+	VkDeviceSize size() const { return _size; }
+	VkDeviceSize used() const { return _used; }
+
+private:
+	// offset to size
+	std::map<VkDeviceSize, VkDeviceSize> _freeRanges;
+	VkDeviceSize _size{ 0 };
+	VkDeviceSize _used{ 0 };
+};
+
+// device local buffers that every mesh is sub-allocated from instead of getting buffers of its own.
+// starts with one block and adds another whenever an allocation fits none of them, an allocation
+// bigger than a block gets a block of its exact size. only used from the thread that loads scenes
+class GeometryArena {
+public:
+	void init(VulkanEngine* engine, VkBufferUsageFlags usage, VkDeviceSize blockSize);
+	void destroy();
+
+	GeometryRange allocate(VkDeviceSize size, VkDeviceSize alignment);
+	void free(const GeometryRange& range);
+
+	VkBuffer buffer(uint32_t block) const { return _blocks[block].buffer.buffer; }
+	VkDeviceAddress address(const GeometryRange& range) const { return _blocks[range.block].address + range.offset; }
+
+	uint32_t block_count() const { return (uint32_t)_blocks.size(); }
+	VkDeviceSize used_bytes() const;
+	VkDeviceSize capacity_bytes() const;
+
+private:
+	struct Block {
+		AllocatedBuffer buffer;
+		VkDeviceAddress address;
+		FreeListAllocator allocator;
+	};
+
+	void add_block(VkDeviceSize size);
+
+	VulkanEngine* _engine{ nullptr };
+	VkBufferUsageFlags _usage{ 0 };
+	VkDeviceSize _blockSize{ 0 };
+	std::vector<Block> _blocks;
+};
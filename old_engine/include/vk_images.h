@@ -9,4 +9,9 @@ namespace vkutil {
 	void transition_image(VkCommandBuffer cmd, VkImage image, VkImageMemoryBarrier2 imageBarrier);
 	void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
 	void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize);
+
+	// the bc formats can't be blitted, their mips have to come with the data
+	bool is_block_compressed(VkFormat format);
+	// bytes of one mip level with tightly packed rows, block compressed levels round up to whole 4x4 blocks
+	VkDeviceSize image_level_size(VkFormat format, VkExtent3D extent, uint32_t level);
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "vk_types.h"
 #include "vk_descriptors.h"
+#include "mesh_optimizer.h"
+#include "texture_codec.h"
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/parser.hpp>
 #include <fastgltf/tools.hpp>
@@ -24,41 +26,60 @@ struct GLTFMaterial
 	MaterialInstance data;
 };
 
+// startIndex/count is the full detail range, lods[0] repeats it and the rest are simplified copies
+// further along the same index buffer
 struct GeoSurface
 {
 	uint32_t startIndex;
 	uint32_t count;
 	Bounds bounds;
 	std::shared_ptr<GLTFMaterial> material;
+	MeshLod lods[MAX_MESH_LODS];
+	uint32_t lodCount;
+};
+
+// rgba8 pixels straight from stb, owned by the caller until passed to stbi_image_free
+struct DecodedImage
+{
+	unsigned char* pixels;
+	VkExtent3D extent;
+	// ktx2 files carry their own format and mips, as do images mipmapped on the cpu for streaming. pixels is null for both
+	TextureData texture;
 };
 
-struct MeshNode;
 struct MeshAsset
 {
 	std::string name;
 	std::vector<GeoSurface> surfaces;
 	GPUMeshBuffers meshBuffers;
 	uint32_t vertexCount;
+	// lod 0 only, the lower lods are not part of the blas
 	uint32_t indexCount;
 };
 
+struct MeshNode
+{
+	std::string name;
+	Node node;
+	std::shared_ptr<MeshAsset> mesh;
+};
+
 struct LoadedGLTF : public IRenderable
 {
 public:
 	std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
-	std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
-	std::unordered_map<std::string, std::shared_ptr<Node>> meshNodes;
+	// every node of the file, parents before children
+	TransformHierarchy transforms;
+	std::unordered_map<std::string, Node> nodes;
+	// the nodes that draw something, walked front to back by Draw
+	std::vector<MeshNode> meshNodes;
 	std::vector<AllocatedImage> images;
+	// handles in creator->_textureStreamer, their images are not in the list above
+	std::vector<uint32_t> streamedTextures;
 	std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
 
-	std::vector<std::shared_ptr<Node>> topNodes;
-
 	std::vector<VkSampler> samplers;
 
-	DescriptorAllocatorGrowable descriptorPool;
-
-	AllocatedBuffer materialDataBuffer;
-
 	VulkanEngine *creator;
 
 	virtual void Draw(const glm::mat4 &topMatrix, DrawContext &ctx);
@@ -69,6 +90,8 @@ namespace vkutil
 {
 	std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(VulkanEngine *engine, std::string_view filePath);
 	std::optional<AllocatedImage> load_image(VulkanEngine *engine, fastgltf::Asset &asset, fastgltf::Image &image);
+	// cpu only, safe to call from worker threads
+	std::optional<DecodedImage> decode_image(const fastgltf::Asset &asset, const fastgltf::Image &image);
 	VkFilter extract_filter(fastgltf::Filter filter);
 	VkSamplerMipmapMode extract_mipmap_mode(fastgltf::Filter filter);
 }
@@ -5,6 +5,10 @@ namespace vkutil {
 
 	bool load_shader_module(std::filesystem::path filePath, VkDevice device, VkShaderModule* outShaderModule);
 
+	// starts from the file when its header matches this device and driver, empty otherwise
+	VkPipelineCache load_pipeline_cache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath);
+	void save_pipeline_cache(VkDevice device, VkPipelineCache cache, const std::filesystem::path& filePath);
+
 };
 
 class PipelineBuilder {
@@ -38,5 +42,10 @@ class PipelineBuilder {
 		void enable_blending_additive();
 		void enable_blending_alphablend();
 
-		VkResult build_pipeline(VkDevice device, VkPipeline& pipeline);
+		VkResult build_pipeline(VkDevice device, VkPipeline& pipeline, VkPipelineCache cache = VK_NULL_HANDLE);
+
+		// VK_EXT_graphics_pipeline_library: builds only the given parts of the pipeline from the current state
+		VkResult build_library(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT parts, VkPipeline& library, VkPipelineCache cache = VK_NULL_HANDLE);
+		// an unoptimized link is cheap enough to do while a frame waits on it, the optimized one is not
+		static VkResult link_libraries(VkDevice device, std::span<const VkPipeline> libraries, VkPipelineLayout layout, bool optimize, VkPipeline& pipeline, VkPipelineCache cache = VK_NULL_HANDLE);
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 // or project specific include files.
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <string>
@@ -21,6 +22,8 @@
 #include <glm/vec4.hpp>
 
 #include "defines.h"
+#include "transform_hierarchy.h"
+#include "vertex_format.h"
  
 #define VK_CHECK(x)                                                                      \
     do {                                                                                 \
@@ -62,17 +65,82 @@ struct Vertex {
     glm::vec4 color;
 };
 
+// a sub-allocation of one of the engine's GeometryArenas
+struct GeometryRange {
+    uint32_t block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+// ranges in the engine's geometry arenas, handed back with VulkanEngine::free_mesh_buffers
 struct GPUMeshBuffers {
 
-    AllocatedBuffer indexBuffer;
-    AllocatedBuffer vertexBuffer;
+    GeometryRange vertices;
+    GeometryRange indices;
     VkDeviceAddress vertexBufferAddress;
+    // where the mesh starts in its index arena block, in indices of indexType
+    uint32_t firstIndex{ 0 };
+    // timeline value of the upload filling the buffers, see UploadService
+    uint64_t uploadTicket{ 0 };
+    // 16 bit whenever the mesh has few enough vertices
+    VkIndexType indexType{ VK_INDEX_TYPE_UINT32 };
+    // VERTEX_FORMAT_FULL (Vertex) or VERTEX_FORMAT_PACKED (PackedVertex)
+    uint32_t vertexFormat{ VERTEX_FORMAT_FULL };
+    // Meshlet array read by the cull pass, in the vertex arena. size 0 for meshes without meshlets
+    GeometryRange meshlets{};
+    VkDeviceAddress meshletBufferAddress{ 0 };
 };
 
+// the mesh pipelines read everything per draw from the object buffer through gl_InstanceIndex
 struct GPUDrawPushConstants {
 
+    VkDeviceAddress objectBuffer;
+};
+
+// one per surface handed to the cull pass, layout matches ObjectData in cull.comp and pbr.vert
+struct GPUObjectData {
+
     glm::mat4 worldMatrix;
+    glm::vec4 boundsOrigin;
+    glm::vec4 boundsExtents;
     VkDeviceAddress vertexBuffer;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // first indirect command of the object's bucket and the slot of its draw count
+    uint32_t drawOffset;
+    uint32_t countIndex;
+    // slot in the BindlessMaterialTable
+    uint32_t materialIndex;
+    uint32_t vertexFormat;
+    // with meshletCount > 0 the cull pass tests and draws the object's meshlets one by one instead
+    VkDeviceAddress meshletBuffer;
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+    // 0 for double sided materials, their back faces are drawn
+    uint32_t coneCull;
+    uint32_t pad[3];
+};
+
+// read by the cull pass through GPUCullPushConstants::viewBuffer, the push constants are full
+struct GPUCullView {
+
+    glm::vec4 frustumPlanes[6];
+    glm::vec4 cameraPosition;
+    // a world space length at distance 1 in pixels, for the mip feedback
+    float pixelScale;
+    uint32_t pad;
+    // one uint per material slot, the largest on screen diameter of a visible object drawn with it
+    VkDeviceAddress mipFeedbackBuffer;
+};
+
+struct GPUCullPushConstants {
+
+    VkDeviceAddress viewBuffer;
+    VkDeviceAddress objectBuffer;
+    VkDeviceAddress drawBuffer;
+    VkDeviceAddress countBuffer;
+    uint32_t objectCount;
+    uint32_t cullEnabled;
 };
 
 enum class MaterialPass : uint8_t {
@@ -81,15 +149,41 @@ enum class MaterialPass : uint8_t {
     Other
 };
 
+// pipeline is filled in by the PipelineCompiler whenever a build finishes and may be swapped for a
+// better one later, read it once per recording
 struct MaterialPipeline {
-    VkPipeline pipeline;
+    std::atomic<VkPipeline> pipeline{ VK_NULL_HANDLE };
     VkPipelineLayout layout;
+    // drawn with while pipeline is still compiling, has to share the layout
+    MaterialPipeline* fallback{ nullptr };
+
+    // null when neither this nor the fallback is ready yet
+    const MaterialPipeline* resolve() const
+    {
+        if (pipeline.load(std::memory_order_acquire) != VK_NULL_HANDLE) {
+            return this;
+        }
+        return fallback != nullptr ? fallback->resolve() : nullptr;
+    }
 };
 
 struct MaterialInstance {
     MaterialPipeline* pipeline;
-    VkDescriptorSet materialSet;
+    uint32_t materialIndex;
     MaterialPass passType;
+    bool doubleSided;
+};
+
+// one entry of the material storage buffer, layout matches MaterialData in input_structures.glsl.
+// the texture fields are slots of the bindless texture array
+struct GPUMaterialData {
+
+    glm::vec4 colorFactors;
+    glm::vec4 metalRoughFactors;
+    uint32_t colorTexture;
+    uint32_t metalRoughTexture;
+    uint32_t normalTexture;
+    uint32_t pad;
 };
 
 
@@ -114,26 +208,15 @@ class IRenderable {
     virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx) = 0;
 };
 
-struct Node : public IRenderable {
-    
-    std::weak_ptr<Node> parent;
-    std::vector<std::shared_ptr<Node>> children;
+// handle to one entry of a scene's TransformHierarchy, the matrices themselves live in the hierarchy
+struct Node {
 
-    glm::mat4 localTransform;
-    glm::mat4 worldTransform;
-    
-    void refreshTransform(const glm::mat4& parentMatrix)
-    {
-        worldTransform = parentMatrix * localTransform;
-        for (auto c : children) {
-            c->refreshTransform(worldTransform);
-        }
-    }
+    TransformHierarchy* hierarchy{ nullptr };
+    uint32_t index{ 0 };
 
-    virtual void Draw(const glm::mat4& topMatrix, DrawContext& ctx)
-    {
-        for (auto& c : children) {
-            c->Draw(topMatrix, ctx);
-        }
-    }
+    const glm::mat4& localTransform() const { return hierarchy->local(index); }
+    const glm::mat4& worldTransform() const { return hierarchy->world(index); }
+
+    void setLocalTransform(const glm::mat4& transform) { hierarchy->set_local(index, transform); }
+    void setWorldTransform(const glm::mat4& transform) { hierarchy->set_world(index, transform); }
 };
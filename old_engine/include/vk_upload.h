@@ -0,0 +1,109 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "vk_types.h"
+
+// streams buffer and image data to the gpu through a persistently mapped staging ring.
+// copies are batched and submitted from a worker thread on the transfer queue, every batch
+// signals a value on a timeline semaphore. the value returned by the upload_* calls is the
+// ticket a caller can poll or wait on; the render loop never blocks on it.
+class UploadService {
+public:
+	void init(VulkanEngine* engine, VkQueue queue, uint32_t queueFamily, std::mutex* queueMutex, VkDeviceSize stagingSize);
+	void destroy();
+
+	uint64_t upload_buffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	uint64_t upload_image(const AllocatedImage& image, const void* data, VkDeviceSize size, bool mipmapped);
+	// data holds mipLevels tightly packed levels of the image's format, largest first
+	uint64_t upload_image_levels(const AllocatedImage& image, const void* data, VkDeviceSize size, uint32_t mipLevels);
+
+	// hands the open batch to the worker thread, returns the value it will signal
+	uint64_t flush();
+	void wait(uint64_t value);
+	bool is_complete(uint64_t value);
+	// is_complete and, with a separate transfer family, the acquire and final layout already recorded by
+	// record_graphics_work of an earlier frame. only then may an image of the upload be sampled
+	bool is_ready_for_graphics(uint64_t value);
+
+	// records queue ownership acquires, mip generation and final layouts for images whose
+	// transfer was submitted. returns the timeline value the graphics submit has to wait on, or 0
+	// when everything submitted so far was already waited on by an earlier frame
+	uint64_t record_graphics_work(VkCommandBuffer cmd);
+
+	VkSemaphore timeline_semaphore() const { return _timeline; }
+
+private:
+	struct BufferCopy {
+		VkBuffer dst;
+		VkBufferCopy region;
+		VkBuffer src;
+	};
+
+	struct ImageCopy {
+		VkImage image;
+		VkExtent3D extent;
+		bool generateMips;
+		std::vector<VkBufferImageCopy> regions;
+		VkBuffer src;
+	};
+
+	struct Batch {
+		uint64_t value{ 0 };
+		std::vector<BufferCopy> bufferCopies;
+		std::vector<ImageCopy> imageCopies;
+		std::vector<AllocatedBuffer> dedicatedStaging; // uploads too large for the ring
+		VkDeviceSize ringBytes{ 0 };
+		VkDeviceSize ringEnd{ 0 };
+		VkCommandPool pool{ VK_NULL_HANDLE };
+		VkCommandBuffer cmd{ VK_NULL_HANDLE };
+	};
+
+	struct StagingAllocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		void* data;
+	};
+
+	StagingAllocation reserve(std::unique_lock<std::mutex>& lock, VkDeviceSize size, VkDeviceSize alignment);
+	uint64_t flush_locked();
+	void retire(uint64_t completedValue);
+	void worker_loop();
+	void record_and_submit(Batch& batch);
+	void record_image_finish(VkCommandBuffer cmd, const ImageCopy& copy);
+	void release_batch_resources(Batch& batch);
+
+	VulkanEngine* _engine;
+	VkDevice _device;
+	VkQueue _queue;
+	uint32_t _queueFamily;
+	uint32_t _graphicsQueueFamily;
+	std::mutex* _queueMutex;
+	// true when the copies run on a family that can't blit, so mips and layouts are finished on graphics
+	bool _separateFamily;
+
+	VkSemaphore _timeline;
+	uint64_t _completedValue{ 0 };
+	uint64_t _submittedValue{ 0 };
+
+	AllocatedBuffer _ring;
+	VkDeviceSize _ringSize{ 0 };
+	VkDeviceSize _ringHead{ 0 };
+	VkDeviceSize _ringTail{ 0 };
+	VkDeviceSize _ringUsed{ 0 };
+
+	Batch _openBatch;
+	std::deque<Batch> _closedBatches;
+	std::deque<Batch> _inFlightBatches;
+	std::vector<ImageCopy> _pendingGraphicsWork;
+	uint64_t _graphicsWaitedValue{ 0 };
+	std::vector<std::pair<VkCommandPool, VkCommandBuffer>> _freeCommandBuffers;
+
+	std::mutex _mutex;
+	std::condition_variable _workAvailable;
+	std::condition_variable _batchRetired;
+	std::thread _worker;
+	bool _stop{ false };
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of threads that run one task per worker and hand back when all of them are done.
+// the calling thread takes part as worker 0, so a task sees worker indices 0..worker_count()-1
+// and can keep per-worker state (command pools, scratch memory) without locking
+class WorkerPool {
+public:
+	void init(uint32_t threadCount);
+	void destroy();
+
+	uint32_t worker_count() const { return (uint32_t)_threads.size() + 1; }
+
+	// calls task(worker) once on every worker and blocks until the last one returns
+	void run(const std::function<void(uint32_t worker)>& task);
+
+private:
+	void worker_loop(uint32_t worker);
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _taskAvailable;
+	std::condition_variable _taskFinished;
+	const std::function<void(uint32_t)>* _task{ nullptr };
+	uint64_t _taskGeneration{ 0 };
+	uint32_t _pending{ 0 };
+	bool _quit{ false };
+};
@@ -1,4 +1,5 @@
 #extension GL_EXT_ray_tracing : require
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(set = 0, binding = 0) uniform SceneData{
 
@@ -15,16 +16,23 @@ layout(set = 0, binding = 0) uniform SceneData{
 	float lightIntensity;
 } sceneData;
 
-layout(set = 1, binding = 0) uniform GLTFMaterialData{
-	
+// bindless material table, same layout as GPUMaterialData. the texture fields index textures[]
+struct MaterialData {
+
 	vec4 colorFactors;
 	vec4 metal_rough_factors;
+	uint colorTex;
+	uint metalRoughTex;
+	uint normalTex;
+	uint pad;
+};
 
-} materialData;
+layout(set = 1, binding = 0) readonly buffer MaterialBuffer{
+	MaterialData materials[];
+} materialBuffer;
 
-layout(set = 1, binding = 1) uniform sampler2D colorTex;
-layout(set = 1, binding = 2) uniform sampler2D metalRoughTex;
-layout(set = 1, binding = 3) uniform sampler2D normalTex;
+// one indirect draw covers many materials, so the index is not uniform and has to go through nonuniformEXT
+layout(set = 1, binding = 1) uniform sampler2D textures[];
 
 // if ray-tracing is enabled
 layout(set = 2, binding = 0) uniform accelerationStructureEXT topLevelAS;
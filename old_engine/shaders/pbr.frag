@@ -8,6 +8,7 @@
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inWorldPos;
 layout (location = 2) in vec2 inUV;
+layout (location = 3) flat in uint inMaterialIndex;
 
 layout (location = 0) out vec4 outFragColor;
 
@@ -17,9 +18,12 @@ const float PI = 3.14159265359;
 // Don't worry if you don't get what's going on; you generally want to do normal 
 // mapping the usual way for performance anyways; I do plan make a note of this 
 // technique somewhere later in the normal mapping tutorial.
-vec3 getNormalFromMap()
+vec3 getNormalFromMap(MaterialData material)
 {
-    vec3 tangentNormal = texture(normalTex, inUV).xyz * 2.0 - 1.0;
+    // normal maps may be two channel bc5, so z is always rebuilt from xy
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(textures[nonuniformEXT(material.normalTex)], inUV).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 Q1  = dFdx(inWorldPos);
     vec3 Q2  = dFdy(inWorldPos);
@@ -91,14 +95,16 @@ void main()
     lightIntensity[0] = 15.0;
     lightIntensity[1] = sceneData.lightIntensity;
 
-    vec3 albedo     = pow(texture(colorTex, inUV).rgb * materialData.colorFactors.rgb, vec3(2.2));
-    // float metallic  = texture(metalRoughTex, inUV).b;
-    // float roughness = texture(metalRoughTex, inUV).g;
-    // float ao        = texture(metalRoughTex, inUV).r;
-    float metallic = materialData.metal_rough_factors.x;
-    float roughness = materialData.metal_rough_factors.y;
+    MaterialData material = materialBuffer.materials[inMaterialIndex];
 
-    // vec3 N = getNormalFromMap();
+    vec3 albedo     = pow(texture(textures[nonuniformEXT(material.colorTex)], inUV).rgb * material.colorFactors.rgb, vec3(2.2));
+    // float metallic  = texture(textures[nonuniformEXT(material.metalRoughTex)], inUV).b;
+    // float roughness = texture(textures[nonuniformEXT(material.metalRoughTex)], inUV).g;
+    // float ao        = texture(textures[nonuniformEXT(material.metalRoughTex)], inUV).r;
+    float metallic = material.metal_rough_factors.x;
+    float roughness = material.metal_rough_factors.y;
+
+    // vec3 N = getNormalFromMap(material);
     vec3 N = normalize(inNormal);
     vec3 V = normalize(sceneData.cameraPos.xyz - inWorldPos);
 
@@ -10,6 +10,7 @@
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outWorldPos;
 layout (location = 2) out vec2 outUV;
+layout (location = 3) flat out uint outMaterialIndex;
 
 struct Vertex {
 
@@ -24,22 +25,88 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
-layout( push_constant ) uniform constants
-{
+// same layout as PackedVertex in vertex_format.h. the position is spelled out as floats,
+// a vec3 would align the struct to 16 bytes and break the 24 byte stride
+struct PackedVertex {
+
+	float position_x;
+	float position_y;
+	float position_z;
+	uint normal;
+	uint uv;
+	uint color;
+};
+
+layout(buffer_reference, std430) readonly buffer PackedVertexBuffer{
+	PackedVertex vertices[];
+};
+
+// same layout as GPUObjectData, written by the cpu and picked through the draw's firstInstance
+struct ObjectData {
+
 	mat4 render_matrix;
+	vec4 boundsOrigin;
+	vec4 boundsExtents;
 	VertexBuffer vertexBuffer;
+	uint firstIndex;
+	uint indexCount;
+	uint drawOffset;
+	uint countIndex;
+	uint materialIndex;
+	uint vertexFormat;
+	uvec2 meshletBuffer;
+	uint firstMeshlet;
+	uint meshletCount;
+	uint coneCull;
+	uint pad[3];
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+};
+
+layout( push_constant ) uniform constants
+{
+	ObjectBuffer objectBuffer;
 } PushConstants;
 
+vec3 decode_normal(uint packed)
+{
+	vec2 e = unpackSnorm2x16(packed);
+	vec3 n = vec3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
+
 void main()
 {
-	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	mat4 render_matrix = PushConstants.objectBuffer.objects[gl_InstanceIndex].render_matrix;
+	VertexBuffer vertexBuffer = PushConstants.objectBuffer.objects[gl_InstanceIndex].vertexBuffer;
+
+	vec3 vertexPosition;
+	vec3 vertexNormal;
+	vec2 vertexUV;
+	if (PushConstants.objectBuffer.objects[gl_InstanceIndex].vertexFormat == 1) {
+		PackedVertex v = PackedVertexBuffer(vertexBuffer).vertices[gl_VertexIndex];
+		vertexPosition = vec3(v.position_x, v.position_y, v.position_z);
+		vertexNormal = decode_normal(v.normal);
+		vertexUV = unpackHalf2x16(v.uv);
+	}
+	else {
+		Vertex v = vertexBuffer.vertices[gl_VertexIndex];
+		vertexPosition = v.position;
+		vertexNormal = v.normal;
+		vertexUV = vec2(v.uv_x, v.uv_y);
+	}
 
-	vec4 position = vec4(v.position, 1.0f);
+	vec4 position = vec4(vertexPosition, 1.0f);
 
-	gl_Position = sceneData.viewproj * PushConstants.render_matrix * position;
+	gl_Position = sceneData.viewproj * render_matrix * position;
 
-	outNormal = mat3(transpose(inverse(PushConstants.render_matrix))) * v.normal;
-	outWorldPos = (PushConstants.render_matrix * position).xyz;
-	outUV.x = v.uv_x;
-	outUV.y = v.uv_y;
+	outNormal = mat3(transpose(inverse(render_matrix))) * vertexNormal;
+	outWorldPos = (render_matrix * position).xyz;
+	outUV = vertexUV;
+	outMaterialIndex = PushConstants.objectBuffer.objects[gl_InstanceIndex].materialIndex;
 }
\ No newline at end of file
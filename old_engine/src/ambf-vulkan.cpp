@@ -1,14 +1,54 @@
 #include <vk_engine.h>
+#include <cpu_trace.h>
 
-int main()
+#include <cstring>
+#include <cstdlib>
+
+// --frames-in-flight n, --swapchain-images n, --present-mode fifo|mailbox|immediate, --fps-limit n, --latency-target ms,
+// --trace file to record cpu zones from the start and write them to file on F11 and at shutdown
+static void parse_options(int argc, char* argv[], VulkanEngine& engine)
+{
+	FramePacingSettings& pacing = engine._pacing;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const char* option = argv[i];
+		const char* value = argv[i + 1];
+
+		if (strcmp(option, "--frames-in-flight") == 0) {
+			pacing.framesInFlight = (uint32_t)atoi(value);
+		} else if (strcmp(option, "--swapchain-images") == 0) {
+			pacing.swapchainImageCount = (uint32_t)atoi(value);
+		} else if (strcmp(option, "--present-mode") == 0) {
+			if (strcmp(value, "mailbox") == 0) {
+				pacing.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+			} else if (strcmp(value, "immediate") == 0) {
+				pacing.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			} else {
+				pacing.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+			}
+		} else if (strcmp(option, "--fps-limit") == 0) {
+			pacing.frameRateLimit = (float)atof(value);
+		} else if (strcmp(option, "--latency-target") == 0) {
+			pacing.latencyTargetMs = (float)atof(value);
+		} else if (strcmp(option, "--trace") == 0) {
+			engine._cpuTracePath = value;
+			cputrace::set_enabled(true);
+		} else {
+			std::cout << "unknown option " << option << std::endl;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
 {
 	VulkanEngine engine;
 
-	engine.init();	
-	
-	engine.run();	
+	parse_options(argc, argv, engine);
+
+	engine.init();
+
+	engine.run();
 
-	engine.cleanup();	
+	engine.cleanup();
 
 	return 0;
 }
@@ -0,0 +1,178 @@
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> cputrace::detail::enabled{ false };
+
+namespace {
+	struct TraceEvent {
+		const char* name;
+		uint64_t beginNs;
+		uint64_t endNs;
+	};
+
+	struct ThreadRing {
+		uint32_t threadId;
+		std::string name;
+		std::vector<TraceEvent> events;
+		// events ever written, the ring holds the last CPU_TRACE_EVENTS_PER_THREAD of them
+		std::atomic<uint64_t> written{ 0 };
+		// its thread exited, the next new thread takes the ring over. guarded by ringsMutex
+		bool free{ false };
+	};
+
+	std::mutex ringsMutex;
+	// rings outlive their threads, a dump still shows what a finished thread recorded until a new thread
+	// takes its ring over
+	std::vector<std::unique_ptr<ThreadRing>> rings;
+	// tids aren't reused, a taken over ring shows up as a new thread in the trace
+	uint32_t nextThreadId{ 1 };
+
+	// the ring is only allocated by the thread's first zone, a named thread that never records while tracing
+	// is on doesn't cost one. hands the ring back when the thread exits, threads that come and go
+	// don't pile up rings
+	struct ThreadSlot {
+		ThreadRing* ring{ nullptr };
+		std::string name;
+
+		~ThreadSlot()
+		{
+			if (ring != nullptr) {
+				std::lock_guard<std::mutex> lock(ringsMutex);
+				ring->free = true;
+			}
+		}
+	};
+	thread_local ThreadSlot threadSlot;
+
+	ThreadRing& thread_ring()
+	{
+		if (threadSlot.ring == nullptr) {
+			std::lock_guard<std::mutex> lock(ringsMutex);
+			for (auto& ring : rings) {
+				if (ring->free) {
+					// the dump only reads the events below written, dropping the count drops the old thread's zones
+					ring->free = false;
+					ring->name = threadSlot.name;
+					ring->threadId = nextThreadId++;
+					ring->written.store(0, std::memory_order_relaxed);
+					threadSlot.ring = ring.get();
+					return *threadSlot.ring;
+				}
+			}
+
+			auto ring = std::make_unique<ThreadRing>();
+			ring->events.resize(CPU_TRACE_EVENTS_PER_THREAD);
+			ring->name = threadSlot.name;
+			ring->threadId = nextThreadId++;
+			threadSlot.ring = ring.get();
+			rings.push_back(std::move(ring));
+		}
+		return *threadSlot.ring;
+	}
+
+	void write_json_string(std::ostream& out, const char* text)
+	{
+		out << '"';
+		for (const char* c = text; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				out << '\\';
+			}
+			out << *c;
+		}
+		out << '"';
+	}
+}
+
+void cputrace::set_enabled(bool enabled)
+{
+	detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void cputrace::set_thread_name(const char* name)
+{
+	threadSlot.name = name;
+	if (threadSlot.ring != nullptr) {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		threadSlot.ring->name = name;
+	}
+}
+
+uint64_t cputrace::now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void cputrace::record(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+	ThreadRing& ring = thread_ring();
+	uint64_t index = ring.written.load(std::memory_order_relaxed);
+	ring.events[index % CPU_TRACE_EVENTS_PER_THREAD] = { name, beginNs, endNs };
+	ring.written.store(index + 1, std::memory_order_release);
+}
+
+bool cputrace::dump_chrome_trace(const std::string& path)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open()) {
+		std::cout << path << " failed to open." << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+
+	// timestamps in microseconds from the earliest zone still held, they stay short and exact
+	uint64_t baseNs = UINT64_MAX;
+	for (const auto& ring : rings) {
+		uint64_t written = ring->written.load(std::memory_order_acquire);
+		uint64_t first = written - std::min<uint64_t>(written, CPU_TRACE_EVENTS_PER_THREAD);
+		for (uint64_t i = first; i < written; i++) {
+			baseNs = std::min(baseNs, ring->events[i % CPU_TRACE_EVENTS_PER_THREAD].beginNs);
+		}
+	}
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"traceEvents\":[\n";
+
+	bool firstEvent = true;
+	size_t eventCount = 0;
+	for (const auto& ring : rings) {
+		if (!ring->name.empty()) {
+			file << (firstEvent ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->threadId
+				<< ",\"args\":{\"name\":";
+			write_json_string(file, ring->name.c_str());
+			file << "}}";
+			firstEvent = false;
+		}
+
+		uint64_t written = ring->written.load(std::memory_order_acquire);
+		uint64_t first = written - std::min<uint64_t>(written, CPU_TRACE_EVENTS_PER_THREAD);
+		for (uint64_t i = first; i < written; i++) {
+			const TraceEvent& event = ring->events[i % CPU_TRACE_EVENTS_PER_THREAD];
+			if (event.beginNs < baseNs || event.endNs < event.beginNs) {
+				continue;
+			}
+
+			file << (firstEvent ? "" : ",\n") << "{\"ph\":\"X\",\"name\":";
+			write_json_string(file, event.name);
+			file << ",\"pid\":1,\"tid\":" << ring->threadId
+				<< ",\"ts\":" << (event.beginNs - baseNs) / 1000.0
+				<< ",\"dur\":" << (event.endNs - event.beginNs) / 1000.0 << "}";
+			firstEvent = false;
+			eventCount++;
+		}
+	}
+
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	std::cout << "cputrace: wrote " << eventCount << " zones to " << path << std::endl;
+	return true;
+}
@@ -0,0 +1,155 @@
+#include "culling.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+static constexpr uint32_t CULLING_BATCH = 8;
+
+Frustum Frustum::from_view_proj(const glm::mat4& viewProj)
+{
+	// glm is column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 row0{ viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0] };
+	glm::vec4 row1{ viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1] };
+	glm::vec4 row2{ viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2] };
+	glm::vec4 row3{ viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3] };
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row2;
+	frustum.planes[5] = row3 - row2;
+
+	for (glm::vec4& plane : frustum.planes) {
+		float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0.0f) {
+			plane /= length;
+		}
+	}
+
+	return frustum;
+}
+
+void CullingBounds::clear()
+{
+	count = 0;
+}
+
+void CullingBounds::reserve(size_t newCount)
+{
+	size_t padded = (newCount + CULLING_BATCH - 1) / CULLING_BATCH * CULLING_BATCH;
+	centerX.reserve(padded);
+	centerY.reserve(padded);
+	centerZ.reserve(padded);
+	extentX.reserve(padded);
+	extentY.reserve(padded);
+	extentZ.reserve(padded);
+}
+
+void CullingBounds::add(const glm::mat4& transform, const glm::vec3& origin, const glm::vec3& extents)
+{
+	if (count == centerX.size()) {
+		size_t padded = count + CULLING_BATCH;
+		centerX.resize(padded);
+		centerY.resize(padded);
+		centerZ.resize(padded);
+		extentX.resize(padded);
+		extentY.resize(padded);
+		extentZ.resize(padded);
+	}
+
+	// the world box that encloses the transformed local box: the center goes through the full
+	// matrix, the extents through the absolute value of its 3x3 part
+	glm::vec4 center = transform * glm::vec4(origin, 1.0f);
+
+	centerX[count] = center.x;
+	centerY[count] = center.y;
+	centerZ[count] = center.z;
+	extentX[count] = std::abs(transform[0][0]) * extents.x + std::abs(transform[1][0]) * extents.y + std::abs(transform[2][0]) * extents.z;
+	extentY[count] = std::abs(transform[0][1]) * extents.x + std::abs(transform[1][1]) * extents.y + std::abs(transform[2][1]) * extents.z;
+	extentZ[count] = std::abs(transform[0][2]) * extents.x + std::abs(transform[1][2]) * extents.y + std::abs(transform[2][2]) * extents.z;
+
+	count++;
+}
+
+uint32_t CullingBounds::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+	size_t visibleBefore = visible.size();
+
+	// a box is outside when it is fully behind any plane: dot(n, c) + w + dot(|n|, e) < 0
+#if defined(__AVX__)
+	for (uint32_t i = 0; i < count; i += 8) {
+		__m256 cx = _mm256_loadu_ps(&centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&extentZ[i]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (const glm::vec4& plane : frustum.planes) {
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+			__m256 radius = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), ey)),
+				_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), ez));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+
+		uint32_t mask = _mm256_movemask_ps(inside);
+		for (uint32_t lane = 0; mask != 0 && lane < 8; lane++, mask >>= 1) {
+			if ((mask & 1) && i + lane < count) {
+				visible.push_back(i + lane);
+			}
+		}
+	}
+#elif defined(__SSE__) || defined(_M_X64)
+	for (uint32_t i = 0; i < count; i += 4) {
+		__m128 cx = _mm_loadu_ps(&centerX[i]);
+		__m128 cy = _mm_loadu_ps(&centerY[i]);
+		__m128 cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]);
+		__m128 ey = _mm_loadu_ps(&extentY[i]);
+		__m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+		__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+		for (const glm::vec4& plane : frustum.planes) {
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+			__m128 radius = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), ey)),
+				_mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+
+		uint32_t mask = _mm_movemask_ps(inside);
+		for (uint32_t lane = 0; mask != 0 && lane < 4; lane++, mask >>= 1) {
+			if ((mask & 1) && i + lane < count) {
+				visible.push_back(i + lane);
+			}
+		}
+	}
+#else
+	for (uint32_t i = 0; i < count; i++) {
+		bool inside = true;
+		for (const glm::vec4& plane : frustum.planes) {
+			float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+			float radius = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+			inside = inside && distance + radius >= 0.0f;
+		}
+		if (inside) {
+			visible.push_back(i);
+		}
+	}
+#endif
+
+	return count - (uint32_t)(visible.size() - visibleBefore);
+}
@@ -0,0 +1,152 @@
+#include "gpu_profiler.h"
+
+#include <fstream>
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameSlots)
+{
+	_device = device;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+	uint32_t validBits = families[queueFamily].timestampValidBits;
+	if (validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+		std::cout << "GpuProfiler: no timestamp support on the graphics queue, gpu timings are off" << std::endl;
+		return;
+	}
+	_timestampPeriod = properties.limits.timestampPeriod;
+	_timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = frameSlots * GPU_PROFILER_MAX_SCOPES * 2;
+	VK_CHECK(vkCreateQueryPool(_device, &poolInfo, nullptr, &_queryPool));
+	// needs hostQueryReset
+	vkResetQueryPool(_device, _queryPool, 0, poolInfo.queryCount);
+
+	_slots.resize(frameSlots);
+	for (Slot& slot : _slots) {
+		slot.scopes.reserve(GPU_PROFILER_MAX_SCOPES);
+	}
+	_results.resize(GPU_PROFILER_MAX_SCOPES * 2);
+	_latest.scopes.reserve(GPU_PROFILER_MAX_SCOPES);
+	_history.reserve(GPU_PROFILER_HISTORY);
+}
+
+void GpuProfiler::destroy()
+{
+	if (_queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(_device, _queryPool, nullptr);
+		_queryPool = VK_NULL_HANDLE;
+	}
+}
+
+void GpuProfiler::begin_frame(uint32_t slot, uint64_t frameNumber)
+{
+	if (!enabled()) {
+		return;
+	}
+
+	read_back(_slots[slot], slot);
+	vkResetQueryPool(_device, _queryPool, slot * GPU_PROFILER_MAX_SCOPES * 2, GPU_PROFILER_MAX_SCOPES * 2);
+
+	_slots[slot].frameNumber = frameNumber;
+	_slots[slot].scopes.clear();
+	_currentSlot = slot;
+	_depth = 0;
+}
+
+uint32_t GpuProfiler::begin_scope(VkCommandBuffer cmd, const char* name)
+{
+	if (!enabled() || _slots[_currentSlot].scopes.size() >= GPU_PROFILER_MAX_SCOPES) {
+		return UINT32_MAX;
+	}
+
+	Slot& slot = _slots[_currentSlot];
+	uint32_t scope = (uint32_t)slot.scopes.size();
+	slot.scopes.push_back({ name, _depth });
+	_depth++;
+
+	uint32_t query = (_currentSlot * GPU_PROFILER_MAX_SCOPES + scope) * 2;
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, _queryPool, query);
+	return scope;
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd, uint32_t scope)
+{
+	if (scope == UINT32_MAX) {
+		return;
+	}
+
+	_depth--;
+
+	uint32_t query = (_currentSlot * GPU_PROFILER_MAX_SCOPES + scope) * 2 + 1;
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, _queryPool, query);
+}
+
+void GpuProfiler::read_back(Slot& slot, uint32_t slotIndex)
+{
+	uint32_t queryCount = (uint32_t)slot.scopes.size() * 2;
+	if (queryCount == 0) {
+		return;
+	}
+
+	// a scope that was begun but never ended leaves its second query unavailable, VK_NOT_READY drops the frame
+	VkResult result = vkGetQueryPoolResults(_device, _queryPool, slotIndex * GPU_PROFILER_MAX_SCOPES * 2, queryCount,
+		queryCount * sizeof(uint64_t), _results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) {
+		return;
+	}
+
+	uint64_t base = _results[0] & _timestampMask;
+	_latest.frameNumber = slot.frameNumber;
+	_latest.scopes.clear();
+	for (uint32_t i = 0; i < slot.scopes.size(); i++) {
+		uint64_t begin = (_results[i * 2] & _timestampMask) - base;
+		uint64_t end = (_results[i * 2 + 1] & _timestampMask) - base;
+		_latest.scopes.push_back({
+			slot.scopes[i].name,
+			slot.scopes[i].depth,
+			(float)(begin * _timestampPeriod / 1e6),
+			(float)(end * _timestampPeriod / 1e6)
+		});
+	}
+
+	if (_history.size() < GPU_PROFILER_HISTORY) {
+		_history.push_back(_latest);
+	} else {
+		// assignment reuses the vector the oldest frame already has
+		_history[_historyNext].frameNumber = _latest.frameNumber;
+		_history[_historyNext].scopes.assign(_latest.scopes.begin(), _latest.scopes.end());
+	}
+	_historyNext = (_historyNext + 1) % GPU_PROFILER_HISTORY;
+}
+
+bool GpuProfiler::export_csv(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open()) {
+		std::cout << path << " failed to open." << std::endl;
+		return false;
+	}
+
+	file << "frame,scope,depth,begin_ms,end_ms,duration_ms\n";
+	// oldest first
+	uint32_t start = _history.size() < GPU_PROFILER_HISTORY ? 0 : _historyNext;
+	for (uint32_t i = 0; i < _history.size(); i++) {
+		const GpuFrameTimings& frame = _history[(start + i) % _history.size()];
+		for (const GpuScopeTiming& scope : frame.scopes) {
+			file << frame.frameNumber << ',' << scope.name << ',' << scope.depth << ','
+				<< scope.beginMs << ',' << scope.endMs << ',' << scope.endMs - scope.beginMs << '\n';
+		}
+	}
+
+	std::cout << "GpuProfiler: wrote " << _history.size() << " frames to " << path << std::endl;
+	return true;
+}
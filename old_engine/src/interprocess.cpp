@@ -1,39 +1,119 @@
 #include "interprocess.h"
 
-Interprocess::Interprocess(const std::unordered_map<std::string, std::shared_ptr<Node>> &nodeMap)
+Interprocess::Interprocess(const std::vector<std::pair<std::string, glm::mat4>> &publishedTransforms)
 {
     boost::interprocess::shared_memory_object::remove("ambfInterprocess");
 
+    _slotCount = static_cast<uint32_t>(publishedTransforms.size()) + 1;
+
+    // room for the transform buffers plus a generous estimate for the directory entries and their names
+    size_t segmentSize = 65536 + _slotCount * (SNAPSHOT_BUFFER_COUNT * sizeof(Transform) + 256);
     _segment = boost::interprocess::managed_shared_memory(
         boost::interprocess::create_only,
         "ambfInterprocess",
-        65536
+        segmentSize
     );
-    _map = _segment.construct<HashMap>("HashMap")(
-        nodeMap.size(), boost::hash<ShmemString>(), std::equal_to<ShmemString>(),
-        _segment.get_allocator<HashValueType>());
-
-    for (auto node : nodeMap) {
-        ShmemString name(node.first.c_str(), _segment.get_allocator<ShmemString>());
-        Transform trans{};
-        assert(sizeof(trans.array) == sizeof(node.second->worldTransform));
-        memcpy(trans.array, glm::value_ptr(node.second->worldTransform), sizeof(node.second->worldTransform));
-        HashValueType value(name, trans);
-        _map->insert(value);
+    _directory = _segment.construct<SlotDirectory>("SlotDirectory")(
+        _slotCount, boost::hash<ShmemString>(), std::equal_to<ShmemString>(),
+        _segment.get_allocator<SlotValueType>());
+    _transforms = _segment.construct<Transform>("Transforms")[SNAPSHOT_BUFFER_COUNT * _slotCount]();
+
+    // the renderer starts out reading buffer 0, the producer writing buffer 2
+    _exchange = _segment.construct<SnapshotExchange>("SnapshotExchange")();
+    _exchange->middle.store(1, std::memory_order_relaxed);
+    _exchange->producerBuffer = 2;
+    for (uint64_t& generation : _exchange->generations) {
+        generation = 0;
     }
+    _readBuffer = 0;
+
+    glm::mat4 cameraMat{ 1.0f };
+    memcpy(_transforms[CAMERA_SLOT].array, glm::value_ptr(cameraMat), sizeof(cameraMat));
     ShmemString cameraBasis("CameraBasis", _segment.get_allocator<ShmemString>());
-    Transform cameraTransform{};
-    glm::mat4 cameraMat{0.0f};
-    cameraMat[0][0] = 1.0f;
-    cameraMat[1][1] = 1.0f;
-    cameraMat[2][2] = 1.0f;
-    cameraMat[3][3] = 1.0f;
-    memcpy(cameraTransform.array, glm::value_ptr(cameraMat), sizeof(cameraMat));
-    HashValueType value(cameraBasis, cameraTransform);
-    _map->insert(value);
+    _directory->insert(SlotValueType(cameraBasis, CAMERA_SLOT));
+
+    for (uint32_t i = 0; i < publishedTransforms.size(); i++) {
+        uint32_t slot = i + 1;
+        memcpy(_transforms[slot].array, glm::value_ptr(publishedTransforms[i].second), sizeof(glm::mat4));
+
+        ShmemString name(publishedTransforms[i].first.c_str(), _segment.get_allocator<ShmemString>());
+        _directory->insert(SlotValueType(name, slot));
+    }
+
+    // every buffer starts from the same frame so whichever one comes around first is complete
+    for (uint32_t buffer = 1; buffer < SNAPSHOT_BUFFER_COUNT; buffer++) {
+        memcpy(&_transforms[buffer * _slotCount], &_transforms[0], _slotCount * sizeof(Transform));
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+bool Interprocess::acquire_transforms()
+{
+    if (!(_exchange->middle.load(std::memory_order_relaxed) & SnapshotExchange::FRESH_BIT)) {
+        return false;
+    }
+
+    // hands our buffer back without the fresh bit and takes whatever is newest, even if the producer
+    // published again since the load above
+    uint32_t previous = _exchange->middle.exchange(_readBuffer, std::memory_order_acq_rel);
+    _readBuffer = previous & SnapshotExchange::INDEX_MASK;
+    return true;
+}
+
+const glm::mat4 *Interprocess::transforms() const
+{
+    return reinterpret_cast<const glm::mat4 *>(&_transforms[_readBuffer * _slotCount]);
 }
 
 void Interprocess::destroy()
 {
     boost::interprocess::shared_memory_object::remove("ambfInterprocess");
 }
+
+bool TransformPublisher::open()
+{
+    try {
+        _segment = boost::interprocess::managed_shared_memory(boost::interprocess::open_only, "ambfInterprocess");
+    }
+    catch (const boost::interprocess::interprocess_exception &) {
+        return false;
+    }
+
+    _directory = _segment.find<SlotDirectory>("SlotDirectory").first;
+    _exchange = _segment.find<SnapshotExchange>("SnapshotExchange").first;
+    auto transforms = _segment.find<Transform>("Transforms");
+    if (_directory == nullptr || _exchange == nullptr || transforms.first == nullptr) {
+        return false;
+    }
+
+    _transforms = transforms.first;
+    _slotCount = static_cast<uint32_t>(transforms.second / SNAPSHOT_BUFFER_COUNT);
+    _lastPublished = _exchange->middle.load(std::memory_order_acquire) & SnapshotExchange::INDEX_MASK;
+    _generation = _exchange->generations[_lastPublished];
+    return true;
+}
+
+uint32_t TransformPublisher::slot(const char *name) const
+{
+    ShmemString key(name, _segment.get_segment_manager());
+    auto it = _directory->find(key);
+    return it != _directory->end() ? it->second : NO_SLOT;
+}
+
+Transform *TransformPublisher::begin_frame()
+{
+    // the last published buffer is either in the middle or being read, both only ever get read
+    Transform *buffer = &_transforms[_exchange->producerBuffer * _slotCount];
+    memcpy(buffer, &_transforms[_lastPublished * _slotCount], _slotCount * sizeof(Transform));
+    return buffer;
+}
+
+void TransformPublisher::publish()
+{
+    uint32_t buffer = _exchange->producerBuffer;
+    _exchange->generations[buffer] = ++_generation;
+
+    uint32_t previous = _exchange->middle.exchange(buffer | SnapshotExchange::FRESH_BIT, std::memory_order_acq_rel);
+    _exchange->producerBuffer = previous & SnapshotExchange::INDEX_MASK;
+    _lastPublished = buffer;
+}
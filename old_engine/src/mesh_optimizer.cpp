@@ -0,0 +1,693 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#include <glm/geometric.hpp>
+#include <glm/vec3.hpp>
+
+static constexpr uint32_t NO_VERTEX = UINT32_MAX;
+
+static glm::vec3 read_position(const uint8_t* positions, size_t vertexStride, uint32_t v)
+{
+	const float* p = reinterpret_cast<const float*>(positions + (size_t)v * vertexStride);
+	return glm::vec3(p[0], p[1], p[2]);
+}
+
+// fifo cache simulation with timestamps, a vertex is a hit while fewer than VERTEX_CACHE_SIZE misses happened since it went in
+struct CacheSimulation {
+	std::vector<uint32_t> timestamps;
+	uint32_t time;
+
+	explicit CacheSimulation(size_t vertexCount)
+		: timestamps(vertexCount, 0)
+		, time(meshopt::VERTEX_CACHE_SIZE + 1)
+	{
+	}
+
+	void flush()
+	{
+		time += meshopt::VERTEX_CACHE_SIZE + 1;
+	}
+
+	uint32_t triangle_misses(const uint32_t* triangle)
+	{
+		uint32_t misses = 0;
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = triangle[k];
+			if (time - timestamps[v] > meshopt::VERTEX_CACHE_SIZE) {
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+};
+
+size_t meshopt::weld_vertices(uint32_t* indices, size_t indexCount, void* vertices, size_t vertexCount, size_t vertexSize)
+{
+	std::vector<uint8_t> source(static_cast<const uint8_t*>(vertices), static_cast<const uint8_t*>(vertices) + vertexCount * vertexSize);
+	uint8_t* destination = static_cast<uint8_t*>(vertices);
+
+	std::unordered_map<std::string_view, uint32_t> unique;
+	unique.reserve(vertexCount);
+
+	std::vector<uint32_t> remap(vertexCount);
+	uint32_t next = 0;
+	for (size_t v = 0; v < vertexCount; v++) {
+		const uint8_t* bytes = source.data() + v * vertexSize;
+		auto [it, inserted] = unique.emplace(std::string_view(reinterpret_cast<const char*>(bytes), vertexSize), next);
+		if (inserted) {
+			memcpy(destination + (size_t)next * vertexSize, bytes, vertexSize);
+			next++;
+		}
+		remap[v] = it->second;
+	}
+
+	for (size_t i = 0; i < indexCount; i++) {
+		indices[i] = remap[indices[i]];
+	}
+
+	return next;
+}
+
+void meshopt::optimize_vertex_cache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& clusters)
+{
+	clusters.clear();
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// vertex to triangle adjacency, packed into one array
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		liveTriangles[indices[i]]++;
+	}
+
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		offsets[v + 1] = offsets[v] + liveTriangles[v];
+	}
+
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+		}
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnds;
+	deadEnds.reserve(triangleCount * 3);
+	std::vector<uint32_t> candidates;
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	uint32_t cursor = 0;
+
+	// once nothing around the current fan is left, continue from a recently used vertex or the next live one
+	auto skip_dead_end = [&]() -> uint32_t {
+		while (!deadEnds.empty()) {
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0) {
+				return v;
+			}
+		}
+		for (; cursor < vertexCount; cursor++) {
+			if (liveTriangles[cursor] > 0) {
+				return cursor;
+			}
+		}
+		return NO_VERTEX;
+	};
+
+	uint32_t fan = indices[0];
+	clusters.push_back(0);
+	while (fan != NO_VERTEX) {
+		candidates.clear();
+
+		for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; a++) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > VERTEX_CACHE_SIZE) {
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// the candidate that has been in the cache longest and still fits its remaining triangles in it
+		uint32_t next = NO_VERTEX;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) {
+				continue;
+			}
+
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE) {
+				priority = time - cacheTime[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		if (next == NO_VERTEX) {
+			next = skip_dead_end();
+			if (next != NO_VERTEX) {
+				clusters.push_back((uint32_t)(output.size() / 3));
+			}
+		}
+		fan = next;
+	}
+
+	memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+}
+
+void meshopt::optimize_overdraw(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& clusters,
+	const uint8_t* positions, size_t vertexStride, size_t vertexCount, float threshold)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || clusters.empty()) {
+		return;
+	}
+
+	// the cache order leaves few, large clusters. split them wherever the cache efficiency so far is
+	// within threshold of the whole cluster's, so the sort below has something to work with
+	std::vector<uint32_t> softClusters;
+	CacheSimulation cache(vertexCount);
+	for (size_t c = 0; c < clusters.size(); c++) {
+		size_t start = clusters[c];
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		cache.flush();
+		uint32_t clusterMisses = 0;
+		for (size_t t = start; t < end; t++) {
+			clusterMisses += cache.triangle_misses(indices + t * 3);
+		}
+		float clusterThreshold = threshold * (float)clusterMisses / (float)(end - start);
+
+		cache.flush();
+		softClusters.push_back((uint32_t)start);
+		size_t softStart = start;
+		uint32_t misses = 0;
+		for (size_t t = start; t + 1 < end; t++) {
+			misses += cache.triangle_misses(indices + t * 3);
+			if ((float)misses / (float)(t + 1 - softStart) <= clusterThreshold) {
+				softClusters.push_back((uint32_t)(t + 1));
+				softStart = t + 1;
+				misses = 0;
+				cache.flush();
+			}
+		}
+	}
+
+	auto position = [&](uint32_t v) {
+		return read_position(positions, vertexStride, v);
+	};
+
+	// area weighted centroid and normal per cluster, the cross product already carries twice the area
+	std::vector<glm::vec3> centroids(softClusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(softClusters.size(), glm::vec3(0.0f));
+	std::vector<float> areas(softClusters.size(), 0.0f);
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t c = 0; c < softClusters.size(); c++) {
+		size_t end = c + 1 < softClusters.size() ? softClusters[c + 1] : triangleCount;
+		for (size_t t = softClusters[c]; t < end; t++) {
+			glm::vec3 p0 = position(indices[t * 3 + 0]);
+			glm::vec3 p1 = position(indices[t * 3 + 1]);
+			glm::vec3 p2 = position(indices[t * 3 + 2]);
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+
+			centroids[c] += center * area;
+			normals[c] += normal;
+			areas[c] += area;
+		}
+
+		meshCentroid += centroids[c];
+		meshArea += areas[c];
+		if (areas[c] > 0.0f) {
+			centroids[c] /= areas[c];
+		}
+	}
+	if (meshArea > 0.0f) {
+		meshCentroid /= meshArea;
+	}
+
+	// clusters facing away from the middle of the mesh are the ones likely to occlude the rest
+	std::vector<float> sortKeys(softClusters.size());
+	std::vector<uint32_t> order(softClusters.size());
+	for (size_t c = 0; c < softClusters.size(); c++) {
+		sortKeys[c] = glm::dot(centroids[c] - meshCentroid, normals[c]);
+		order[c] = (uint32_t)c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return sortKeys[a] > sortKeys[b];
+	});
+
+	std::vector<uint32_t> source(indices, indices + triangleCount * 3);
+	uint32_t* destination = indices;
+	for (uint32_t c : order) {
+		size_t start = softClusters[c];
+		size_t end = c + 1 < softClusters.size() ? softClusters[c + 1] : triangleCount;
+		memcpy(destination, source.data() + start * 3, (end - start) * 3 * sizeof(uint32_t));
+		destination += (end - start) * 3;
+	}
+}
+
+size_t meshopt::optimize_vertex_fetch(uint32_t* indices, size_t indexCount, void* vertices, size_t vertexCount, size_t vertexSize)
+{
+	std::vector<uint32_t> remap(vertexCount, NO_VERTEX);
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& v = remap[indices[i]];
+		if (v == NO_VERTEX) {
+			v = next++;
+		}
+		indices[i] = v;
+	}
+
+	std::vector<uint8_t> source(static_cast<const uint8_t*>(vertices), static_cast<const uint8_t*>(vertices) + vertexCount * vertexSize);
+	uint8_t* destination = static_cast<uint8_t*>(vertices);
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (remap[v] != NO_VERTEX) {
+			memcpy(destination + (size_t)remap[v] * vertexSize, source.data() + v * vertexSize, vertexSize);
+		}
+	}
+
+	return next;
+}
+
+void meshopt::build_meshlets(const uint32_t* indices, size_t indexCount, uint32_t indexOffset,
+	const uint8_t* positions, size_t vertexStride, std::vector<Meshlet>& meshlets)
+{
+	// cos 60 degrees, a triangle further off the meshlet's average normal starts a new one
+	constexpr float MAX_NORMAL_SPREAD = 0.5f;
+	// below this the connectivity and normal rules are ignored, lots of tiny draws cost more than they cull
+	constexpr uint32_t MIN_TRIANGLES = 8;
+
+	auto position = [&](uint32_t v) {
+		return read_position(positions, vertexStride, v);
+	};
+	auto triangle_normal = [&](const uint32_t* triangle) {
+		glm::vec3 p0 = position(triangle[0]);
+		return glm::cross(position(triangle[1]) - p0, position(triangle[2]) - p0);
+	};
+
+	std::vector<uint32_t> meshletVertices;
+	meshletVertices.reserve(MESHLET_MAX_VERTICES);
+	glm::vec3 normalSum(0.0f);
+	size_t start = 0;
+
+	auto finish = [&](size_t end) {
+		if (end == start) {
+			return;
+		}
+
+		glm::vec3 minPos = position(meshletVertices[0]);
+		glm::vec3 maxPos = minPos;
+		for (uint32_t v : meshletVertices) {
+			minPos = glm::min(minPos, position(v));
+			maxPos = glm::max(maxPos, position(v));
+		}
+		glm::vec3 center = (minPos + maxPos) * 0.5f;
+		float radius = 0.0f;
+		for (uint32_t v : meshletVertices) {
+			radius = std::max(radius, glm::length(position(v) - center));
+		}
+
+		float coneCutoff = 1.0f;
+		glm::vec3 axis(0.0f, 0.0f, 1.0f);
+		if (glm::length(normalSum) > 0.0f) {
+			axis = glm::normalize(normalSum);
+			float minDot = 1.0f;
+			for (size_t i = start; i < end; i += 3) {
+				glm::vec3 normal = triangle_normal(indices + i);
+				if (glm::length(normal) > 0.0f) {
+					minDot = std::min(minDot, glm::dot(glm::normalize(normal), axis));
+				}
+			}
+			// wider than a hemisphere can always be seen from somewhere
+			if (minDot > 0.0f) {
+				coneCutoff = std::sqrt(1.0f - minDot * minDot);
+			}
+		}
+
+		Meshlet meshlet{};
+		memcpy(meshlet.center, &center, sizeof(meshlet.center));
+		meshlet.radius = radius;
+		memcpy(meshlet.coneAxis, &axis, sizeof(meshlet.coneAxis));
+		meshlet.coneCutoff = coneCutoff;
+		meshlet.firstIndex = indexOffset + (uint32_t)start;
+		meshlet.indexCount = (uint32_t)(end - start);
+		meshlets.push_back(meshlet);
+
+		start = end;
+		meshletVertices.clear();
+		normalSum = glm::vec3(0.0f);
+	};
+
+	size_t end = indexCount / 3 * 3;
+	for (size_t i = 0; i < end; i += 3) {
+		const uint32_t* triangle = indices + i;
+
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++) {
+			if (std::find(meshletVertices.begin(), meshletVertices.end(), triangle[k]) == meshletVertices.end()) {
+				newVertices++;
+			}
+		}
+
+		glm::vec3 normal = triangle_normal(triangle);
+		uint32_t triangleCount = (uint32_t)(i - start) / 3;
+
+		bool full = meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES || triangleCount + 1 > MESHLET_MAX_TRIANGLES;
+		bool split = false;
+		if (triangleCount >= MIN_TRIANGLES) {
+			bool disconnected = newVertices == 3;
+			bool spread = glm::length(normalSum) > 0.0f && glm::length(normal) > 0.0f
+				&& glm::dot(glm::normalize(normalSum), glm::normalize(normal)) < MAX_NORMAL_SPREAD;
+			split = disconnected || spread;
+		}
+		if (full || split) {
+			finish(i);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			if (std::find(meshletVertices.begin(), meshletVertices.end(), triangle[k]) == meshletVertices.end()) {
+				meshletVertices.push_back(triangle[k]);
+			}
+		}
+		normalSum += normal;
+	}
+	finish(end);
+}
+
+// symmetric 4x4 matrix summing the squared distances to a set of planes, each weighted by its triangle's area
+struct Quadric {
+	double a00{ 0 }, a01{ 0 }, a02{ 0 }, a03{ 0 };
+	double a11{ 0 }, a12{ 0 }, a13{ 0 };
+	double a22{ 0 }, a23{ 0 };
+	double a33{ 0 };
+	double weight{ 0 };
+
+	void add_plane(glm::vec3 n, float d, float w)
+	{
+		a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+		a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+		a22 += w * n.z * n.z; a23 += w * n.z * d;
+		a33 += w * d * d;
+		weight += w;
+	}
+
+	Quadric& operator+=(const Quadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23;
+		a33 += q.a33;
+		weight += q.weight;
+		return *this;
+	}
+
+	// mean squared distance of p to the planes
+	double evaluate(glm::vec3 p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double sum = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+			+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+			+ a22 * z * z + 2 * a23 * z
+			+ a33;
+		return weight > 0 ? std::max(sum / weight, 0.0) : 0.0;
+	}
+};
+
+size_t meshopt::simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount,
+	const uint8_t* positions, size_t vertexStride, size_t vertexCount, size_t targetIndexCount, float& error)
+{
+	std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+	error = 0.0f;
+
+	auto position = [&](uint32_t v) {
+		return read_position(positions, vertexStride, v);
+	};
+
+	// vertices sharing a position are one point of the surface with different attributes, seams and borders
+	// are found on those points rather than on the vertices
+	std::vector<uint32_t> point(vertexCount, NO_VERTEX);
+	std::vector<uint32_t> pointVertexCount;
+	{
+		std::unordered_map<std::string_view, uint32_t> unique;
+		unique.reserve(result.size() / 2);
+		for (uint32_t v : result) {
+			if (point[v] != NO_VERTEX) {
+				continue;
+			}
+			auto [it, inserted] = unique.emplace(std::string_view(reinterpret_cast<const char*>(positions + (size_t)v * vertexStride), sizeof(float) * 3), (uint32_t)pointVertexCount.size());
+			if (inserted) {
+				pointVertexCount.push_back(0);
+			}
+			point[v] = it->second;
+			pointVertexCount[it->second]++;
+		}
+	}
+
+	// a directed edge has to show up exactly once, and its reverse exactly once, for the surface to be closed there
+	std::vector<uint8_t> pointLocked(pointVertexCount.size(), 0);
+	{
+		auto edge_key = [&](uint32_t a, uint32_t b) {
+			return ((uint64_t)point[a] << 32) | point[b];
+		};
+
+		std::vector<uint64_t> edges(result.size());
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				edges[i + k] = edge_key(result[i + k], result[i + (k + 1) % 3]);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		auto edge_count = [&](uint64_t key) {
+			auto range = std::equal_range(edges.begin(), edges.end(), key);
+			return range.second - range.first;
+		};
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t a = result[i + k];
+				uint32_t b = result[i + (k + 1) % 3];
+				if (edge_count(edge_key(a, b)) != 1 || edge_count(edge_key(b, a)) != 1) {
+					pointLocked[point[a]] = 1;
+					pointLocked[point[b]] = 1;
+				}
+			}
+		}
+	}
+
+	// only a vertex alone at its point can be collapsed or collapsed onto, otherwise the other side of the seam would tear
+	auto single = [&](uint32_t v) { return pointVertexCount[point[v]] == 1; };
+	auto collapsible = [&](uint32_t v) { return single(v) && !pointLocked[point[v]]; };
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3) {
+		glm::vec3 p0 = position(result[i + 0]);
+		glm::vec3 p1 = position(result[i + 1]);
+		glm::vec3 p2 = position(result[i + 2]);
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		if (area == 0.0f) {
+			continue;
+		}
+		normal /= area;
+
+		for (int k = 0; k < 3; k++) {
+			quadrics[result[i + k]].add_plane(normal, -glm::dot(normal, p0), area);
+		}
+	}
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		float cost;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<uint64_t> order;
+	std::vector<uint32_t> offsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> remap(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		remap[v] = v;
+	}
+
+	// every pass collapses the cheapest edges that don't share a neighbourhood, then rebuilds the adjacency
+	while (result.size() > targetIndexCount) {
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint32_t v : result) {
+			offsets[v + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+		adjacency.resize(result.size());
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++) {
+			adjacency[fill[result[i]]++] = (uint32_t)(i / 3);
+		}
+
+		// a closed edge shows up once in each winding, only the one going up is looked at
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t a = result[i + k];
+				uint32_t b = result[i + (k + 1) % 3];
+				if (a > b && !pointLocked[point[a]] && !pointLocked[point[b]]) {
+					continue;
+				}
+				if (collapsible(a) && single(b)) {
+					Quadric q = quadrics[a];
+					q += quadrics[b];
+					collapses.push_back(Collapse{ a, b, (float)q.evaluate(position(b)) });
+				}
+				if (collapsible(b) && single(a)) {
+					Quadric q = quadrics[b];
+					q += quadrics[a];
+					collapses.push_back(Collapse{ b, a, (float)q.evaluate(position(a)) });
+				}
+			}
+		}
+		// costs are never negative, so their bits sort like the floats and the key sorts as one integer
+		order.resize(collapses.size());
+		for (size_t c = 0; c < collapses.size(); c++) {
+			uint32_t bits;
+			memcpy(&bits, &collapses[c].cost, sizeof(bits));
+			order[c] = ((uint64_t)bits << 32) | c;
+		}
+		std::sort(order.begin(), order.end());
+
+		// moving a vertex must not turn any of its other triangles over
+		auto flips = [&](uint32_t from, uint32_t to) {
+			glm::vec3 target = position(to);
+			for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++) {
+				const uint32_t* triangle = &result[adjacency[a] * 3];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+					continue;
+				}
+
+				glm::vec3 before[3];
+				glm::vec3 after[3];
+				for (int k = 0; k < 3; k++) {
+					before[k] = position(triangle[k]);
+					after[k] = triangle[k] == from ? target : before[k];
+				}
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				if (glm::dot(normalBefore, normalAfter) <= 0.0f) {
+					return true;
+				}
+			}
+			return false;
+		};
+
+		// the edge has to be the only link between its ends' neighbourhoods, which for an interior edge means
+		// exactly the two opposite vertices are shared. anything else folds the surface onto itself
+		std::vector<uint32_t> ring;
+		auto shares_more_than_edge = [&](uint32_t from, uint32_t to) {
+			ring.clear();
+			for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++) {
+				const uint32_t* triangle = &result[adjacency[a] * 3];
+				for (int k = 0; k < 3; k++) {
+					if (triangle[k] != from && triangle[k] != to) {
+						ring.push_back(triangle[k]);
+					}
+				}
+			}
+			std::sort(ring.begin(), ring.end());
+			ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+
+			uint32_t shared = 0;
+			for (uint32_t a = offsets[to]; a < offsets[to + 1]; a++) {
+				const uint32_t* triangle = &result[adjacency[a] * 3];
+				for (int k = 0; k < 3; k++) {
+					if (std::binary_search(ring.begin(), ring.end(), triangle[k])) {
+						shared++;
+					}
+				}
+			}
+			// every shared vertex is seen from both of its triangles around to
+			return shared > 4;
+		};
+
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removed = 0;
+		size_t collapsed = 0;
+		for (uint64_t key : order) {
+			const Collapse& collapse = collapses[(uint32_t)key];
+			if (touched[collapse.from] || touched[collapse.to]
+				|| flips(collapse.from, collapse.to) || shares_more_than_edge(collapse.from, collapse.to)) {
+				continue;
+			}
+
+			for (uint32_t a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++) {
+				const uint32_t* triangle = &result[adjacency[a] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			error = std::max(error, (float)std::sqrt(collapse.cost));
+			collapsed++;
+
+			// an interior vertex takes the two triangles of the collapsed edge with it
+			removed += 2;
+			if (removed >= trianglesToRemove) {
+				break;
+			}
+		}
+
+		if (collapsed == 0) {
+			break;
+		}
+
+		size_t written = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			uint32_t a = remap[result[i + 0]];
+			uint32_t b = remap[result[i + 1]];
+			uint32_t c = remap[result[i + 2]];
+			if (a != b && b != c && c != a) {
+				result[written++] = a;
+				result[written++] = b;
+				result[written++] = c;
+			}
+		}
+		result.resize(written);
+	}
+
+	memcpy(destination, result.data(), result.size() * sizeof(uint32_t));
+	return result.size();
+}
@@ -0,0 +1,227 @@
+#include "pipeline_compiler.h"
+#include "cpu_trace.h"
+
+#include <array>
+
+namespace {
+
+	template<typename T>
+	void append_key(std::string& key, const T& value)
+	{
+		key.append((const char*)&value, sizeof(T));
+	}
+
+	VkShaderModule find_stage(const PipelineBuilder& builder, bool fragment)
+	{
+		for (const VkPipelineShaderStageCreateInfo& stage : builder._shaderStages) {
+			if ((stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) == fragment) {
+				return stage.module;
+			}
+		}
+		return VK_NULL_HANDLE;
+	}
+
+	// only the fields a part actually reads, so unrelated state doesn't split the cache
+	std::string library_key(const PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT part)
+	{
+		std::string key;
+		append_key(key, part);
+
+		switch (part) {
+		case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+			append_key(key, builder._inputAssembly.topology);
+			append_key(key, builder._inputAssembly.primitiveRestartEnable);
+			break;
+		case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+			append_key(key, find_stage(builder, false));
+			append_key(key, builder._pipelineLayout);
+			append_key(key, builder._rasterizer.polygonMode);
+			append_key(key, builder._rasterizer.cullMode);
+			append_key(key, builder._rasterizer.frontFace);
+			append_key(key, builder._rasterizer.lineWidth);
+			break;
+		case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+			append_key(key, find_stage(builder, true));
+			append_key(key, builder._pipelineLayout);
+			append_key(key, builder._depthStencil.depthTestEnable);
+			append_key(key, builder._depthStencil.depthWriteEnable);
+			append_key(key, builder._depthStencil.depthCompareOp);
+			append_key(key, builder._multisampling.rasterizationSamples);
+			append_key(key, builder._multisampling.sampleShadingEnable);
+			append_key(key, builder._multisampling.minSampleShading);
+			break;
+		case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT:
+			append_key(key, builder._colorBlendAttachment);
+			append_key(key, builder._renderInfo.colorAttachmentCount);
+			append_key(key, builder._colorAttachmentFormat);
+			append_key(key, builder._renderInfo.depthAttachmentFormat);
+			append_key(key, builder._multisampling.rasterizationSamples);
+			break;
+		}
+
+		return key;
+	}
+
+	constexpr std::array<VkGraphicsPipelineLibraryFlagsEXT, 4> LIBRARY_PARTS = {
+		VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+	};
+
+}
+
+void PipelineCompiler::init(VkDevice device, VkPipelineCache cache, bool useLibraries, bool fastLinking, uint32_t threadCount)
+{
+	_device = device;
+	_cache = cache;
+	_useLibraries = useLibraries;
+	_fastLinking = fastLinking;
+	_quit = false;
+
+	for (uint32_t i = 0; i < threadCount; i++) {
+		_threads.emplace_back(&PipelineCompiler::worker_loop, this);
+	}
+}
+
+void PipelineCompiler::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+		_pending -= (uint32_t)_jobs.size();
+		_jobs.clear();
+	}
+	_jobAvailable.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+	_threads.clear();
+
+	for (VkPipeline pipeline : _retired) {
+		vkDestroyPipeline(_device, pipeline, nullptr);
+	}
+	_retired.clear();
+
+	for (auto& [key, library] : _libraries) {
+		vkDestroyPipeline(_device, library, nullptr);
+	}
+	_libraries.clear();
+}
+
+void PipelineCompiler::compile(const PipelineBuilder& builder, MaterialPipeline* target)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		// without fast linking the unoptimized link is not worth publishing first
+		_jobs.push_back(Job{ builder, target, _useLibraries && !_fastLinking });
+		_pending++;
+	}
+	_jobAvailable.notify_one();
+}
+
+void PipelineCompiler::wait_idle()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock, [&]() { return _pending == 0; });
+}
+
+uint32_t PipelineCompiler::pending_count()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _pending;
+}
+
+void PipelineCompiler::worker_loop()
+{
+	cputrace::set_thread_name("pipeline compiler");
+
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_jobAvailable.wait(lock, [&]() { return _quit || !_jobs.empty(); });
+			if (_quit) {
+				return;
+			}
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+
+		run_job(job);
+
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			idle = --_pending == 0;
+		}
+		if (idle) {
+			_idle.notify_all();
+		}
+	}
+}
+
+void PipelineCompiler::run_job(Job& job)
+{
+	TRACE_FUNCTION();
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	if (!_useLibraries) {
+		VK_CHECK(job.builder.build_pipeline(_device, pipeline, _cache));
+		publish(job.target, pipeline);
+		return;
+	}
+
+	std::array<VkPipeline, LIBRARY_PARTS.size()> libraries;
+	for (size_t i = 0; i < LIBRARY_PARTS.size(); i++) {
+		libraries[i] = get_library(job.builder, LIBRARY_PARTS[i]);
+	}
+
+	VK_CHECK(PipelineBuilder::link_libraries(_device, libraries, job.builder._pipelineLayout, job.optimize, pipeline, _cache));
+	publish(job.target, pipeline);
+
+	if (!job.optimize) {
+		// back of the queue, so every pending material gets a usable pipeline before any of them is optimized
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_quit) {
+			job.optimize = true;
+			_jobs.push_back(std::move(job));
+			_pending++;
+			_jobAvailable.notify_one();
+		}
+	}
+}
+
+VkPipeline PipelineCompiler::get_library(const PipelineBuilder& builder, VkGraphicsPipelineLibraryFlagsEXT part)
+{
+	std::string key = library_key(builder, part);
+	{
+		std::lock_guard<std::mutex> lock(_libraryMutex);
+		auto it = _libraries.find(key);
+		if (it != _libraries.end()) {
+			return it->second;
+		}
+	}
+
+	// compiled outside the lock, two threads racing on the same part just throw one result away
+	PipelineBuilder partBuilder = builder;
+	VkPipeline library;
+	VK_CHECK(partBuilder.build_library(_device, part, library, _cache));
+
+	std::lock_guard<std::mutex> lock(_libraryMutex);
+	auto [it, inserted] = _libraries.emplace(std::move(key), library);
+	if (!inserted) {
+		vkDestroyPipeline(_device, library, nullptr);
+	}
+	return it->second;
+}
+
+void PipelineCompiler::publish(MaterialPipeline* target, VkPipeline pipeline)
+{
+	VkPipeline previous = target->pipeline.exchange(pipeline, std::memory_order_acq_rel);
+	if (previous != VK_NULL_HANDLE) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_retired.push_back(previous);
+	}
+}
@@ -0,0 +1,208 @@
+#include "scene_cache.h"
+
+#include <fstream>
+#include <iostream>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t CookedScene::add_string(std::string_view str)
+{
+	uint32_t offset = (uint32_t)strings.size();
+	strings.append(str);
+	strings.push_back('\0');
+	return offset;
+}
+
+bool SceneCacheView::open(const std::filesystem::path& cachePath, const std::filesystem::path& sourcePath)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(cachePath, ec)) {
+		return false;
+	}
+
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	if (!scenecache::source_stamp(sourcePath, sourceSize, sourceWriteTime)) {
+		return false;
+	}
+
+	uint64_t fileSize = std::filesystem::file_size(cachePath, ec);
+	if (ec || fileSize < sizeof(SceneCacheHeader)) {
+		return false;
+	}
+
+	try {
+		_file = boost::interprocess::file_mapping(cachePath.string().c_str(), boost::interprocess::read_only);
+		_region = boost::interprocess::mapped_region(_file, boost::interprocess::read_only);
+	}
+	catch (const boost::interprocess::interprocess_exception& e) {
+		std::cout << "Failed to map scene cache " << cachePath << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	_base = static_cast<const uint8_t*>(_region.get_address());
+	_header = reinterpret_cast<const SceneCacheHeader*>(_base);
+
+	if (_header->magic != SCENE_CACHE_MAGIC || _header->version != SCENE_CACHE_VERSION) {
+		std::cout << "Scene cache " << cachePath << " was written by a different cooker version" << std::endl;
+		return false;
+	}
+	if (_header->sourceSize != sourceSize) {
+		std::cout << "Scene cache " << cachePath << " is stale" << std::endl;
+		return false;
+	}
+	if (_header->sourceWriteTime != sourceWriteTime) {
+		uint64_t sourceHash;
+		if (!scenecache::source_hash(sourcePath, sourceHash) || sourceHash != _header->sourceHash) {
+			std::cout << "Scene cache " << cachePath << " is stale" << std::endl;
+			return false;
+		}
+	}
+
+	const SceneCacheSection* sections[] = {
+		&_header->samplers, &_header->images, &_header->materials, &_header->surfaces, &_header->meshes,
+		&_header->nodes, &_header->vertices, &_header->indices, &_header->meshlets, &_header->texels, &_header->strings
+	};
+	const uint64_t elementSizes[] = {
+		sizeof(CookedSampler), sizeof(CookedImage), sizeof(CookedMaterial), sizeof(CookedSurface), sizeof(CookedMesh),
+		sizeof(CookedNode), sizeof(CookedVertex), sizeof(uint32_t), sizeof(Meshlet), 1, 1
+	};
+	for (size_t i = 0; i < std::size(sections); i++) {
+		if (sections[i]->offset + sections[i]->count * elementSizes[i] > _region.get_size()) {
+			std::cout << "Scene cache " << cachePath << " is truncated" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const char* SceneCacheView::string(uint32_t offset) const
+{
+	return reinterpret_cast<const char*>(_base + _header->strings.offset + offset);
+}
+
+const uint8_t* SceneCacheView::texels(uint64_t offset) const
+{
+	return _base + _header->texels.offset + offset;
+}
+
+std::filesystem::path scenecache::cache_path(const std::filesystem::path& sourcePath)
+{
+	std::filesystem::path path = sourcePath;
+	path += SCENE_CACHE_EXTENSION;
+	return path;
+}
+
+bool scenecache::source_stamp(const std::filesystem::path& sourcePath, uint64_t& size, int64_t& writeTime)
+{
+	std::error_code ec;
+	size = std::filesystem::file_size(sourcePath, ec);
+	if (ec) {
+		return false;
+	}
+
+	auto time = std::filesystem::last_write_time(sourcePath, ec);
+	if (ec) {
+		return false;
+	}
+	writeTime = time.time_since_epoch().count();
+
+	return true;
+}
+
+bool scenecache::source_hash(const std::filesystem::path& sourcePath, uint64_t& hash)
+{
+	std::ifstream in(sourcePath, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+
+	hash = 0xcbf29ce484222325ull;
+	std::vector<char> chunk(1 << 20);
+	while (in) {
+		in.read(chunk.data(), chunk.size());
+		for (std::streamsize i = 0; i < in.gcount(); i++) {
+			hash = (hash ^ (uint8_t)chunk[i]) * 0x100000001b3ull;
+		}
+	}
+
+	return in.eof();
+}
+
+bool scenecache::write(const std::filesystem::path& cachePath, const CookedScene& scene)
+{
+	SceneCacheHeader header{};
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.sourceSize = scene.sourceSize;
+	header.sourceWriteTime = scene.sourceWriteTime;
+	header.sourceHash = scene.sourceHash;
+
+	uint64_t offset = align_up(sizeof(SceneCacheHeader), 16);
+	auto place = [&](SceneCacheSection& section, uint64_t count, uint64_t elementSize) {
+		section.offset = offset;
+		section.count = count;
+		offset = align_up(offset + count * elementSize, 16);
+	};
+
+	place(header.samplers, scene.samplers.size(), sizeof(CookedSampler));
+	place(header.images, scene.images.size(), sizeof(CookedImage));
+	place(header.materials, scene.materials.size(), sizeof(CookedMaterial));
+	place(header.surfaces, scene.surfaces.size(), sizeof(CookedSurface));
+	place(header.meshes, scene.meshes.size(), sizeof(CookedMesh));
+	place(header.nodes, scene.nodes.size(), sizeof(CookedNode));
+	place(header.vertices, scene.vertices.size(), sizeof(CookedVertex));
+	place(header.indices, scene.indices.size(), sizeof(uint32_t));
+	place(header.meshlets, scene.meshlets.size(), sizeof(Meshlet));
+	place(header.texels, scene.texels.size(), 1);
+	place(header.strings, scene.strings.size(), 1);
+
+	// written next to the final file and renamed, so a crashed cook never leaves a half written cache behind
+	std::filesystem::path tempPath = cachePath;
+	tempPath += ".tmp";
+
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cout << "Failed to open " << tempPath << " for writing" << std::endl;
+		return false;
+	}
+
+	auto write_section = [&](const SceneCacheSection& section, const void* data, uint64_t size) {
+		uint64_t position = out.tellp();
+		static const char zeros[16] = {};
+		out.write(zeros, section.offset - position);
+		out.write(static_cast<const char*>(data), size);
+	};
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	write_section(header.samplers, scene.samplers.data(), scene.samplers.size() * sizeof(CookedSampler));
+	write_section(header.images, scene.images.data(), scene.images.size() * sizeof(CookedImage));
+	write_section(header.materials, scene.materials.data(), scene.materials.size() * sizeof(CookedMaterial));
+	write_section(header.surfaces, scene.surfaces.data(), scene.surfaces.size() * sizeof(CookedSurface));
+	write_section(header.meshes, scene.meshes.data(), scene.meshes.size() * sizeof(CookedMesh));
+	write_section(header.nodes, scene.nodes.data(), scene.nodes.size() * sizeof(CookedNode));
+	write_section(header.vertices, scene.vertices.data(), scene.vertices.size() * sizeof(CookedVertex));
+	write_section(header.indices, scene.indices.data(), scene.indices.size() * sizeof(uint32_t));
+	write_section(header.meshlets, scene.meshlets.data(), scene.meshlets.size() * sizeof(Meshlet));
+	write_section(header.texels, scene.texels.data(), scene.texels.size());
+	write_section(header.strings, scene.strings.data(), scene.strings.size());
+	out.close();
+
+	if (!out) {
+		std::cout << "Failed to write " << tempPath << std::endl;
+		return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, cachePath, ec);
+	if (ec) {
+		std::cout << "Failed to move " << tempPath << " to " << cachePath << ": " << ec.message() << std::endl;
+		return false;
+	}
+
+	return true;
+}
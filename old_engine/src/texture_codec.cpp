@@ -0,0 +1,508 @@
+#include "texture_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+uint32_t texcodec::block_extent(TextureFormat format)
+{
+	return format == TextureFormat::RGBA8 ? 1 : 4;
+}
+
+uint32_t texcodec::block_bytes(TextureFormat format)
+{
+	switch (format) {
+	case TextureFormat::RGBA8: return 4;
+	case TextureFormat::BC1: return 8;
+	case TextureFormat::BC5: return 16;
+	case TextureFormat::BC7: return 16;
+	}
+	return 4;
+}
+
+size_t texcodec::level_size(TextureFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+	uint32_t extent = block_extent(format);
+	size_t blocksX = (std::max(width >> level, 1u) + extent - 1) / extent;
+	size_t blocksY = (std::max(height >> level, 1u) + extent - 1) / extent;
+	return blocksX * blocksY * block_bytes(format);
+}
+
+uint32_t texcodec::full_mip_count(uint32_t width, uint32_t height)
+{
+	return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+}
+
+void texcodec::build_mips(const uint8_t* pixels, uint32_t width, uint32_t height, TextureData& out)
+{
+	out.format = TextureFormat::RGBA8;
+	out.width = width;
+	out.height = height;
+	out.mipLevels = full_mip_count(width, height);
+
+	out.texels.assign(pixels, pixels + (size_t)width * height * 4);
+
+	size_t srcOffset = 0;
+	uint32_t srcWidth = width;
+	uint32_t srcHeight = height;
+	for (uint32_t level = 1; level < out.mipLevels; level++) {
+		uint32_t dstWidth = std::max(srcWidth / 2, 1u);
+		uint32_t dstHeight = std::max(srcHeight / 2, 1u);
+
+		size_t dstOffset = out.texels.size();
+		out.texels.resize(dstOffset + (size_t)dstWidth * dstHeight * 4);
+
+		const uint8_t* src = out.texels.data() + srcOffset;
+		uint8_t* dst = out.texels.data() + dstOffset;
+		for (uint32_t y = 0; y < dstHeight; y++) {
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				uint32_t x0 = std::min(x * 2, srcWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+				uint32_t y0 = std::min(y * 2, srcHeight - 1);
+				uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c]
+						+ src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+					dst[(y * dstWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+
+		srcOffset = dstOffset;
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+	}
+}
+
+bool texcodec::has_alpha(const TextureData& texture)
+{
+	if (texture.format != TextureFormat::RGBA8) {
+		return false;
+	}
+
+	size_t texelCount = (size_t)texture.width * texture.height;
+	for (size_t i = 0; i < texelCount; i++) {
+		if (texture.texels[i * 4 + 3] != 255) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// direction of largest spread of the block's texels around their mean, found by power iteration
+// on the covariance. the first `channels` channels take part, the rest of axis is left at 0
+static void principal_axis(const float texels[16][4], int channels, float mean[4], float axis[4])
+{
+	for (int c = 0; c < 4; c++) {
+		mean[c] = 0.0f;
+		axis[c] = 0.0f;
+	}
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < channels; c++) {
+			mean[c] += texels[i][c] / 16.0f;
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++) {
+				covariance[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+			}
+		}
+	}
+
+	// start from the channel that varies most, it is never orthogonal to the answer
+	int widest = 0;
+	for (int c = 1; c < channels; c++) {
+		if (covariance[c][c] > covariance[widest][widest]) {
+			widest = c;
+		}
+	}
+	axis[widest] = 1.0f;
+
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < channels; b++) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+		}
+
+		float length = 0.0f;
+		for (int c = 0; c < channels; c++) {
+			length += next[c] * next[c];
+		}
+		if (length <= 0.0f) {
+			return;
+		}
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++) {
+			axis[c] = next[c] / length;
+		}
+	}
+}
+
+// the two texels' worth of color at the ends of the block's principal axis
+static void axis_endpoints(const float texels[16][4], int channels, float low[4], float high[4])
+{
+	float mean[4];
+	float axis[4];
+	principal_axis(texels, channels, mean, axis);
+
+	float minProjection = 0.0f;
+	float maxProjection = 0.0f;
+	for (int i = 0; i < 16; i++) {
+		float projection = 0.0f;
+		for (int c = 0; c < channels; c++) {
+			projection += (texels[i][c] - mean[c]) * axis[c];
+		}
+		minProjection = std::min(minProjection, projection);
+		maxProjection = std::max(maxProjection, projection);
+	}
+
+	for (int c = 0; c < 4; c++) {
+		low[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+		high[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+	}
+}
+
+static int nearest(const float texel[4], const float palette[][4], int paletteSize, int channels)
+{
+	int best = 0;
+	float bestError = INFINITY;
+	for (int p = 0; p < paletteSize; p++) {
+		float error = 0.0f;
+		for (int c = 0; c < channels; c++) {
+			float d = texel[c] - palette[p][c];
+			error += d * d;
+		}
+		if (error < bestError) {
+			bestError = error;
+			best = p;
+		}
+	}
+	return best;
+}
+
+static uint16_t to_565(const float color[4])
+{
+	uint32_t r = (uint32_t)std::lround(color[0] * 31.0f / 255.0f);
+	uint32_t g = (uint32_t)std::lround(color[1] * 63.0f / 255.0f);
+	uint32_t b = (uint32_t)std::lround(color[2] * 31.0f / 255.0f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t packed, float color[4])
+{
+	uint32_t r = (packed >> 11) & 31;
+	uint32_t g = (packed >> 5) & 63;
+	uint32_t b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+	color[3] = 255.0f;
+}
+
+static void encode_bc1(const float texels[16][4], uint8_t* out)
+{
+	float low[4];
+	float high[4];
+	axis_endpoints(texels, 3, low, high);
+
+	uint16_t color0 = to_565(high);
+	uint16_t color1 = to_565(low);
+	// color0 > color1 selects the four color mode without transparency
+	if (color0 < color1) {
+		std::swap(color0, color1);
+	}
+
+	float palette[4][4];
+	from_565(color0, palette[0]);
+	from_565(color1, palette[1]);
+	for (int c = 0; c < 4; c++) {
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1) {
+		for (int i = 0; i < 16; i++) {
+			indices |= (uint32_t)nearest(texels[i], palette, 4, 3) << (i * 2);
+		}
+	}
+
+	memcpy(out, &color0, 2);
+	memcpy(out + 2, &color1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// one channel of a bc4 block, in the eight value mode
+static void encode_bc4(const float texels[16][4], int channel, uint8_t* out)
+{
+	float minValue = 255.0f;
+	float maxValue = 0.0f;
+	for (int i = 0; i < 16; i++) {
+		minValue = std::min(minValue, texels[i][channel]);
+		maxValue = std::max(maxValue, texels[i][channel]);
+	}
+
+	uint8_t value0 = (uint8_t)std::lround(maxValue);
+	uint8_t value1 = (uint8_t)std::lround(minValue);
+
+	uint64_t indices = 0;
+	if (value0 > value1) {
+		float palette[8][4] = {};
+		palette[0][0] = value0;
+		palette[1][0] = value1;
+		for (int p = 2; p < 8; p++) {
+			palette[p][0] = ((8 - p) * value0 + (p - 1) * value1) / 7.0f;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			float texel[4] = { texels[i][channel] };
+			indices |= (uint64_t)nearest(texel, palette, 8, 1) << (i * 3);
+		}
+	}
+
+	out[0] = value0;
+	out[1] = value1;
+	memcpy(out + 2, &indices, 6);
+}
+
+static void encode_bc5(const float texels[16][4], uint8_t* out)
+{
+	encode_bc4(texels, 0, out);
+	encode_bc4(texels, 1, out + 8);
+}
+
+// bc7 blocks are a little endian bit stream
+struct BlockWriter {
+	uint8_t* out;
+	uint32_t position{ 0 };
+
+	void put(uint32_t value, uint32_t bits)
+	{
+		for (uint32_t b = 0; b < bits; b++, position++) {
+			if (value & (1u << b)) {
+				out[position / 8] |= (uint8_t)(1u << (position % 8));
+			}
+		}
+	}
+};
+
+// mode 6 only: one subset, rgba endpoints of 7 bits plus a p-bit each and 4 bit indices.
+// that is the mode with the finest gradients, good enough for everything a material samples
+static void encode_bc7(const float texels[16][4], uint8_t* out)
+{
+	static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	float ends[2][4];
+	axis_endpoints(texels, 4, ends[1], ends[0]);
+
+	// each endpoint gets the p-bit that quantizes it best
+	uint32_t quantized[2][4];
+	uint32_t pbits[2];
+	for (int e = 0; e < 2; e++) {
+		float bestError = INFINITY;
+		for (uint32_t p = 0; p < 2; p++) {
+			uint32_t q[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++) {
+				q[c] = (uint32_t)std::clamp((long)std::lround((ends[e][c] - p) / 2.0f), 0l, 127l);
+				float d = (float)(q[c] * 2 + p) - ends[e][c];
+				error += d * d;
+			}
+			if (error < bestError) {
+				bestError = error;
+				pbits[e] = p;
+				memcpy(quantized[e], q, sizeof(q));
+			}
+		}
+	}
+
+	float palette[16][4];
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			int e0 = (int)(quantized[0][c] * 2 + pbits[0]);
+			int e1 = (int)(quantized[1][c] * 2 + pbits[1]);
+			palette[i][c] = (float)(((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6);
+		}
+	}
+
+	uint32_t indices[16];
+	for (int i = 0; i < 16; i++) {
+		indices[i] = (uint32_t)nearest(texels[i], palette, 16, 4);
+	}
+
+	// the first index is stored without its top bit, flip the block around when it is set
+	if (indices[0] >= 8) {
+		std::swap(quantized[0], quantized[1]);
+		std::swap(pbits[0], pbits[1]);
+		for (int i = 0; i < 16; i++) {
+			indices[i] = 15 - indices[i];
+		}
+	}
+
+	memset(out, 0, 16);
+	BlockWriter writer{ out };
+	writer.put(1u << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		writer.put(quantized[0][c], 7);
+		writer.put(quantized[1][c], 7);
+	}
+	writer.put(pbits[0], 1);
+	writer.put(pbits[1], 1);
+	writer.put(indices[0], 3);
+	for (int i = 1; i < 16; i++) {
+		writer.put(indices[i], 4);
+	}
+}
+
+void texcodec::compress(TextureData& texture, TextureFormat format)
+{
+	if (texture.format != TextureFormat::RGBA8 || format == TextureFormat::RGBA8) {
+		return;
+	}
+
+	std::vector<uint8_t> compressed;
+	size_t srcOffset = 0;
+	for (uint32_t level = 0; level < texture.mipLevels; level++) {
+		uint32_t width = std::max(texture.width >> level, 1u);
+		uint32_t height = std::max(texture.height >> level, 1u);
+		const uint8_t* src = texture.texels.data() + srcOffset;
+
+		size_t dstOffset = compressed.size();
+		compressed.resize(dstOffset + level_size(format, texture.width, texture.height, level));
+		uint8_t* dst = compressed.data() + dstOffset;
+
+		for (uint32_t by = 0; by < height; by += 4) {
+			for (uint32_t bx = 0; bx < width; bx += 4) {
+				float texels[16][4];
+				for (uint32_t i = 0; i < 16; i++) {
+					uint32_t x = std::min(bx + i % 4, width - 1);
+					uint32_t y = std::min(by + i / 4, height - 1);
+					for (uint32_t c = 0; c < 4; c++) {
+						texels[i][c] = src[(y * width + x) * 4 + c];
+					}
+				}
+
+				switch (format) {
+				case TextureFormat::BC1: encode_bc1(texels, dst); break;
+				case TextureFormat::BC5: encode_bc5(texels, dst); break;
+				case TextureFormat::BC7: encode_bc7(texels, dst); break;
+				default: break;
+				}
+				dst += block_bytes(format);
+			}
+		}
+
+		srcOffset += (size_t)width * height * 4;
+	}
+
+	texture.format = format;
+	texture.texels = std::move(compressed);
+}
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+
+// the header fields after the identifier, see the ktx 2.0 specification. the supercompression
+// global data range follows, unused without supercompression, and the level index starts at byte 80
+struct Ktx2Header {
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+};
+
+constexpr size_t KTX2_LEVEL_INDEX_OFFSET = 80;
+
+struct Ktx2Level {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+bool texcodec::is_ktx2(const uint8_t* data, size_t size)
+{
+	return size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+bool texcodec::load_ktx2(const uint8_t* data, size_t size, TextureData& out)
+{
+	if (!is_ktx2(data, size) || size < KTX2_LEVEL_INDEX_OFFSET) {
+		std::cout << "ktx2: not a ktx2 file" << std::endl;
+		return false;
+	}
+
+	Ktx2Header header;
+	memcpy(&header, data + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+	// VkFormat values, the srgb variants are read like the unorm ones since every texture is sampled as unorm
+	switch (header.vkFormat) {
+	case 37: case 43: out.format = TextureFormat::RGBA8; break;
+	case 131: case 132: case 133: case 134: out.format = TextureFormat::BC1; break;
+	case 141: out.format = TextureFormat::BC5; break;
+	case 145: case 146: out.format = TextureFormat::BC7; break;
+	default:
+		// 0 is basis universal, which needs a transcoder
+		std::cout << "ktx2: unsupported vkFormat " << header.vkFormat << std::endl;
+		return false;
+	}
+
+	if (header.supercompressionScheme != 0) {
+		std::cout << "ktx2: supercompression scheme " << header.supercompressionScheme << " is not supported" << std::endl;
+		return false;
+	}
+	if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+		std::cout << "ktx2: only single 2d images are supported" << std::endl;
+		return false;
+	}
+
+	out.width = header.pixelWidth;
+	out.height = header.pixelHeight;
+	// 0 asks the loader to generate them
+	uint32_t storedLevels = std::max(header.levelCount, 1u);
+	if (storedLevels > full_mip_count(out.width, out.height)) {
+		std::cout << "ktx2: " << storedLevels << " levels for a " << out.width << "x" << out.height << " image" << std::endl;
+		return false;
+	}
+
+	size_t levelIndexOffset = KTX2_LEVEL_INDEX_OFFSET;
+	if (levelIndexOffset + storedLevels * sizeof(Ktx2Level) > size) {
+		std::cout << "ktx2: truncated level index" << std::endl;
+		return false;
+	}
+
+	out.texels.clear();
+	for (uint32_t level = 0; level < storedLevels; level++) {
+		Ktx2Level entry;
+		memcpy(&entry, data + levelIndexOffset + level * sizeof(Ktx2Level), sizeof(entry));
+
+		size_t expected = level_size(out.format, out.width, out.height, level);
+		if (entry.byteLength != expected || entry.byteOffset > size || entry.byteLength > size - entry.byteOffset) {
+			std::cout << "ktx2: level " << level << " is truncated or has an unexpected size" << std::endl;
+			return false;
+		}
+		out.texels.insert(out.texels.end(), data + entry.byteOffset, data + entry.byteOffset + entry.byteLength);
+	}
+	out.mipLevels = storedLevels;
+
+	if (header.levelCount == 0 && out.format == TextureFormat::RGBA8) {
+		std::vector<uint8_t> base = std::move(out.texels);
+		build_mips(base.data(), out.width, out.height, out);
+	}
+
+	return true;
+}
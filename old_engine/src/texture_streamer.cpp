@@ -0,0 +1,287 @@
+#include "texture_streamer.h"
+#include "vk_engine.h"
+#include "vk_images.h"
+#include "cpu_trace.h"
+
+#include <algorithm>
+
+void TextureStreamer::init(VulkanEngine* engine, VkDeviceSize budget)
+{
+	_engine = engine;
+	_budget = budget;
+	_committedBytes = 0;
+	_pendingCount = 0;
+	_frame = 0;
+}
+
+void TextureStreamer::destroy()
+{
+	// the uploader may be gone already, with the device idle nothing is left to wait for
+	for (StreamedTexture& texture : _textures) {
+		if (!texture.live) {
+			continue;
+		}
+		if (texture.pending) {
+			_engine->destroy_image(texture.pendingImage);
+		}
+		_engine->destroy_image(texture.image);
+	}
+
+	_textures.clear();
+	_freeTextures.clear();
+	_views.clear();
+}
+
+uint32_t TextureStreamer::add_texture(std::shared_ptr<const void> owner, const uint8_t* texels, VkExtent3D extent, VkFormat format, uint32_t mipLevels)
+{
+	uint32_t handle;
+	if (!_freeTextures.empty()) {
+		handle = _freeTextures.back();
+		_freeTextures.pop_back();
+	}
+	else {
+		handle = (uint32_t)_textures.size();
+		_textures.emplace_back();
+	}
+
+	StreamedTexture& texture = _textures[handle];
+	texture = StreamedTexture{};
+	texture.owner = std::move(owner);
+	texture.texels = texels;
+	texture.extent = extent;
+	texture.format = format;
+	texture.mipLevels = mipLevels;
+	texture.live = true;
+
+	while (texture.tailMip + 1 < mipLevels && std::max(extent.width, extent.height) >> texture.tailMip > STREAM_TAIL_SIZE) {
+		texture.tailMip++;
+	}
+
+	// the tail goes up like any other texture and is drawn with as soon as its batch lands
+	uint64_t ticket;
+	texture.image = upload_levels(texture, texture.tailMip, ticket);
+	texture.residentMip = texture.tailMip;
+	texture.wantedMip = texture.tailMip;
+	texture.lastSeenFrame = _frame;
+	_committedBytes += chain_size(texture, texture.tailMip);
+	_views[texture.image.imageView] = handle;
+
+	return handle;
+}
+
+void TextureStreamer::remove_texture(uint32_t handle)
+{
+	StreamedTexture& texture = _textures[handle];
+
+	if (texture.pending) {
+		_engine->_uploader.wait(texture.uploadTicket);
+		_committedBytes -= chain_size(texture, texture.pendingMip);
+		_engine->destroy_image(texture.pendingImage);
+		_pendingCount--;
+	}
+	else {
+		_committedBytes -= chain_size(texture, texture.residentMip);
+	}
+
+	_views.erase(texture.image.imageView);
+	_engine->destroy_image(texture.image);
+
+	texture = StreamedTexture{};
+	_freeTextures.push_back(handle);
+}
+
+void TextureStreamer::update(const uint32_t* materialPixels, uint32_t materialCount, DeletionQueue& deletionQueue, uint64_t retireValue)
+{
+	TRACE_FUNCTION();
+	_frame++;
+
+	// finished uploads first, the images they replace may still be sampled by frames in flight. a finished
+	// transfer isn't enough, the image is only usable once a frame recorded its acquire and final layout
+	for (uint32_t handle = 0; handle < _textures.size(); handle++) {
+		StreamedTexture& texture = _textures[handle];
+		if (texture.live && texture.pending && _engine->_uploader.is_ready_for_graphics(texture.uploadTicket)) {
+			finish_replace(handle, deletionQueue, retireValue);
+		}
+	}
+
+	if (materialPixels != nullptr) {
+		const BindlessMaterialTable& table = _engine->_materialTable;
+		std::span<const GPUMaterialData> materials = table.materials();
+		uint32_t count = std::min(materialCount, (uint32_t)materials.size());
+
+		for (uint32_t m = 0; m < count; m++) {
+			uint32_t pixels = materialPixels[m];
+			if (pixels == 0) {
+				continue;
+			}
+
+			const GPUMaterialData& material = materials[m];
+			for (uint32_t slot : { material.colorTexture, material.metalRoughTexture, material.normalTexture }) {
+				if (slot == BINDLESS_NO_TEXTURE) {
+					continue;
+				}
+				auto found = _views.find(table.texture_view(slot));
+				if (found == _views.end()) {
+					continue;
+				}
+
+				StreamedTexture& texture = _textures[found->second];
+				if (texture.lastSeenFrame != _frame) {
+					texture.lastSeenFrame = _frame;
+					texture.requiredPixels = 0;
+				}
+				texture.requiredPixels = std::max(texture.requiredPixels, pixels);
+			}
+		}
+	}
+
+	// the finest level that still has a texel per pixel across the object. uv density is unknown here,
+	// so the texture is assumed to be stretched once over the object's bounding sphere
+	std::vector<uint32_t> streamIn;
+	std::vector<uint32_t> evictable;
+	for (uint32_t handle = 0; handle < _textures.size(); handle++) {
+		StreamedTexture& texture = _textures[handle];
+		if (!texture.live) {
+			continue;
+		}
+
+		if (texture.lastSeenFrame == _frame) {
+			uint32_t size = std::max(texture.extent.width, texture.extent.height);
+			uint32_t mip = 0;
+			while (mip < texture.tailMip && (size >> (mip + 1)) >= texture.requiredPixels) {
+				mip++;
+			}
+			texture.wantedMip = mip;
+		}
+		else if (_frame - texture.lastSeenFrame > STREAM_IDLE_FRAMES) {
+			texture.wantedMip = texture.tailMip;
+		}
+
+		if (texture.pending) {
+			continue;
+		}
+		if (texture.wantedMip < texture.residentMip) {
+			streamIn.push_back(handle);
+		}
+		if (texture.residentMip < texture.tailMip) {
+			evictable.push_back(handle);
+		}
+	}
+
+	// over budget: first drop the levels nothing asks for anymore, then single levels of everything,
+	// in both passes the textures unseen the longest go first
+	if (_committedBytes > _budget) {
+		std::sort(evictable.begin(), evictable.end(), [&](uint32_t A, uint32_t B) {
+			return _textures[A].lastSeenFrame < _textures[B].lastSeenFrame;
+		});
+
+		for (uint32_t handle : evictable) {
+			if (_committedBytes <= _budget) {
+				break;
+			}
+			StreamedTexture& texture = _textures[handle];
+			if (texture.wantedMip > texture.residentMip) {
+				begin_replace(texture, texture.wantedMip);
+			}
+		}
+		for (uint32_t handle : evictable) {
+			if (_committedBytes <= _budget) {
+				break;
+			}
+			StreamedTexture& texture = _textures[handle];
+			if (!texture.pending) {
+				begin_replace(texture, texture.residentMip + 1);
+			}
+		}
+	}
+
+	// the textures furthest from what they want first, each gets the finest levels that still fit the budget
+	std::sort(streamIn.begin(), streamIn.end(), [&](uint32_t A, uint32_t B) {
+		return _textures[A].residentMip - _textures[A].wantedMip > _textures[B].residentMip - _textures[B].wantedMip;
+	});
+
+	VkDeviceSize queuedBytes = 0;
+	for (uint32_t handle : streamIn) {
+		StreamedTexture& texture = _textures[handle];
+		if (texture.pending) {
+			continue;
+		}
+
+		VkDeviceSize residentSize = chain_size(texture, texture.residentMip);
+		uint32_t mip = texture.wantedMip;
+		while (mip < texture.residentMip && _committedBytes + chain_size(texture, mip) - residentSize > _budget) {
+			mip++;
+		}
+		if (mip == texture.residentMip) {
+			continue;
+		}
+
+		VkDeviceSize size = chain_size(texture, mip);
+		if (queuedBytes > 0 && queuedBytes + size > STREAM_UPLOAD_BYTES_PER_FRAME) {
+			break;
+		}
+		begin_replace(texture, mip);
+		queuedBytes += size;
+	}
+}
+
+VkDeviceSize TextureStreamer::level_offset(const StreamedTexture& texture, uint32_t mip) const
+{
+	VkDeviceSize offset = 0;
+	for (uint32_t level = 0; level < mip; level++) {
+		offset += vkutil::image_level_size(texture.format, texture.extent, level);
+	}
+	return offset;
+}
+
+VkDeviceSize TextureStreamer::chain_size(const StreamedTexture& texture, uint32_t mip) const
+{
+	VkDeviceSize size = 0;
+	for (uint32_t level = mip; level < texture.mipLevels; level++) {
+		size += vkutil::image_level_size(texture.format, texture.extent, level);
+	}
+	return size;
+}
+
+// the whole chain from mip down is uploaded again, the coarser levels are small next to the one added
+AllocatedImage TextureStreamer::upload_levels(StreamedTexture& texture, uint32_t mip, uint64_t& ticket)
+{
+	VkExtent3D extent{ std::max(texture.extent.width >> mip, 1u), std::max(texture.extent.height >> mip, 1u), 1 };
+	uint32_t levels = texture.mipLevels - mip;
+
+	AllocatedImage image = _engine->create_image_levels(extent, texture.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, levels);
+	ticket = _engine->_uploader.upload_image_levels(image, texture.texels + level_offset(texture, mip), chain_size(texture, mip), levels);
+	return image;
+}
+
+void TextureStreamer::begin_replace(StreamedTexture& texture, uint32_t mip)
+{
+	texture.pendingImage = upload_levels(texture, mip, texture.uploadTicket);
+	texture.pendingMip = mip;
+	texture.pending = true;
+	_pendingCount++;
+
+	// the old image is counted as gone already, both exist until the replacement lands
+	_committedBytes += chain_size(texture, mip);
+	_committedBytes -= chain_size(texture, texture.residentMip);
+}
+
+void TextureStreamer::finish_replace(uint32_t handle, DeletionQueue& deletionQueue, uint64_t retireValue)
+{
+	StreamedTexture& texture = _textures[handle];
+
+	std::vector<uint32_t> oldSlots = _engine->_materialTable.retarget_view(texture.image.imageView, texture.pendingImage.imageView);
+	_views.erase(texture.image.imageView);
+	_views[texture.pendingImage.imageView] = handle;
+
+	for (uint32_t slot : oldSlots) {
+		deletionQueue.push_texture_slot(&_engine->_materialTable, slot, retireValue);
+	}
+	deletionQueue.push_image(texture.image, retireValue);
+
+	texture.image = texture.pendingImage;
+	texture.residentMip = texture.pendingMip;
+	texture.pendingImage = AllocatedImage{};
+	texture.pending = false;
+	_pendingCount--;
+}
@@ -0,0 +1,105 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cassert>
+
+uint32_t TransformHierarchy::add(uint32_t parent, const glm::mat4& localTransform)
+{
+	uint32_t index = size();
+	assert(parent == NO_PARENT || parent < index);
+
+	parents.push_back(parent);
+	localTransforms.push_back(localTransform);
+	worldTransforms.push_back(localTransform);
+	dirty.push_back(1);
+	anyDirty = true;
+
+	return index;
+}
+
+void TransformHierarchy::clear()
+{
+	parents.clear();
+	localTransforms.clear();
+	worldTransforms.clear();
+	dirty.clear();
+	anyDirty = false;
+}
+
+void TransformHierarchy::set_local(uint32_t index, const glm::mat4& localTransform)
+{
+	localTransforms[index] = localTransform;
+	dirty[index] = 1;
+	anyDirty = true;
+}
+
+void TransformHierarchy::set_world(uint32_t index, const glm::mat4& worldTransform)
+{
+	worldTransforms[index] = worldTransform;
+}
+
+uint32_t TransformHierarchy::update()
+{
+	if (!anyDirty) {
+		return 0;
+	}
+
+	uint32_t updated = 0;
+	uint32_t count = size();
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t parent = parents[i];
+		// parents come first, so their flag is final by the time a child reads it
+		if (parent != NO_PARENT && dirty[parent]) {
+			dirty[i] = 1;
+		}
+		if (dirty[i]) {
+			worldTransforms[i] = parent == NO_PARENT ? localTransforms[i] : worldTransforms[parent] * localTransforms[i];
+			updated++;
+		}
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+	anyDirty = false;
+
+	return updated;
+}
+
+std::vector<uint32_t> TransformHierarchy::topological_order(std::span<const int32_t> parentIndices)
+{
+	uint32_t count = (uint32_t)parentIndices.size();
+
+	// children grouped by parent, counting sort style so nothing is allocated per node
+	std::vector<uint32_t> childStart(count + 1, 0);
+	for (int32_t parent : parentIndices) {
+		if (parent >= 0) {
+			childStart[parent + 1]++;
+		}
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		childStart[i + 1] += childStart[i];
+	}
+	std::vector<uint32_t> children(childStart[count]);
+	std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+	for (uint32_t i = 0; i < count; i++) {
+		if (parentIndices[i] >= 0) {
+			children[fill[parentIndices[i]]++] = i;
+		}
+	}
+
+	// breadth first from the roots, the order itself doubles as the queue
+	std::vector<uint32_t> order;
+	order.reserve(count);
+	for (uint32_t i = 0; i < count; i++) {
+		if (parentIndices[i] < 0) {
+			order.push_back(i);
+		}
+	}
+	for (size_t head = 0; head < order.size(); head++) {
+		uint32_t node = order[head];
+		for (uint32_t c = childStart[node]; c < childStart[node + 1]; c++) {
+			order.push_back(children[c]);
+		}
+	}
+
+	return order;
+}
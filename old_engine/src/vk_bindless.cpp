@@ -0,0 +1,199 @@
+#include "vk_bindless.h"
+#include "vk_descriptors.h"
+
+void BindlessMaterialTable::init(VkDevice device, VmaAllocator allocator, VkShaderStageFlags stages)
+{
+	_device = device;
+	_allocator = allocator;
+
+	DescriptorLayoutBuilder layoutBuilder;
+	layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	// partially bound since most of the array stays empty, unused slots can change while frames are in flight
+	layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, BINDLESS_TEXTURE_CAPACITY,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT);
+	_layout = layoutBuilder.build(device, stages);
+
+	VkDescriptorPoolSize poolSizes[] = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, BINDLESS_TEXTURE_CAPACITY },
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	VK_CHECK(vkCreateDescriptorPool(device, &poolInfo, nullptr, &_pool));
+
+	VkDescriptorSetAllocateInfo allocInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = _pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &_layout;
+	VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &_set));
+
+	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = sizeof(GPUMaterialData) * BINDLESS_MATERIAL_CAPACITY;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	VmaAllocationCreateInfo vmaAllocInfo = {};
+	vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &_materialBuffer.buffer, &_materialBuffer.allocation, &_materialBuffer.info));
+
+	DescriptorWriter writer;
+	writer.write_buffer(0, _materialBuffer.buffer, bufferInfo.size, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	writer.update_set(device, _set);
+}
+
+void BindlessMaterialTable::destroy()
+{
+	vmaDestroyBuffer(_allocator, _materialBuffer.buffer, _materialBuffer.allocation);
+	vkDestroyDescriptorPool(_device, _pool, nullptr);
+	vkDestroyDescriptorSetLayout(_device, _layout, nullptr);
+
+	_materials.clear();
+	_freeMaterials.clear();
+	_textures.clear();
+	_freeTextures.clear();
+	_textureLookup.clear();
+}
+
+uint32_t BindlessMaterialTable::acquire_texture(VkImageView view, VkSampler sampler)
+{
+	auto found = _textureLookup.find({ view, sampler });
+	if (found != _textureLookup.end()) {
+		_textures[found->second].references++;
+		return found->second;
+	}
+
+	uint32_t slot;
+	if (!_freeTextures.empty()) {
+		slot = _freeTextures.back();
+		_freeTextures.pop_back();
+	}
+	else if (_textures.size() < BINDLESS_TEXTURE_CAPACITY) {
+		slot = (uint32_t)_textures.size();
+		_textures.emplace_back();
+	}
+	else {
+		std::cout << "BindlessMaterialTable: out of texture slots, sampling slot 0 instead" << std::endl;
+		_textures[0].references++;
+		return 0;
+	}
+
+	_textures[slot] = TextureSlot{ view, sampler, 1 };
+	_textureLookup[{ view, sampler }] = slot;
+
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.dstSet = _set;
+	write.dstBinding = 1;
+	write.dstArrayElement = slot;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+
+	return slot;
+}
+
+void BindlessMaterialTable::release_texture(uint32_t slot)
+{
+	TextureSlot& texture = _textures[slot];
+	if (--texture.references > 0) {
+		return;
+	}
+
+	// the descriptor is left as is, nothing indexes a free slot until it is written again.
+	// a retargeted slot was already dropped from the lookup
+	auto found = _textureLookup.find({ texture.view, texture.sampler });
+	if (found != _textureLookup.end() && found->second == slot) {
+		_textureLookup.erase(found);
+	}
+	texture.view = VK_NULL_HANDLE;
+	_freeTextures.push_back(slot);
+}
+
+std::vector<uint32_t> BindlessMaterialTable::retarget_view(VkImageView view, VkImageView newView)
+{
+	std::vector<uint32_t> oldSlots;
+	for (uint32_t slot = 0; slot < _textures.size(); slot++) {
+		if (_textures[slot].view == view && _textures[slot].references > 0) {
+			oldSlots.push_back(slot);
+		}
+	}
+
+	for (uint32_t oldSlot : oldSlots) {
+		VkSampler sampler = _textures[oldSlot].sampler;
+		uint32_t references = _textures[oldSlot].references;
+		_textureLookup.erase({ view, sampler });
+
+		uint32_t newSlot = acquire_texture(newView, sampler);
+		_textures[newSlot].references += references - 1;
+		_textures[oldSlot].references = 1;
+
+		for (uint32_t index = 0; index < _materials.size(); index++) {
+			GPUMaterialData& data = _materials[index];
+			bool changed = false;
+			for (uint32_t* texture : { &data.colorTexture, &data.metalRoughTexture, &data.normalTexture }) {
+				if (*texture == oldSlot) {
+					*texture = newSlot;
+					changed = true;
+				}
+			}
+
+			// frames in flight read either slot, both stay valid until the old one is released
+			if (changed) {
+				((GPUMaterialData*)_materialBuffer.info.pMappedData)[index] = data;
+				vmaFlushAllocation(_allocator, _materialBuffer.allocation, index * sizeof(GPUMaterialData), sizeof(GPUMaterialData));
+			}
+		}
+	}
+
+	return oldSlots;
+}
+
+uint32_t BindlessMaterialTable::add_material(const GPUMaterialData& data)
+{
+	uint32_t index;
+	if (!_freeMaterials.empty()) {
+		index = _freeMaterials.back();
+		_freeMaterials.pop_back();
+	}
+	else if (_materials.size() < BINDLESS_MATERIAL_CAPACITY) {
+		index = (uint32_t)_materials.size();
+		_materials.emplace_back();
+	}
+	else {
+		std::cout << "BindlessMaterialTable: out of material slots, drawing with material 0 instead" << std::endl;
+		release_texture(data.colorTexture);
+		release_texture(data.metalRoughTexture);
+		release_texture(data.normalTexture);
+		return 0;
+	}
+
+	_materials[index] = data;
+	((GPUMaterialData*)_materialBuffer.info.pMappedData)[index] = data;
+	vmaFlushAllocation(_allocator, _materialBuffer.allocation, index * sizeof(GPUMaterialData), sizeof(GPUMaterialData));
+
+	return index;
+}
+
+void BindlessMaterialTable::remove_material(uint32_t index)
+{
+	GPUMaterialData& data = _materials[index];
+	release_texture(data.colorTexture);
+	release_texture(data.metalRoughTexture);
+	release_texture(data.normalTexture);
+
+	data.colorTexture = BINDLESS_NO_TEXTURE;
+	data.metalRoughTexture = BINDLESS_NO_TEXTURE;
+	data.normalTexture = BINDLESS_NO_TEXTURE;
+	_freeMaterials.push_back(index);
+}
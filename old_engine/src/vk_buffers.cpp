@@ -0,0 +1,107 @@
+#include <vk_buffers.h>
+
+#include <algorithm>
+#include <iostream>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void LinearBufferAllocator::init(VmaAllocator allocator, VkDeviceSize size, VkDeviceSize alignment, VkBufferUsageFlags usage)
+{
+	this->alignment = std::max<VkDeviceSize>(alignment, 1);
+	usageFlags = usage;
+	capacity = align_up(size, this->alignment);
+	buffer = create_chunk(allocator, capacity);
+	head = 0;
+	overflowHead = 0;
+	highWater = 0;
+}
+
+void LinearBufferAllocator::reset(VmaAllocator allocator)
+{
+	if (!overflowChunks.empty()) {
+		for (auto& chunk : overflowChunks) {
+			vmaDestroyBuffer(allocator, chunk.buffer, chunk.allocation);
+		}
+		overflowChunks.clear();
+
+		// grow once so the next frames fit in a single buffer again
+		VkDeviceSize newCapacity = capacity;
+		while (newCapacity < highWater) {
+			newCapacity *= 2;
+		}
+		std::cout << "LinearBufferAllocator: growing from " << capacity << " to " << newCapacity << " bytes" << std::endl;
+
+		vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+		capacity = newCapacity;
+		buffer = create_chunk(allocator, capacity);
+	}
+
+	head = 0;
+	overflowHead = 0;
+	highWater = 0;
+}
+
+void LinearBufferAllocator::destroy(VmaAllocator allocator)
+{
+	for (auto& chunk : overflowChunks) {
+		vmaDestroyBuffer(allocator, chunk.buffer, chunk.allocation);
+	}
+	overflowChunks.clear();
+
+	vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+	buffer = {};
+	capacity = 0;
+	head = 0;
+}
+
+LinearBufferAllocator::Allocation LinearBufferAllocator::allocate(VmaAllocator allocator, VkDeviceSize size)
+{
+	VkDeviceSize offset = align_up(head, alignment);
+	highWater = align_up(highWater, alignment) + size;
+
+	if (overflowChunks.empty() && offset + size <= capacity) {
+		head = offset + size;
+		return Allocation{
+			.buffer = buffer.buffer,
+			.offset = offset,
+			.size = size,
+			.data = (char*)buffer.info.pMappedData + offset
+		};
+	}
+
+	// out of space this frame, spill into a temporary chunk until the next reset
+	offset = align_up(overflowHead, alignment);
+	if (overflowChunks.empty() || offset + size > overflowChunks.back().info.size) {
+		overflowChunks.push_back(create_chunk(allocator, std::max(capacity, align_up(size, alignment))));
+		offset = 0;
+	}
+	overflowHead = offset + size;
+
+	AllocatedBuffer& chunk = overflowChunks.back();
+	return Allocation{
+		.buffer = chunk.buffer,
+		.offset = offset,
+		.size = size,
+		.data = (char*)chunk.info.pMappedData + offset
+	};
+}
+
+AllocatedBuffer LinearBufferAllocator::create_chunk(VmaAllocator allocator, VkDeviceSize size)
+{
+	VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = usageFlags;
+
+	VmaAllocationCreateInfo vmaAllocInfo = {};
+	vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	AllocatedBuffer newBuffer;
+	VK_CHECK(vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+
+	return newBuffer;
+}
@@ -0,0 +1,101 @@
+#include "vk_deletion.h"
+#include "vk_bindless.h"
+
+#include <algorithm>
+
+// destroys and drops the retired entries in place, the vectors keep their capacity
+template<typename T, typename Destroy>
+static void retire(std::vector<T>& entries, uint64_t completedValue, Destroy&& destroy)
+{
+	std::erase_if(entries, [&](const T& entry) {
+		if (entry.retireValue > completedValue) {
+			return false;
+		}
+		destroy(entry.handle);
+		return true;
+	});
+}
+
+void DeletionQueue::init(VkDevice device, VmaAllocator allocator)
+{
+	_device = device;
+	_allocator = allocator;
+}
+
+void DeletionQueue::push_buffer(const AllocatedBuffer& buffer, uint64_t retireValue)
+{
+	_buffers.push_back({ buffer, retireValue });
+}
+
+void DeletionQueue::push_image(const AllocatedImage& image, uint64_t retireValue)
+{
+	_images.push_back({ image, retireValue });
+}
+
+void DeletionQueue::push_accel_struct(const AllocatedAS& accel, uint64_t retireValue)
+{
+	_accelStructs.push_back({ accel, retireValue });
+}
+
+void DeletionQueue::push_sampler(VkSampler sampler, uint64_t retireValue)
+{
+	_samplers.push_back({ sampler, retireValue });
+}
+
+void DeletionQueue::push_descriptor_pool(VkDescriptorPool pool, uint64_t retireValue)
+{
+	_descriptorPools.push_back({ pool, retireValue });
+}
+
+void DeletionQueue::push_command_pool(VkCommandPool pool, uint64_t retireValue)
+{
+	_commandPools.push_back({ pool, retireValue });
+}
+
+void DeletionQueue::push_texture_slot(BindlessMaterialTable* table, uint32_t slot, uint64_t retireValue)
+{
+	_textureSlots.push_back({ { table, slot }, retireValue });
+}
+
+void DeletionQueue::push_function(std::function<void()>&& function)
+{
+	_functions.push_back(std::move(function));
+}
+
+void DeletionQueue::flush(uint64_t completedValue)
+{
+	// slots first, a slot may still name a view destroyed below
+	retire(_textureSlots, completedValue, [&](const std::pair<BindlessMaterialTable*, uint32_t>& slot) {
+		slot.first->release_texture(slot.second);
+	});
+	retire(_images, completedValue, [&](const AllocatedImage& image) {
+		vkDestroyImageView(_device, image.imageView, nullptr);
+		vmaDestroyImage(_allocator, image.image, image.allocation);
+	});
+	retire(_accelStructs, completedValue, [&](const AllocatedAS& accel) {
+		vkDestroyAccelerationStructureKHR(_device, accel.accel, nullptr);
+		vmaDestroyBuffer(_allocator, accel.buffer.buffer, accel.buffer.allocation);
+	});
+	retire(_buffers, completedValue, [&](const AllocatedBuffer& buffer) {
+		vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+	});
+	retire(_samplers, completedValue, [&](VkSampler sampler) {
+		vkDestroySampler(_device, sampler, nullptr);
+	});
+	retire(_descriptorPools, completedValue, [&](VkDescriptorPool pool) {
+		vkDestroyDescriptorPool(_device, pool, nullptr);
+	});
+	retire(_commandPools, completedValue, [&](VkCommandPool pool) {
+		vkDestroyCommandPool(_device, pool, nullptr);
+	});
+}
+
+void DeletionQueue::flush_all()
+{
+	flush(UINT64_MAX);
+
+	for (auto& function : _functions) {
+		function();
+	}
+	_functions.clear();
+}
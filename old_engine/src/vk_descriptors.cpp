@@ -2,18 +2,25 @@
 #include "vk_initializers.h"
 
 void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type)
+{
+	add_binding(binding, type, 1, 0);
+}
+
+void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type, uint32_t count, VkDescriptorBindingFlags flags)
 {
 	VkDescriptorSetLayoutBinding newBind{};
 	newBind.binding = binding;
-	newBind.descriptorCount = 1;
+	newBind.descriptorCount = count;
 	newBind.descriptorType = type;
 
 	bindings.push_back(newBind);
+	bindingFlags.push_back(flags);
 }
 
 void DescriptorLayoutBuilder::clear()
 {
 	bindings.clear();
+	bindingFlags.clear();
 }
 
 VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderStageFlags shaderStages)
@@ -30,6 +37,21 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderSt
 	info.bindingCount = (uint32_t)bindings.size();
 	info.flags = 0;
 
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+	flagsInfo.bindingCount = (uint32_t)bindingFlags.size();
+	flagsInfo.pBindingFlags = bindingFlags.data();
+
+	bool anyFlags = false;
+	for (VkDescriptorBindingFlags flags : bindingFlags) {
+		anyFlags |= flags != 0;
+		if (flags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT) {
+			info.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		}
+	}
+	if (anyFlags) {
+		info.pNext = &flagsInfo;
+	}
+
 	VkDescriptorSetLayout set;
 	VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set));
 
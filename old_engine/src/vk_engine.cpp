@@ -6,6 +6,7 @@
 #include "vk_pipelines.h"
 #include "vk_loader.h"
 #include "vk_descriptors.h"
+#include "cpu_trace.h"
 #include <glm/gtx/transform.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -25,6 +26,7 @@
 #include <chrono>
 #include <thread>
 #include <array>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -54,12 +56,22 @@ static void check_vk_result(VkResult err)
         abort();
 }
 
+static FramePacingSettings clamp_pacing(FramePacingSettings pacing)
+{
+    pacing.framesInFlight = std::clamp(pacing.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+    pacing.swapchainImageCount = std::max(pacing.swapchainImageCount, 2u);
+    pacing.frameRateLimit = std::max(pacing.frameRateLimit, 0.0f);
+    pacing.latencyTargetMs = std::max(pacing.latencyTargetMs, 0.0f);
+    return pacing;
+}
+
 void VulkanEngine::init()
 {
     volkInitialize();
     // only one engine initialization is allowed with the application.
     assert(loadedEngine == nullptr);
     loadedEngine = this;
+    cputrace::set_thread_name("main");
 
     // We initialize SDL and create a window with it.
     SDL_Init(SDL_INIT_VIDEO);
@@ -82,19 +94,25 @@ void VulkanEngine::init()
     SDL_SetRelativeMouseMode(SDL_TRUE);
 
     init_vulkan();
+    // nothing is in flight yet, the swapchain and frame slots start out with these
+    _pacing = clamp_pacing(_pacing);
+    _appliedPacing = _pacing;
     init_swapchain();
     init_commands();
     init_async_compute_commands();
     init_sync_structures();
     init_async_compute_sync_structures();
+    init_upload_service();
+    init_geometry_arenas();
     init_descriptors();
     init_pipelines();
     init_default_data();
     init_renderables();
+    init_ray_tracing();
 #ifndef AVI_DISABLE_INTERCHANGE
+    // after the ray tracing instances exist, the slots resolve straight to them
     init_interprocess();
 #endif // AVI_DISABLE_INTERCHANGE
-    init_ray_tracing();
     init_imgui();
 
 
@@ -125,23 +143,27 @@ void VulkanEngine::cleanup()
     if (_isInitialized) {
         vkDeviceWaitIdle(_device);
 
+        // the deletion queue tears the pipeline cache and the material down in push order, a link still
+        // queued would publish into a material that is already destroyed, so the compiler stops first
+        _pipelineCompiler.destroy();
+
+        if (cputrace::enabled()) {
+            cputrace::dump_chrome_trace(_cpuTracePath);
+        }
+
         cleanup_ray_tracing();
 
         for (auto& scene : _loadedScenes) {
             scene.second->clearAll();
         }
         for (auto& meshBuffers : meshesToDelete) {
-            destroy_buffer(meshBuffers.vertexBuffer);
-            destroy_buffer(meshBuffers.indexBuffer);
+            free_mesh_buffers(meshBuffers);
         }
         _interprocess->destroy(); 
         _loadedScenes.clear();
         
-        for (auto& frame : _frames) {
-            frame._deletionQueue.flush();
-        }
-
-        _mainDeletionQueue.flush();
+        _frameDeletionQueue.flush_all();
+        _mainDeletionQueue.flush_all();
 
         destroy_swapchain();
 
@@ -162,25 +184,38 @@ void VulkanEngine::cleanup()
 
 void VulkanEngine::draw()
 {
+    TRACE_FUNCTION();
 
-    VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
+    // the slot was last used framesInFlight frames back, once that frame is done everything before it is too
+    {
+        TRACE_ZONE("wait for frame slot");
+        wait_for_frame((int64_t)_frameNumber - _appliedPacing.framesInFlight);
+    }
 
-    get_current_frame()._deletionQueue.flush();
+    uint64_t completedValue;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _frameTimeline, &completedValue));
+    _frameDeletionQueue.flush(completedValue);
     get_current_frame()._frameDescriptors.clear_pools(_device);
+    get_current_frame()._frameBuffer.reset(_allocator);
 
     uint32_t swapchainImageIndex;
 
     VkResult e = vkAcquireNextImageKHR(_device, _swapchain, 1000000000, get_current_frame()._swapchainSemaphore, nullptr, &swapchainImageIndex);
-    if (e == VK_ERROR_OUT_OF_DATE_KHR || e == VK_SUBOPTIMAL_KHR) {
+    if (e == VK_ERROR_OUT_OF_DATE_KHR) {
         _resize_requested = true;
         return;
     }
+    // a suboptimal image was still acquired and its semaphore will be signalled, so the frame goes ahead
+    if (e == VK_SUBOPTIMAL_KHR) {
+        _resize_requested = true;
+    }
+
+    // reads back the timings this slot recorded last time, that frame is complete after the wait above
+    _gpuProfiler.begin_frame(_frameNumber % _appliedPacing.framesInFlight, _frameNumber);
 
     _drawExtent.width = std::min(_windowExtent.width, _drawImage.imageExtent.width) * _renderScale;
     _drawExtent.height = std::min(_windowExtent.height, _drawImage.imageExtent.height) * _renderScale;
 
-    VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
- 
     VK_CHECK(vkResetCommandBuffer(get_current_frame()._mainCommandBuffer, 0));
 
     VkCommandBuffer cmd = get_current_frame()._mainCommandBuffer;
@@ -188,6 +223,25 @@ void VulkanEngine::draw()
     VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
  
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+    uint32_t frameScope = _gpuProfiler.begin_scope(cmd, "frame");
+
+    // the sizes this slot's last cull pass copied back decide which mips stream in or out, the uploads
+    // go out with the flush below and replaced images wait in the frame deletion queue
+    {
+        IndirectDrawBuffers& indirect = get_current_frame()._indirect;
+        const uint32_t* materialPixels = nullptr;
+        if (indirect.objectCount > 0) {
+            vmaInvalidateAllocation(_allocator, indirect.mipFeedbackReadback.allocation, 0, VK_WHOLE_SIZE);
+            materialPixels = (const uint32_t*)indirect.mipFeedbackReadback.info.pMappedData;
+        }
+        _textureStreamer.update(materialPixels, BINDLESS_MATERIAL_CAPACITY, _frameDeletionQueue, frame_signal_value());
+    }
+
+    // anything queued since the last frame goes out now, whatever already landed gets finished on this queue
+    _uploader.flush();
+    uint32_t uploadScope = _gpuProfiler.begin_scope(cmd, "uploads");
+    uint64_t uploadWaitValue = _uploader.record_graphics_work(cmd);
+    _gpuProfiler.end_scope(cmd, uploadScope);
     {
         VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
         imageBarrier.pNext = nullptr;
@@ -255,7 +309,9 @@ void VulkanEngine::draw()
         imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
         vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], imageBarrier);
     }
+    uint32_t blitScope = _gpuProfiler.begin_scope(cmd, "blit");
     vkutil::copy_image_to_image(cmd, _postProcessingImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
+    _gpuProfiler.end_scope(cmd, blitScope);
     {
         VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
         imageBarrier.pNext = nullptr;
@@ -267,7 +323,9 @@ void VulkanEngine::draw()
         imageBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], imageBarrier);
     }
+    uint32_t imguiScope = _gpuProfiler.begin_scope(cmd, "imgui");
     draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]);
+    _gpuProfiler.end_scope(cmd, imguiScope);
     {
         VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
         imageBarrier.pNext = nullptr;
@@ -285,33 +343,110 @@ void VulkanEngine::draw()
         ImGui::RenderPlatformWindowsDefault();
 
     }
+    _gpuProfiler.end_scope(cmd, frameScope);
     VK_CHECK(vkEndCommandBuffer(cmd));
 
     VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(cmd);
 
-    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
-    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame()._renderSemaphore);
+    VkSemaphoreSubmitInfo waitInfos[2];
+    waitInfos[0] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
+    waitInfos[1] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _uploader.timeline_semaphore());
+    waitInfos[1].value = uploadWaitValue;
+    VkSemaphoreSubmitInfo signalInfos[2];
+    signalInfos[0] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, _presentSemaphores[swapchainImageIndex]);
+    signalInfos[1] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _frameTimeline);
+    signalInfos[1].value = frame_signal_value();
 
-    VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, &signalInfo, &waitInfo);
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, signalInfos, waitInfos);
+    submit.waitSemaphoreInfoCount = uploadWaitValue ? 2 : 1;
+    submit.signalSemaphoreInfoCount = 2;
 
-    VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, get_current_frame()._renderFence));
+    TRACE_ZONE("submit and present");
+    std::unique_lock<std::mutex> queueLock(_graphicsQueueMutex);
+    VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, VK_NULL_HANDLE));
 
     VkPresentInfoKHR presentInfo = vkinit::present_info();
     presentInfo.pSwapchains = &_swapchain;
     presentInfo.swapchainCount = 1;
 
-    presentInfo.pWaitSemaphores = &get_current_frame()._renderSemaphore;
+    presentInfo.pWaitSemaphores = &_presentSemaphores[swapchainImageIndex];
     presentInfo.waitSemaphoreCount = 1;
 
     presentInfo.pImageIndices = &swapchainImageIndex;
 
     VkResult presentResult = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+    queueLock.unlock();
+
+    // counted even when the present failed, the submit already used up this frame's timeline value
+    _frameNumber++;
+
     if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
         _resize_requested = true;
+    }
+}
+
+void VulkanEngine::wait_for_frame(int64_t frameNumber)
+{
+    if (frameNumber < 0) {
         return;
     }
 
-    _frameNumber++;
+    uint64_t value = (uint64_t)frameNumber + 1;
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_frameTimeline;
+    waitInfo.pValues = &value;
+    VK_CHECK(vkWaitSemaphores(_device, &waitInfo, 1000000000));
+}
+
+void VulkanEngine::pace_frame()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (_pacing.frameRateLimit > 0.0f) {
+        auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(1.0f / _pacing.frameRateLimit));
+        if (now < _nextFrameDeadline) {
+            TRACE_ZONE("frame limiter");
+            std::this_thread::sleep_until(_nextFrameDeadline);
+            now = std::chrono::steady_clock::now();
+        }
+        // keeps the cadence when sleeps overshoot a little, a frame that ran over a whole period resets it
+        _nextFrameDeadline = std::max(_nextFrameDeadline + period, now);
+    }
+
+    if (_lastFrameStart != std::chrono::steady_clock::time_point{}) {
+        float interval = std::chrono::duration<float, std::milli>(now - _lastFrameStart).count();
+        _frameIntervalMs = _frameIntervalMs > 0.0f ? _frameIntervalMs * 0.9f + interval * 0.1f : interval;
+    }
+    _lastFrameStart = now;
+
+    if (_pacing.latencyTargetMs > 0.0f) {
+        // once the gpu is the bottleneck every queued frame adds about one loop interval before the new
+        // frame's input reaches the screen, so the target buys that many frames including the new one
+        int64_t queuedFrames = _appliedPacing.framesInFlight;
+        if (_frameIntervalMs > 0.0f) {
+            queuedFrames = std::clamp<int64_t>((int64_t)(_pacing.latencyTargetMs / _frameIntervalMs), 1, _appliedPacing.framesInFlight);
+        }
+        TRACE_ZONE("latency target wait");
+        wait_for_frame((int64_t)_frameNumber - queuedFrames);
+    }
+}
+
+void VulkanEngine::apply_frame_pacing()
+{
+    _pacing = clamp_pacing(_pacing);
+
+    if (_pacing.framesInFlight != _appliedPacing.framesInFlight) {
+        // frame numbers map onto slots modulo the count, nothing may be in flight while it changes
+        vkDeviceWaitIdle(_device);
+    }
+    if (_pacing.presentMode != _appliedPacing.presentMode || _pacing.swapchainImageCount != _appliedPacing.swapchainImageCount) {
+        _resize_requested = true;
+    }
+
+    _appliedPacing = _pacing;
 }
 
 void VulkanEngine::run()
@@ -321,7 +456,9 @@ void VulkanEngine::run()
 
     // main loop
     while (!bQuit) {
-        auto start = std::chrono::system_clock::now();
+        TRACE_ZONE_TIMED("frame", &_stats.frame_time);
+        pace_frame();
+
         // Handle events on queue
         while (SDL_PollEvent(&e) != 0) {
             // close the window when user alt-f4s or clicks the X button
@@ -341,6 +478,10 @@ void VulkanEngine::run()
             
             _mainCamera.processSDLEvent(e);
             ImGui_ImplSDL2_ProcessEvent(&e);
+
+            if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F11 && e.key.repeat == 0) {
+                cputrace::dump_chrome_trace(_cpuTracePath);
+            }
         }
         
         if (_mainCamera.shouldUnfocus) {
@@ -359,6 +500,7 @@ void VulkanEngine::run()
         // do not draw if we are minimized
         if (_freeze_rendering) continue;
 
+        apply_frame_pacing();
         if (_resize_requested) {
             resize_swapchain();
         }
@@ -370,13 +512,53 @@ void VulkanEngine::run()
         if (ImGui::Begin("Stats"))
         {
             ImGui::Text("frame time: %f ms", _stats.frame_time);
-            ImGui::Text("draw time: %f ms", _stats.mesh_draw_time);
+            ImGui::Text("draw record time (cpu): %f ms", _stats.mesh_draw_time);
             ImGui::Text("update time: %f ms", _stats.scene_update_time);
             ImGui::Text("triangle count: %i", _stats.triangle_count);
             ImGui::Text("draw call count: %i", _stats.draw_call_count);
+            ImGui::Text("culled count: %i", _stats.culled_count);
+            ImGui::Text("pipelines compiling: %u", _pipelineCompiler.pending_count());
+            ImGui::Text("geometry memory: %llu / %llu MB", (unsigned long long)((_vertexArena.used_bytes() + _indexArena.used_bytes()) >> 20),
+                (unsigned long long)((_vertexArena.capacity_bytes() + _indexArena.capacity_bytes()) >> 20));
+            ImGui::Text("texture memory: %llu / %llu MB, %u streaming", (unsigned long long)(_textureStreamer.committed_bytes() >> 20),
+                (unsigned long long)(_textureStreamer.budget() >> 20), _textureStreamer.pending_count());
+            int textureBudget = (int)(_textureStreamer.budget() >> 20);
+            if (ImGui::SliderInt("texture budget (MB)", &textureBudget, 16, 4096)) {
+                _textureStreamer.set_budget((VkDeviceSize)textureBudget << 20);
+            }
+            int framesInFlight = (int)_pacing.framesInFlight;
+            if (ImGui::SliderInt("frames in flight", &framesInFlight, 1, MAX_FRAMES_IN_FLIGHT)) {
+                _pacing.framesInFlight = (uint32_t)framesInFlight;
+            }
+            int swapchainImageCount = (int)_pacing.swapchainImageCount;
+            if (ImGui::SliderInt("swapchain images", &swapchainImageCount, 2, 4)) {
+                _pacing.swapchainImageCount = (uint32_t)swapchainImageCount;
+            }
+            const char* presentModeNames[] = { "fifo", "mailbox", "immediate" };
+            const VkPresentModeKHR presentModes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+            int presentMode = (int)(std::find(std::begin(presentModes), std::end(presentModes), _pacing.presentMode) - std::begin(presentModes));
+            if (ImGui::Combo("present mode", &presentMode, presentModeNames, IM_ARRAYSIZE(presentModeNames))) {
+                _pacing.presentMode = presentModes[presentMode];
+            }
+            ImGui::SliderFloat("frame rate limit", &_pacing.frameRateLimit, 0.0f, 240.0f);
+            ImGui::SliderFloat("latency target (ms)", &_pacing.latencyTargetMs, 0.0f, 100.0f);
+            ImGui::Checkbox("gpu culling", &_gpuCulling);
+            ImGui::Checkbox("cluster culling", &_clusterCulling);
+            ImGui::SliderFloat("lod error (px)", &_lodErrorThreshold, 0.0f, 8.0f);
             ImGui::Text("camera positon.x: %f", _stats.camera_location.x);
             ImGui::Text("camera positon.y: %f", _stats.camera_location.y);
             ImGui::Text("camera positon.z: %f", _stats.camera_location.z);
+            bool cpuTracing = cputrace::enabled();
+            if (ImGui::Checkbox("cpu tracing", &cpuTracing)) {
+                cputrace::set_enabled(cpuTracing);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("dump cpu trace (F11)")) {
+                cputrace::dump_chrome_trace(_cpuTracePath);
+            }
+            if (_gpuProfiler.enabled() && ImGui::CollapsingHeader("gpu timings", ImGuiTreeNodeFlags_DefaultOpen)) {
+                draw_gpu_timings();
+            }
 
             ImGui::End();
         }
@@ -407,10 +589,6 @@ void VulkanEngine::run()
         update_scene();
 
         draw();
-
-        auto end = std::chrono::system_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        _stats.frame_time = elapsed.count() / 1000.0f;
     }
 }
 void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function) {
@@ -426,7 +604,10 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& f
 
     VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(cmd);
     VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, nullptr, nullptr);
-    VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, _immFence));
+    {
+        std::lock_guard<std::mutex> queueLock(_graphicsQueueMutex);
+        VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, _immFence));
+    }
     VK_CHECK(vkWaitForFences(_device, 1, &_immFence, true, 9999999999));
 }
 void VulkanEngine::async_compute_submit(std::function<void(VkCommandBuffer cmd)> &&function) {
@@ -445,67 +626,80 @@ void VulkanEngine::async_compute_submit(std::function<void(VkCommandBuffer cmd)>
     VK_CHECK(vkQueueSubmit2(_asyncComputeQueue, 1, &submit, _asyncComputeFence));
     VK_CHECK(vkWaitForFences(_device, 1, &_asyncComputeFence, true, 9999999999));
 }
-GPUMeshBuffers VulkanEngine::uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices) {
-    const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
-    const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
-
-    GPUMeshBuffers newSurface;
-
-    newSurface.vertexBuffer = create_buffer(
-        vertexBufferSize,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT 
-        | VK_BUFFER_USAGE_TRANSFER_DST_BIT 
-        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-        | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VMA_MEMORY_USAGE_GPU_ONLY
-    );
-    VkBufferDeviceAddressInfo deviceVertexAddressInfo{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        .buffer = newSurface.vertexBuffer.buffer
-    };
-    newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device, &deviceVertexAddressInfo);
-
-    newSurface.indexBuffer = create_buffer(
-        indexBufferSize,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-        | VK_BUFFER_USAGE_TRANSFER_DST_BIT
-        | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VMA_MEMORY_USAGE_GPU_ONLY
-    );
+GPUMeshBuffers VulkanEngine::uploadMesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices, std::span<const Meshlet> meshlets) {
+    if (!_compactVertices) {
+        return upload_mesh_buffers(indices, vertices.data(), vertices.size() * sizeof(Vertex), VERTEX_FORMAT_FULL, meshlets);
+    }
 
-    AllocatedBuffer staging = create_buffer(
-        vertexBufferSize + indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_CPU_ONLY
-    );
+    std::vector<PackedVertex> packed(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vertex& v = vertices[i];
+        packed[i] = vertexformat::pack(v.position, v.normal, glm::vec2(v.uv_x, v.uv_y), v.color);
+    }
+    return uploadMesh(indices, packed, meshlets);
+}
 
-    void* data = staging.allocation->GetMappedData();
+GPUMeshBuffers VulkanEngine::uploadMesh(std::span<const uint32_t> indices, std::span<const PackedVertex> vertices, std::span<const Meshlet> meshlets) {
+    return upload_mesh_buffers(indices, vertices.data(), vertices.size() * sizeof(PackedVertex), VERTEX_FORMAT_PACKED, meshlets);
+}
 
-    memcpy(data, vertices.data(), vertexBufferSize);
-    memcpy((char*)data + vertexBufferSize, indices.data(), indexBufferSize);
+GPUMeshBuffers VulkanEngine::upload_mesh_buffers(std::span<const uint32_t> indices, const void* vertexData, size_t vertexBufferSize, uint32_t vertexFormat, std::span<const Meshlet> meshlets) {
+    TRACE_FUNCTION();
+    // indices are mesh relative, so any mesh below 64k vertices fits in 16 bits. 0xffff is left out
+    // since it doubles as the primitive restart value
+    uint32_t maxIndex = 0;
+    for (uint32_t index : indices) {
+        maxIndex = std::max(maxIndex, index);
+    }
+    bool shortIndices = maxIndex < UINT16_MAX;
 
-    immediate_submit([&](VkCommandBuffer cmd) { // usually put on a background thread that solely executes uploads, deleting/reusing the stageing buffers
-        VkBufferCopy vertexCopy{ 0 };
-        vertexCopy.dstOffset = 0;
-        vertexCopy.srcOffset = 0;
-        vertexCopy.size = vertexBufferSize;
+    std::vector<uint16_t> narrowed;
+    if (shortIndices) {
+        narrowed.assign(indices.begin(), indices.end());
+    }
 
-        vkCmdCopyBuffer(cmd, staging.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
+    const void* indexData = shortIndices ? (const void*)narrowed.data() : (const void*)indices.data();
+    const size_t indexBufferSize = indices.size() * (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t));
 
-        VkBufferCopy indexCopy{ 0 };
-        indexCopy.dstOffset = 0;
-        indexCopy.srcOffset = vertexBufferSize;
-        indexCopy.size = indexBufferSize;
+    GPUMeshBuffers newSurface;
+    newSurface.indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    newSurface.vertexFormat = vertexFormat;
+
+    newSurface.vertices = _vertexArena.allocate(vertexBufferSize, 16);
+    newSurface.vertexBufferAddress = _vertexArena.address(newSurface.vertices);
+
+    // both index types share the arena, a range aligned to its index size can be addressed by firstIndex
+    size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+    newSurface.indices = _indexArena.allocate(indexBufferSize, 4);
+    newSurface.firstIndex = (uint32_t)(newSurface.indices.offset / indexSize);
+
+    // copied into the staging ring right away, the transfer itself runs on the upload thread.
+    // the ticket tells callers when the ranges are safe to read on the gpu
+    if (!meshlets.empty()) {
+        // the cull pass emits meshlet draws straight into the shared index buffer
+        std::vector<Meshlet> placed(meshlets.begin(), meshlets.end());
+        for (Meshlet& meshlet : placed) {
+            meshlet.firstIndex += newSurface.firstIndex;
+        }
 
-        vkCmdCopyBuffer(cmd, staging.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
-    }); // otherwise the cpu is waiting until the gpu is done 
+        newSurface.meshlets = _vertexArena.allocate(meshlets.size_bytes(), 16);
+        newSurface.meshletBufferAddress = _vertexArena.address(newSurface.meshlets);
+        _uploader.upload_buffer(_vertexArena.buffer(newSurface.meshlets.block), newSurface.meshlets.offset, placed.data(), meshlets.size_bytes());
+    }
 
-    destroy_buffer(staging);
+    _uploader.upload_buffer(_vertexArena.buffer(newSurface.vertices.block), newSurface.vertices.offset, vertexData, vertexBufferSize);
+    newSurface.uploadTicket = _uploader.upload_buffer(_indexArena.buffer(newSurface.indices.block), newSurface.indices.offset, indexData, indexBufferSize);
 
     return newSurface;
 }
 
+void VulkanEngine::free_mesh_buffers(const GPUMeshBuffers& meshBuffers)
+{
+    _vertexArena.free(meshBuffers.vertices);
+    _indexArena.free(meshBuffers.indices);
+    _vertexArena.free(meshBuffers.meshlets);
+}
+
 void VulkanEngine::init_vulkan()
 {
     vkb::InstanceBuilder builder(vkGetInstanceProcAddr);
@@ -534,10 +728,21 @@ void VulkanEngine::init_vulkan()
     features12.descriptorIndexing = true;
     features12.uniformAndStorageBuffer8BitAccess = true;
     features12.hostQueryReset = true;
+    features12.timelineSemaphore = true;
+    features12.drawIndirectCount = true;
+    // bindless material table
+    features12.runtimeDescriptorArray = true;
+    features12.descriptorBindingPartiallyBound = true;
+    features12.descriptorBindingSampledImageUpdateAfterBind = true;
+    features12.descriptorBindingUpdateUnusedWhilePending = true;
+    features12.shaderSampledImageArrayNonUniformIndexing = true;
 
     VkPhysicalDeviceFeatures features10{};
     features10.samplerAnisotropy = true;
     features10.sampleRateShading = true;
+    features10.drawIndirectFirstInstance = true;
+    // textures cooked by nu-cook or loaded from ktx2 files
+    features10.textureCompressionBC = true;
 
     VkPhysicalDevicePageableDeviceLocalMemoryFeaturesEXT pdlmFeatures{};
     pdlmFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PAGEABLE_DEVICE_LOCAL_MEMORY_FEATURES_EXT;
@@ -591,6 +796,15 @@ void VulkanEngine::init_vulkan()
         .select()
         .value();
 
+    // lets material pipelines be linked from separately compiled stages, see PipelineCompiler
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplFeatures{};
+    gplFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    gplFeatures.graphicsPipelineLibrary = true;
+
+    _pipelineLibrariesSupported = physicalDevice.enable_extension_if_present(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+        && physicalDevice.enable_extension_if_present(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)
+        && physicalDevice.enable_extension_features_if_present(gplFeatures);
+
     vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 
     vkb::Device vkbDevice = deviceBuilder.build().value();
@@ -608,6 +822,17 @@ void VulkanEngine::init_vulkan()
     _asyncComputeQueue = vkbDevice.get_queue(vkb::QueueType::compute).value();
     _asyncComputeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
 
+    // a transfer-only family lets uploads run next to rendering, otherwise they share the graphics queue
+    auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    if (transferQueue.has_value()) {
+        _transferQueue = transferQueue.value();
+        _transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    }
+    else {
+        _transferQueue = _graphicsQueue;
+        _transferQueueFamily = _graphicsQueueFamily;
+    }
+
     _rtProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
     _rtProperties.pNext = &_asProperties;
     _asProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
@@ -617,6 +842,14 @@ void VulkanEngine::init_vulkan()
     prop2.pNext = &_rtProperties;
     vkGetPhysicalDeviceProperties2(_chosenGPU, &prop2);
 
+    if (_pipelineLibrariesSupported) {
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT gplProperties{};
+        gplProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+        prop2.pNext = &gplProperties;
+        vkGetPhysicalDeviceProperties2(_chosenGPU, &prop2);
+        _pipelineLibraryFastLinking = gplProperties.graphicsPipelineLibraryFastLinking;
+    }
+
     VmaVulkanFunctions vmaVulkanFunc{};
     vmaVulkanFunc.vkGetInstanceProcAddr = vkGetInstanceProcAddr;
     vmaVulkanFunc.vkGetDeviceProcAddr = vkGetDeviceProcAddr;
@@ -628,6 +861,9 @@ void VulkanEngine::init_vulkan()
     allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
     allocatorInfo.pVulkanFunctions = &vmaVulkanFunc;
     vmaCreateAllocator(&allocatorInfo, &_allocator);
+
+    _mainDeletionQueue.init(_device, _allocator);
+    _frameDeletionQueue.init(_device, _allocator);
 }
 void VulkanEngine::init_swapchain()
 { 
@@ -775,7 +1011,7 @@ void VulkanEngine::init_commands()
         _graphicsQueueFamily,
         VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
         VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
 
@@ -788,6 +1024,38 @@ void VulkanEngine::init_commands()
         });
     }
 
+    // the calling thread records too, so one less thread than workers
+    uint32_t recordWorkerCount = std::clamp(std::thread::hardware_concurrency(), 1u, RECORD_MAX_WORKERS);
+    _workers.init(recordWorkerCount - 1);
+    _mainDeletionQueue.push_function([&]() {
+        _workers.destroy();
+    });
+
+    VkCommandPoolCreateInfo recordPoolInfo = vkinit::command_pool_create_info(
+        _graphicsQueueFamily,
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        _frames[i]._recordPools.resize(_workers.worker_count());
+        _frames[i]._recordCommandBuffers.resize(_workers.worker_count());
+
+        for (uint32_t w = 0; w < _workers.worker_count(); w++) {
+            VK_CHECK(vkCreateCommandPool(_device, &recordPoolInfo, nullptr, &_frames[i]._recordPools[w]));
+
+            VkCommandBufferAllocateInfo secondaryAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._recordPools[w], 1);
+            secondaryAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+            VK_CHECK(vkAllocateCommandBuffers(_device, &secondaryAllocInfo, &_frames[i]._recordCommandBuffers[w]));
+        }
+
+        _mainDeletionQueue.push_function([=]() {
+            for (VkCommandPool pool : _frames[i]._recordPools) {
+                vkDestroyCommandPool(_device, pool, nullptr);
+            }
+        });
+    }
+
     VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_immCommandPool));
 
     VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_immCommandPool, 1);
@@ -817,20 +1085,32 @@ void VulkanEngine::init_sync_structures()
     VkFenceCreateInfo fenceCreateInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
     VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-    for (int i = 0; i < FRAME_OVERLAP; i++)
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
-        VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
-
         VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._swapchainSemaphore));
-        VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._renderSemaphore));
 
         _mainDeletionQueue.push_function([=]() {
-            vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
             vkDestroySemaphore(_device, _frames[i]._swapchainSemaphore, nullptr);
-            vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
         });
     }
 
+    _gpuProfiler.init(_device, _chosenGPU, _graphicsQueueFamily, MAX_FRAMES_IN_FLIGHT);
+    _mainDeletionQueue.push_function([&]() {
+        _gpuProfiler.destroy();
+    });
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo timelineCreateInfo = vkinit::semaphore_create_info();
+    timelineCreateInfo.pNext = &timelineInfo;
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_frameTimeline));
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroySemaphore(_device, _frameTimeline, nullptr);
+    });
+
     VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_immFence));
     _mainDeletionQueue.push_function([=]() {
         vkDestroyFence(_device, _immFence, nullptr);
@@ -845,6 +1125,28 @@ void VulkanEngine::init_async_compute_sync_structures()
         vkDestroyFence(_device, _asyncComputeFence, nullptr);
     });
 }
+void VulkanEngine::init_upload_service()
+{
+    // the graphics queue is only shared, and needs locking, when there is no transfer family
+    std::mutex* queueMutex = _transferQueue == _graphicsQueue ? &_graphicsQueueMutex : nullptr;
+    _uploader.init(this, _transferQueue, _transferQueueFamily, queueMutex, UPLOAD_STAGING_SIZE);
+
+    _mainDeletionQueue.push_function([&]() {
+        _uploader.destroy();
+    });
+}
+
+void VulkanEngine::init_geometry_arenas()
+{
+    _vertexArena.init(this, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, GEOMETRY_BLOCK_SIZE);
+    _indexArena.init(this, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, GEOMETRY_BLOCK_SIZE);
+
+    _mainDeletionQueue.push_function([&]() {
+        _vertexArena.destroy();
+        _indexArena.destroy();
+    });
+}
+
 void VulkanEngine::init_descriptors()
 {
     std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes =
@@ -880,9 +1182,20 @@ void VulkanEngine::init_descriptors()
         );
     }
 
+    _materialTable.init(_device, _allocator,
+        VK_SHADER_STAGE_VERTEX_BIT
+        | VK_SHADER_STAGE_FRAGMENT_BIT
+        | VK_SHADER_STAGE_RAYGEN_BIT_KHR
+        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
+    );
+
+    _textureStreamer.init(this, TEXTURE_STREAMING_BUDGET);
+
     _mainDeletionQueue.push_function([&]() {
+        _textureStreamer.destroy();
         vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
         vkDestroyDescriptorSetLayout(_device, _gpuSceneDataDescriptorLayout, nullptr);
+        _materialTable.destroy();
     });
 
     _drawImageDescriptors = _globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
@@ -894,7 +1207,7 @@ void VulkanEngine::init_descriptors()
         writer.update_set(_device, _drawImageDescriptors);
     }
 
-    for (int i = 0; i < FRAME_OVERLAP; i++) {
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 
         std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
             { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 3 },
@@ -911,21 +1224,106 @@ void VulkanEngine::init_descriptors()
  _mainDeletionQueue.push_function([&, i]() {
             _frames[i]._frameDescriptors.destroy_pools(_device);
         });
+
+        VkDeviceSize frameBufferAlignment = std::max({
+            _gpuProperties.limits.minUniformBufferOffsetAlignment,
+            _gpuProperties.limits.minStorageBufferOffsetAlignment,
+            VkDeviceSize{ 16 } // tlas instance data
+        });
+        _frames[i]._frameBuffer.init(
+            _allocator,
+            FRAME_BUFFER_SIZE,
+            frameBufferAlignment,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+            | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+            | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+        );
+        _mainDeletionQueue.push_function([&, i]() {
+            _frames[i]._frameBuffer.destroy(_allocator);
+        });
     } 
 
     create_rt_descriptor_set();
 }
 void VulkanEngine::init_pipelines()
 {
-    init_background_pipelines();
+    _pipelineCache = vkutil::load_pipeline_cache(_device, _gpuProperties, PIPELINE_CACHE_PATH);
+    _mainDeletionQueue.push_function([&]() {
+        vkutil::save_pipeline_cache(_device, _pipelineCache, PIPELINE_CACHE_PATH);
+        vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+    });
 
-    init_post_process_pipelines();
+    _pipelineCompiler.init(_device, _pipelineCache, _pipelineLibrariesSupported, _pipelineLibraryFastLinking, PIPELINE_COMPILE_THREADS);
 
+    // the material pipelines are the expensive ones, they compile while the rest is built here
     _metalRoughMaterial.build_pipelines(this);
 
     _mainDeletionQueue.push_function([&]() {
         _metalRoughMaterial.clear_resources(_device); 
     });
+
+    init_background_pipelines();
+
+    init_post_process_pipelines();
+
+    init_cull_pipeline();
+}
+void VulkanEngine::init_cull_pipeline()
+{
+    VkPushConstantRange cullRange{};
+    cullRange.offset = 0;
+    cullRange.size = sizeof(GPUCullPushConstants);
+    cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo cullLayout{};
+    cullLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    cullLayout.pNext = nullptr;
+    cullLayout.setLayoutCount = 0;
+    cullLayout.pPushConstantRanges = &cullRange;
+    cullLayout.pushConstantRangeCount = 1;
+
+    VK_CHECK(vkCreatePipelineLayout(_device, &cullLayout, nullptr, &_cullPipelineLayout));
+
+    VkShaderModule cullShader{};
+    if (!vkutil::load_shader_module("../shaders/cull.comp.spv", _device, &cullShader))
+    {
+        std::cout << "Error when building the cull shader" << std::endl;
+    }
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.pNext = nullptr;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = cullShader;
+    stageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo{};
+    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    computePipelineCreateInfo.pNext = nullptr;
+    computePipelineCreateInfo.layout = _cullPipelineLayout;
+    computePipelineCreateInfo.stage = stageInfo;
+
+    VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &computePipelineCreateInfo, nullptr, &_cullPipeline));
+
+    vkDestroyShaderModule(_device, cullShader, nullptr);
+    _mainDeletionQueue.push_function([&]() {
+        vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+        vkDestroyPipeline(_device, _cullPipeline, nullptr);
+        for (auto& frame : _frames) {
+            if (frame._indirect.drawCapacity > 0) {
+                destroy_buffer(frame._indirect.draws);
+            }
+            if (frame._indirect.countCapacity > 0) {
+                destroy_buffer(frame._indirect.counts);
+                destroy_buffer(frame._indirect.countReadback);
+            }
+            if (frame._indirect.mipFeedback.buffer != VK_NULL_HANDLE) {
+                destroy_buffer(frame._indirect.mipFeedback);
+                destroy_buffer(frame._indirect.mipFeedbackReadback);
+            }
+        }
+    });
 }
 void VulkanEngine::init_background_pipelines()
 {
@@ -978,7 +1376,7 @@ void VulkanEngine::init_background_pipelines()
     gradient.data.data1 = glm::vec4(1, 0, 0, 1);
     gradient.data.data2 = glm::vec4(0, 0, 1, 1);
  
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
+    VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
 
     computePipelineCreateInfo.stage.module = skyShader;
 
@@ -990,7 +1388,7 @@ void VulkanEngine::init_background_pipelines()
     sky.data.data1 = glm::vec4(0.1, 0.2, 0.4, 0.97);
 
 
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
+    VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
 
     _backgroundEffects.push_back(gradient);
     _backgroundEffects.push_back(sky);
@@ -1049,11 +1447,13 @@ void VulkanEngine::init_imgui()
     init_info.DescriptorPool = imguiPool;
     init_info.Subpass = 0;
     init_info.MinImageCount = 3;
-    init_info.ImageCount = 3;
+    // imgui rotates its vertex buffers over this many frames
+    init_info.ImageCount = MAX_FRAMES_IN_FLIGHT;
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     init_info.Allocator = _allocator->GetAllocationCallbacks();
     init_info.CheckVkResultFn = check_vk_result;
     init_info.UseDynamicRendering = true;
+    init_info.PipelineCache = _pipelineCache;
 
     VkPipelineRenderingCreateInfo pipeInfo{}; 
     pipeInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
@@ -1098,6 +1498,7 @@ void VulkanEngine::init_default_data()
         }
     }
     _errorCheckerboardImage = create_image(pixels.data(), VkExtent3D{ 16, 16, 1 }, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT);
+    _uploader.flush();
 
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(_chosenGPU, &properties);
@@ -1149,7 +1550,8 @@ void VulkanEngine::create_swapchain(uint32_t width, uint32_t height)
 
     vkb::Swapchain vkbSwapchain = swapchainBuilder
         .set_desired_format(VkSurfaceFormatKHR{ .format = _swapchainImageFormat, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR })
-        .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+        .set_desired_present_mode(_appliedPacing.presentMode)
+        .set_desired_min_image_count(_appliedPacing.swapchainImageCount)
         .set_desired_extent(width, height)
         .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
         .build()
@@ -1159,6 +1561,12 @@ void VulkanEngine::create_swapchain(uint32_t width, uint32_t height)
     _swapchain = vkbSwapchain.swapchain;
     _swapchainImages = vkbSwapchain.get_images().value();
     _swapchainImageViews = vkbSwapchain.get_image_views().value();
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
+    _presentSemaphores.resize(_swapchainImages.size());
+    for (VkSemaphore& semaphore : _presentSemaphores) {
+        VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &semaphore));
+    }
 }
 void VulkanEngine::destroy_swapchain()
 {
@@ -1168,6 +1576,11 @@ void VulkanEngine::destroy_swapchain()
     {
         vkDestroyImageView(_device, _swapchainImageViews[i], nullptr);
     }
+
+    for (VkSemaphore semaphore : _presentSemaphores) {
+        vkDestroySemaphore(_device, semaphore, nullptr);
+    }
+    _presentSemaphores.clear();
 }
 void VulkanEngine::resize_swapchain()
 {
@@ -1218,15 +1631,52 @@ AllocatedBuffer VulkanEngine::create_buffer(size_t allocSize, VkBufferUsageFlags
 
     return newBuffer;
 }
+AllocatedBuffer VulkanEngine::create_device_buffer(size_t allocSize, VkBufferUsageFlags usage)
+{
+    // shared between every queue that touches it so uploads don't need ownership transfers
+    std::array<uint32_t, 3> families{ _graphicsQueueFamily, _asyncComputeQueueFamily, _transferQueueFamily };
+    std::sort(families.begin(), families.end());
+    uint32_t familyCount = std::unique(families.begin(), families.end()) - families.begin();
+
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.pNext = nullptr;
+    bufferInfo.size = allocSize;
+
+    bufferInfo.usage = usage;
+    if (familyCount > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = familyCount;
+        bufferInfo.pQueueFamilyIndices = families.data();
+    }
+
+    VmaAllocationCreateInfo vmaAllocInfo = {};
+    vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    AllocatedBuffer newBuffer;
+
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocInfo, &newBuffer.buffer, &newBuffer.allocation, &newBuffer.info));
+
+    return newBuffer;
+}
 void VulkanEngine::destroy_buffer(const AllocatedBuffer &buffer)
 {
     vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 void VulkanEngine::draw_main(VkCommandBuffer cmd)
 { 
+    TRACE_FUNCTION();
 
     ComputeEffect& effect = _backgroundEffects[_currentBackgroundEffect];
 
+    // acceleration structure builds can't be recorded inside a rendering pass
+    uint32_t tlasScope = _gpuProfiler.begin_scope(cmd, "tlas build");
+    VkDescriptorSet rtDescriptorSet = update_top_level_as(cmd);
+    _gpuProfiler.end_scope(cmd, tlasScope);
+
+    // neither can the cull dispatch and its copies
+    uint32_t cullScope = _gpuProfiler.begin_scope(cmd, "cull");
+    cull_geometry(cmd);
+    _gpuProfiler.end_scope(cmd, cullScope);
+
     //vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
 
     //vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &_drawImageDescriptors, 0, nullptr);
@@ -1252,19 +1702,19 @@ void VulkanEngine::draw_main(VkCommandBuffer cmd)
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+    // the geometry comes from draw_geometry's secondary command buffers
+    renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
 
+    // timestamps can't go inside a pass that only takes secondary command buffers
+    uint32_t geometryScope = _gpuProfiler.begin_scope(cmd, "geometry");
     vkCmdBeginRendering(cmd, &renderInfo); 
-    auto start = std::chrono::system_clock::now();
-
-    draw_geometry(cmd);
-
-    auto end = std::chrono::system_clock::now();
 
-    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-    _stats.mesh_draw_time = elapsed.count() / 1000.0f;
+    draw_geometry(cmd, rtDescriptorSet);
 
     vkCmdEndRendering(cmd);
+    _gpuProfiler.end_scope(cmd, geometryScope);
  
+    uint32_t postScope = _gpuProfiler.begin_scope(cmd, "post process");
     VkRenderingAttachmentInfo postAttachment = vkinit::attachment_info(_postProcessingImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
     VkRenderingInfo postInfo = vkinit::rendering_info(_drawExtent, &postAttachment, nullptr);
     {
@@ -1297,21 +1747,14 @@ void VulkanEngine::draw_main(VkCommandBuffer cmd)
 
     uniformBlock.inverseScreenSize = glm::vec2(1 / _drawImage.imageExtent.width, 1/ _drawImage.imageExtent.height);
 
-    AllocatedBuffer postProcessingBuffer = create_buffer(sizeof(UniformBlock), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
- 
-    get_current_frame()._deletionQueue.push_function([=, this]() {
-        destroy_buffer(postProcessingBuffer);
-    });
-    
-    UniformBlock* uniformBlockSubmit = (UniformBlock*)postProcessingBuffer.allocation->GetMappedData();
-    *uniformBlockSubmit = uniformBlock;
+    LinearBufferAllocator::Allocation postProcessingBuffer = get_current_frame()._frameBuffer.push(_allocator, uniformBlock);
 
     VkDescriptorSet postProcessingDescriptor = get_current_frame()._frameDescriptors.allocate(_device, _postProcessingDescriptorLayout);
 
     DescriptorWriter writer;
     writer.write_image(0, _drawImage.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
     writer.write_sampler(1, _defaultSamplerLinear, VK_DESCRIPTOR_TYPE_SAMPLER);
-    writer.write_buffer(2, postProcessingBuffer.buffer, sizeof(UniformBlock), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    writer.write_buffer(2, postProcessingBuffer.buffer, sizeof(UniformBlock), postProcessingBuffer.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
     writer.update_set(_device, postProcessingDescriptor);
 
 
@@ -1340,6 +1783,7 @@ void VulkanEngine::draw_main(VkCommandBuffer cmd)
     vkCmdDraw(cmd, 6, 1, 0, 0);
 
     vkCmdEndRendering(cmd);
+    _gpuProfiler.end_scope(cmd, postScope);
 }
 
 void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
@@ -1354,121 +1798,411 @@ void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
     vkCmdEndRendering(cmd);
 }
 
-void VulkanEngine::draw_geometry(VkCommandBuffer cmd)
+void VulkanEngine::draw_gpu_timings()
 {
-    std::vector<uint32_t> opaque_draws;
-    opaque_draws.reserve(_mainDrawContext.OpaqueSurfaces.size());
+    const GpuFrameTimings& timings = _gpuProfiler.latest();
+
+    float frameMs = 0.0f;
+    for (const GpuScopeTiming& scope : timings.scopes) {
+        frameMs = std::max(frameMs, scope.endMs);
+    }
+    ImGui::Text("gpu frame %llu: %.3f ms", (unsigned long long)timings.frameNumber, frameMs);
+
+    // a row per scope, its bar covers the part of the frame the scope ran in
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    float width = ImGui::GetContentRegionAvail().x;
+    float rowHeight = ImGui::GetTextLineHeight();
+    for (const GpuScopeTiming& scope : timings.scopes) {
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        float begin = frameMs > 0.0f ? scope.beginMs / frameMs * width : 0.0f;
+        float end = frameMs > 0.0f ? scope.endMs / frameMs * width : 0.0f;
+        drawList->AddRectFilled(ImVec2(origin.x + begin, origin.y), ImVec2(origin.x + std::max(end, begin + 1.0f), origin.y + rowHeight),
+            IM_COL32(60, 110, 170, 255));
+        ImGui::Text("%*s%s: %.3f ms", (int)scope.depth * 2, "", scope.name, scope.endMs - scope.beginMs);
+    }
 
-    for (uint32_t i = 0; i < _mainDrawContext.OpaqueSurfaces.size(); i++) {
-        // if (vkutil::is_visible(_mainDrawContext.OpaqueSurfaces[i], _sceneData.viewproj)) {
-            opaque_draws.push_back(i); 
-        // }
+    if (ImGui::Button("export gpu timings")) {
+        _gpuProfiler.export_csv(GPU_TIMINGS_CSV_PATH);
     }
+}
 
-    std::sort(opaque_draws.begin(), opaque_draws.end(), [&](const auto& iA, const auto& iB) {
-        const RenderObject& A = _mainDrawContext.OpaqueSurfaces[iA];
-        const RenderObject& B = _mainDrawContext.OpaqueSurfaces[iB];
-        if (A.material == B.material) {
-            return A.indexBuffer < B.indexBuffer;
+void VulkanEngine::cull_geometry(VkCommandBuffer cmd)
+{
+    TRACE_FUNCTION();
+    FrameData& frame = get_current_frame();
+    IndirectDrawBuffers& indirect = frame._indirect;
+
+    // this slot's last frame has completed, so the counts copied back by its submit can be read
+    if (indirect.objectCount > 0) {
+        vmaInvalidateAllocation(_allocator, indirect.countReadback.allocation, 0, VK_WHOLE_SIZE);
+        const uint32_t* counts = (const uint32_t*)indirect.countReadback.info.pMappedData;
+
+        uint32_t visibleCount = 0;
+        for (uint32_t i = 0; i < indirect.bucketCount; i++) {
+            visibleCount += counts[1 + i];
+        }
+        _stats.triangle_count = counts[0];
+        // objects culled on the cpu plus the draws the cull pass dropped, whole objects or single meshlets
+        _stats.culled_count = indirect.cpuCulledCount + indirect.drawSlotCount - visibleCount;
+    }
+
+    Frustum frustum = Frustum::from_view_proj(_sceneData.viewproj);
+
+    std::vector<const RenderObject*> objects;
+    objects.reserve(_mainDrawContext.OpaqueSurfaces.size() + _mainDrawContext.TransparentSurfaces.size());
+    uint32_t cpuCulledCount = 0;
+
+    // opaque objects first, each list sorted so that objects sharing a pipeline and index block and type end up next to each other
+    auto gather = [&](const std::vector<RenderObject>& surfaces) {
+        size_t first = objects.size();
+        if (_gpuCulling) {
+            for (const RenderObject& r : surfaces) {
+                objects.push_back(&r);
+            }
         }
         else {
-            return A.material < B.material;
+            std::vector<uint32_t> visible;
+            visible.reserve(surfaces.size());
+
+            _cullingBounds.clear();
+            _cullingBounds.reserve(surfaces.size());
+            for (const RenderObject& r : surfaces) {
+                _cullingBounds.add(r.transform, r.bounds.origin, r.bounds.extents);
+            }
+            cpuCulledCount += _cullingBounds.cull(frustum, visible);
+
+            for (uint32_t i : visible) {
+                objects.push_back(&surfaces[i]);
+            }
         }
-    });
 
+        std::sort(objects.begin() + first, objects.end(), [](const RenderObject* A, const RenderObject* B) {
+            if (A->material->pipeline != B->material->pipeline) {
+                return A->material->pipeline < B->material->pipeline;
+            }
+            if (A->indexBlock != B->indexBlock) {
+                return A->indexBlock < B->indexBlock;
+            }
+            return A->indexType < B->indexType;
+        });
+    };
+    gather(_mainDrawContext.OpaqueSurfaces);
+    gather(_mainDrawContext.TransparentSurfaces);
+
+    uint32_t objectCount = (uint32_t)objects.size();
+    _drawBuckets.clear();
+    _objectBufferAddress = 0;
+
+    indirect.objectCount = objectCount;
+    indirect.drawSlotCount = 0;
+    indirect.bucketCount = 0;
+    indirect.cpuCulledCount = cpuCulledCount;
+
+    if (objectCount == 0) {
+        _stats.triangle_count = 0;
+        _stats.culled_count = cpuCulledCount;
+        _mainDrawContext.OpaqueSurfaces.clear();
+        _mainDrawContext.TransparentSurfaces.clear();
+        return;
+    }
 
-    AllocatedBuffer gpuSceneDataBuffer = create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-    
-    get_current_frame()._deletionQueue.push_function([=, this]() {
-        destroy_buffer(gpuSceneDataBuffer);
-    });
+    auto buffer_address = [&](VkBuffer buffer) {
+        VkBufferDeviceAddressInfo addressInfo{};
+        addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+        addressInfo.buffer = buffer;
+        return vkGetBufferDeviceAddress(_device, &addressInfo);
+    };
+
+    // one slot per possible material, so unlike the buffers below it never has to grow
+    if (indirect.mipFeedback.buffer == VK_NULL_HANDLE) {
+        indirect.mipFeedback = create_buffer(BINDLESS_MATERIAL_CAPACITY * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+        indirect.mipFeedbackReadback = create_buffer(BINDLESS_MATERIAL_CAPACITY * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    }
+
+    // the per meshlet tests run in the cull pass, with gpu culling off objects are drawn whole
+    bool clusterCulling = _gpuCulling && _clusterCulling;
+
+    LinearBufferAllocator::Allocation objectBuffer = frame._frameBuffer.allocate(_allocator, objectCount * sizeof(GPUObjectData));
+    GPUObjectData* objectData = (GPUObjectData*)objectBuffer.data;
+    uint32_t drawSlotCount = 0;
+    for (uint32_t i = 0; i < objectCount; i++) {
+        const RenderObject& r = *objects[i];
+        uint32_t meshletCount = clusterCulling ? r.meshletCount : 0;
+        uint32_t drawSlots = std::max(meshletCount, 1u);
+
+        // materials come from the bindless table per object and every mesh shares the index arena, so only a
+        // pipeline change splits a bucket. an index type change or a second arena block splits one as well
+        if (_drawBuckets.empty() || _drawBuckets.back().pipeline != r.material->pipeline
+            || _drawBuckets.back().indexBlock != r.indexBlock || _drawBuckets.back().indexType != r.indexType) {
+            _drawBuckets.push_back(DrawBucket{ r.material->pipeline, r.indexBlock, r.indexType, drawSlotCount, 0 });
+        }
+        _drawBuckets.back().maxDrawCount += drawSlots;
+        drawSlotCount += drawSlots;
+
+        GPUObjectData object{};
+        object.worldMatrix = r.transform;
+        object.boundsOrigin = glm::vec4(r.bounds.origin, r.bounds.sphereRadius);
+        object.boundsExtents = glm::vec4(r.bounds.extents, 0.0f);
+        object.vertexBuffer = r.vertexBufferAddress;
+        object.firstIndex = r.firstIndex;
+        object.indexCount = r.indexCount;
+        object.drawOffset = _drawBuckets.back().drawOffset;
+        // slot 0 of the count buffer holds the visible triangle count
+        object.countIndex = (uint32_t)_drawBuckets.size();
+        object.materialIndex = r.material->materialIndex;
+        object.vertexFormat = r.vertexFormat;
+        object.meshletBuffer = r.meshletBufferAddress;
+        object.firstMeshlet = r.firstMeshlet;
+        object.meshletCount = meshletCount;
+        // the mesh pipelines cull nothing, a double sided material shows the back faces a cone test would drop
+        object.coneCull = r.material->doubleSided ? 0 : 1;
+        objectData[i] = object;
+    }
+    _objectBufferAddress = buffer_address(objectBuffer.buffer) + objectBuffer.offset;
+    indirect.drawSlotCount = drawSlotCount;
+
+    GPUCullView view{};
+    for (int i = 0; i < 6; i++) {
+        view.frustumPlanes[i] = frustum.planes[i];
+    }
+    view.cameraPosition = glm::vec4(_mainCamera.position, 1.0f);
+    view.pixelScale = _mainDrawContext.lodScale;
+    view.mipFeedbackBuffer = buffer_address(indirect.mipFeedback.buffer);
+    LinearBufferAllocator::Allocation viewBuffer = frame._frameBuffer.push(_allocator, view);
+
+    _mainDrawContext.OpaqueSurfaces.clear();
+    _mainDrawContext.TransparentSurfaces.clear();
+
+    uint32_t bucketCount = (uint32_t)_drawBuckets.size();
+    uint32_t countCount = bucketCount + 1;
+    indirect.bucketCount = bucketCount;
+
+    // only this frame slot ever touches its indirect buffers and its last frame has completed, so outgrown ones can go right away
+    if (indirect.drawCapacity < drawSlotCount) {
+        if (indirect.drawCapacity > 0) {
+            destroy_buffer(indirect.draws);
+        }
+        indirect.drawCapacity = std::max(drawSlotCount, indirect.drawCapacity * 2);
+        indirect.draws = create_buffer(indirect.drawCapacity * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+    if (indirect.countCapacity < countCount) {
+        if (indirect.countCapacity > 0) {
+            destroy_buffer(indirect.counts);
+            destroy_buffer(indirect.countReadback);
+        }
+        indirect.countCapacity = std::max(countCount, indirect.countCapacity * 2);
+        indirect.counts = create_buffer(indirect.countCapacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+            | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+        indirect.countReadback = create_buffer(indirect.countCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    }
+
+    vkCmdFillBuffer(cmd, indirect.counts.buffer, 0, countCount * sizeof(uint32_t), 0);
+    vkCmdFillBuffer(cmd, indirect.mipFeedback.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+    }
+
+    GPUCullPushConstants cullConstants{};
+    cullConstants.viewBuffer = buffer_address(viewBuffer.buffer) + viewBuffer.offset;
+    cullConstants.objectBuffer = _objectBufferAddress;
+    cullConstants.drawBuffer = buffer_address(indirect.draws.buffer);
+    cullConstants.countBuffer = buffer_address(indirect.counts.buffer);
+    cullConstants.objectCount = objectCount;
+    // objects that reach this point already passed the cpu test when gpu culling is off
+    cullConstants.cullEnabled = _gpuCulling ? 1 : 0;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullPushConstants), &cullConstants);
+    // one workgroup per object, wrapped into rows since a dimension may be limited to 65535 groups
+    uint32_t groupsX = std::min(objectCount, 65535u);
+    vkCmdDispatch(cmd, groupsX, (objectCount + groupsX - 1) / groupsX, 1);
+
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+    }
+
+    VkBufferCopy countCopy{};
+    countCopy.size = countCount * sizeof(uint32_t);
+    vkCmdCopyBuffer(cmd, indirect.counts.buffer, indirect.countReadback.buffer, 1, &countCopy);
+
+    VkBufferCopy feedbackCopy{};
+    feedbackCopy.size = BINDLESS_MATERIAL_CAPACITY * sizeof(uint32_t);
+    vkCmdCopyBuffer(cmd, indirect.mipFeedback.buffer, indirect.mipFeedbackReadback.buffer, 1, &feedbackCopy);
+
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+    }
+}
+
+void VulkanEngine::draw_geometry(VkCommandBuffer cmd, VkDescriptorSet rtDescriptorSet)
+{
+    TRACE_FUNCTION_TIMED(&_stats.mesh_draw_time);
+    _stats.draw_call_count = 0;
+    if (_drawBuckets.empty()) {
+        return;
+    }
 
-    GPUSceneData* sceneUniformData = (GPUSceneData*)gpuSceneDataBuffer.allocation->GetMappedData();
-    *sceneUniformData = _sceneData;
+    LinearBufferAllocator::Allocation gpuSceneDataBuffer = get_current_frame()._frameBuffer.push(_allocator, _sceneData);
  
     VkDescriptorSet globalDescriptor = get_current_frame()._frameDescriptors.allocate(_device, _gpuSceneDataDescriptorLayout);
 
 	DescriptorWriter writer;
-	writer.write_buffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.write_buffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), gpuSceneDataBuffer.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 	writer.update_set(_device, globalDescriptor);
 
-    MaterialPipeline* lastPipeline = nullptr;
-    MaterialInstance* lastMaterial = nullptr;
-    VkBuffer lastIndexBuffer = VK_NULL_HANDLE; 
+    FrameData& frame = get_current_frame();
 
-    VkDescriptorSet rtDescriptorSet = create_top_level_as();
+    // contiguous ranges of the sorted buckets, executed in worker order so the draw order is unchanged
+    uint32_t bucketCount = (uint32_t)_drawBuckets.size();
+    uint32_t chunkCount = std::clamp((bucketCount + RECORD_MIN_BUCKETS_PER_WORKER - 1) / RECORD_MIN_BUCKETS_PER_WORKER, 1u, _workers.worker_count());
+    uint32_t chunkSize = (bucketCount + chunkCount - 1) / chunkCount;
+    chunkCount = (bucketCount + chunkSize - 1) / chunkSize;
 
-    auto draw = [&](const RenderObject& r) {
-        if (r.material != lastMaterial) {
+    VkFormat colorFormat = _msaaDrawImage.imageFormat;
+    VkCommandBufferInheritanceRenderingInfo renderingInheritance{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO };
+    renderingInheritance.colorAttachmentCount = 1;
+    renderingInheritance.pColorAttachmentFormats = &colorFormat;
+    renderingInheritance.depthAttachmentFormat = _msaaDepthImage.imageFormat;
+    renderingInheritance.rasterizationSamples = _msaaSampleCount;
 
-            lastMaterial = r.material;
+    VkCommandBufferInheritanceInfo inheritance{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+    inheritance.pNext = &renderingInheritance;
 
-            if (r.material->pipeline != lastPipeline) {
+    _workers.run([&](uint32_t worker) {
+        if (worker >= chunkCount) {
+            return;
+        }
+        TRACE_ZONE("record buckets");
 
-                lastPipeline = r.material->pipeline;
+        // this slot's last frame has completed, nothing recorded from the pool is still in use
+        VK_CHECK(vkResetCommandPool(_device, frame._recordPools[worker], 0));
 
-                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
-                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout,
-                    0, 1, &globalDescriptor, 0, nullptr);
-                
-                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout,
-                    2, 1, &rtDescriptorSet, 0, nullptr);
+        VkCommandBuffer secondary = frame._recordCommandBuffers[worker];
+        VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(
+            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+        beginInfo.pInheritanceInfo = &inheritance;
+        VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
 
-                VkViewport viewport = {};
-                viewport.x = 0;
-                viewport.y = 0;
-                viewport.width = (float)_drawExtent.width;
-                viewport.height = (float)_drawExtent.height;
-                viewport.minDepth = 0.0f;
-                viewport.maxDepth = 1.0f;
+        uint32_t firstBucket = worker * chunkSize;
+        uint32_t lastBucket = std::min(firstBucket + chunkSize, bucketCount);
+        record_draw_buckets(secondary, firstBucket, lastBucket, globalDescriptor, rtDescriptorSet);
 
-                vkCmdSetViewport(cmd, 0, 1, &viewport);
+        VK_CHECK(vkEndCommandBuffer(secondary));
+    });
 
-                VkRect2D scissor = {};
-                scissor.offset.x = 0;
-                scissor.offset.y = 0;
-                scissor.extent.width = _drawExtent.width;
-                scissor.extent.height = _drawExtent.height;
+    vkCmdExecuteCommands(cmd, chunkCount, frame._recordCommandBuffers.data());
 
-                vkCmdSetScissor(cmd, 0, 1, &scissor);
-            }
+    _stats.draw_call_count = bucketCount;
+}
 
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout,
-                1, 1, &r.material->materialSet, 0, nullptr);
-        }
+// secondary command buffers start without any state, so every range binds everything it uses
+void VulkanEngine::record_draw_buckets(VkCommandBuffer cmd, uint32_t firstBucket, uint32_t lastBucket, VkDescriptorSet globalDescriptor, VkDescriptorSet rtDescriptorSet)
+{
+    const MaterialPipeline* lastPipeline = nullptr;
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    VkIndexType lastIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+    IndirectDrawBuffers& indirect = get_current_frame()._indirect;
 
-        if (r.indexBuffer != lastIndexBuffer) {
-            lastIndexBuffer = r.indexBuffer;
-            vkCmdBindIndexBuffer(cmd, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32); 
+    GPUDrawPushConstants pushConstants;
+    pushConstants.objectBuffer = _objectBufferAddress;
+
+    // one indirect draw per bucket, how many of its commands survived culling is read from the count buffer
+    for (uint32_t i = firstBucket; i < lastBucket; i++) {
+        const DrawBucket& bucket = _drawBuckets[i];
+
+        // still compiling with nothing to stand in, the bucket just shows up a few frames later
+        const MaterialPipeline* pipeline = bucket.pipeline->resolve();
+        if (pipeline == nullptr) {
+            continue;
         }
 
-        GPUDrawPushConstants pushConstants;
-        pushConstants.worldMatrix = r.transform;
-        pushConstants.vertexBuffer = r.vertexBufferAddress;
-        vkCmdPushConstants(cmd, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
+        if (pipeline != lastPipeline) {
 
-        vkCmdDrawIndexed(cmd, r.indexCount, 1, r.firstIndex, 0, 0);
+            lastPipeline = pipeline;
 
-        _stats.draw_call_count++;
-        _stats.triangle_count += r.indexCount / 3;
-    };
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline.load(std::memory_order_acquire));
+            // scene data, the bindless material table and the ray tracing set, all of them stay bound across materials
+            VkDescriptorSet sets[] = { globalDescriptor, _materialTable.set(), rtDescriptorSet };
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout,
+                0, 3, sets, 0, nullptr);
 
-    _stats.draw_call_count = 0;
-    _stats.triangle_count = 0;
+            vkCmdPushConstants(cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &pushConstants);
 
-    for (auto& r : opaque_draws) {
-        draw(_mainDrawContext.OpaqueSurfaces[r]);
-    }
+            VkViewport viewport = {};
+            viewport.x = 0;
+            viewport.y = 0;
+            viewport.width = (float)_drawExtent.width;
+            viewport.height = (float)_drawExtent.height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+
+            vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+            VkRect2D scissor = {};
+            scissor.offset.x = 0;
+            scissor.offset.y = 0;
+            scissor.extent.width = _drawExtent.width;
+            scissor.extent.height = _drawExtent.height;
 
-    for (auto& r : _mainDrawContext.TransparentSurfaces) {
-        draw(r);
+            vkCmdSetScissor(cmd, 0, 1, &scissor);
+        }
+
+        VkBuffer indexBuffer = _indexArena.buffer(bucket.indexBlock);
+        if (indexBuffer != lastIndexBuffer || bucket.indexType != lastIndexType) {
+            lastIndexBuffer = indexBuffer;
+            lastIndexType = bucket.indexType;
+            vkCmdBindIndexBuffer(cmd, indexBuffer, 0, bucket.indexType);
+        }
+
+        vkCmdDrawIndexedIndirectCount(cmd,
+            indirect.draws.buffer, bucket.drawOffset * sizeof(VkDrawIndexedIndirectCommand),
+            indirect.counts.buffer, (1 + i) * sizeof(uint32_t),
+            bucket.maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
     }
- 
-    _mainDrawContext.OpaqueSurfaces.clear();
-    _mainDrawContext.TransparentSurfaces.clear(); 
 }
 
 AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+{
+    uint32_t mipLevels = 1;
+    if (mipmapped) {
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+    }
+    return create_image_levels(size, format, usage, mipLevels);
+}
+
+AllocatedImage VulkanEngine::create_image_levels(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels)
 {
 
     AllocatedImage newImage;
@@ -1476,9 +2210,7 @@ AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkIm
     newImage.imageExtent = size;
 
     VkImageCreateInfo img_info = vkinit::image_create_info(format, usage, size);
-    if (mipmapped) {
-        img_info.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
-    }
+    img_info.mipLevels = mipLevels;
  
     if (format == VK_FORMAT_D32_SFLOAT) {
         img_info.samples = VK_SAMPLE_COUNT_4_BIT;
@@ -1505,52 +2237,23 @@ AllocatedImage VulkanEngine::create_image(VkExtent3D size, VkFormat format, VkIm
 
 AllocatedImage VulkanEngine::create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
 {
-    size_t data_size = size.depth * size.width * size.height * 4;
-    AllocatedBuffer uploadBuffer = create_buffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-    memcpy(uploadBuffer.info.pMappedData, data, data_size);
+    size_t data_size = vkutil::image_level_size(format, size, 0);
+    // blits can't write compressed blocks
+    mipmapped = mipmapped && !vkutil::is_block_compressed(format);
 
     AllocatedImage new_image = create_image(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
 
-    immediate_submit([&](VkCommandBuffer cmd) {
-        {
-            VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-            imageBarrier.pNext = nullptr;
-            imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-            imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
-            imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT; 
-            imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT; 
-            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            vkutil::transition_image(cmd, new_image.image, imageBarrier);
-        }
-        VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset = 0;
-        copyRegion.bufferRowLength = 0;
-        copyRegion.bufferImageHeight = 0;
-        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copyRegion.imageSubresource.mipLevel = 0;
-        copyRegion.imageSubresource.baseArrayLayer = 0;
-        copyRegion.imageSubresource.layerCount = 1;
-        copyRegion.imageExtent = size;
-        vkCmdCopyBufferToImage(cmd, uploadBuffer.buffer, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-        if (mipmapped) {
-            vkutil::generate_mipmaps(cmd, new_image.image, VkExtent2D{ new_image.imageExtent.width, new_image.imageExtent.height });
-        }
-        else {
-            VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-            imageBarrier.pNext = nullptr;
-            imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT; 
-            imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT; 
-            imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT; 
-            imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
-            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            vkutil::transition_image(cmd, new_image.image, imageBarrier); 
-        } 
-    }); 
-    destroy_buffer(uploadBuffer);
+    // layout and mips are finished by the uploader, before the first frame that can sample it
+    _uploader.upload_image(new_image, data, data_size, mipmapped);
+
+    return new_image;
+}
+
+AllocatedImage VulkanEngine::create_image_with_mips(const void* data, size_t dataSize, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, uint32_t mipLevels)
+{
+    AllocatedImage new_image = create_image_levels(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mipLevels);
+
+    _uploader.upload_image_levels(new_image, data, dataSize, mipLevels);
 
     return new_image;
 }
@@ -1592,7 +2295,7 @@ void VulkanEngine::destroy_image(const AllocatedImage& img)
 
 void VulkanEngine::update_scene()
 {
-    auto start = std::chrono::system_clock::now();
+    TRACE_FUNCTION_TIMED(&_stats.scene_update_time);
 
     _mainCamera.update();
 
@@ -1600,10 +2303,21 @@ void VulkanEngine::update_scene()
     _sceneData.view = _mainCamera.getViewMatrix();
 
 #ifndef AVI_DISABLE_INTERCHANGE 
-    ShmemString cameraName("CameraBasis", _interprocess->_segment.get_allocator<ShmemString>());
-    Transform cameraBasisTrans = _interprocess->_map->at(cameraName);
-    glm::mat4 cameraBasis = glm::make_mat4(cameraBasisTrans.array);
-    _sceneData.view *= cameraBasis;
+    // the producer never blocks us, without a new frame the last one is still in place
+    bool newTransforms = _interprocess->acquire_transforms();
+    const glm::mat4* interprocessTransforms = _interprocess->transforms();
+    _sceneData.view *= interprocessTransforms[Interprocess::CAMERA_SLOT];
+
+    // bindings are in slot order, slot 0 being the camera
+    for (uint32_t i = 0; newTransforms && i < _interprocessBindings.size(); i++) {
+        InterprocessBinding& binding = _interprocessBindings[i];
+        const glm::mat4& transform = interprocessTransforms[i + 1];
+        binding.node.setWorldTransform(transform);
+        if (binding.instanceIndex >= 0) {
+            _instances[binding.instanceIndex].transform = transform;
+            _tlasDirty = true;
+        }
+    }
 #endif // AVI_DISABLE_INTERCHANGE
 
     glm::mat4 inverse = glm::inverse(_sceneData.view);
@@ -1619,22 +2333,11 @@ void VulkanEngine::update_scene()
     _sceneData.proj[1][1] *= 1; //might need to change to -1
     _sceneData.viewproj = _sceneData.proj * _sceneData.view;
 
-#ifndef AVI_DISABLE_INTERCHANGE
-    for (auto node : _loadedScenes[sceneString]->nodes) {
-        ShmemString name(node.first.c_str(), _interprocess->_segment.get_allocator<ShmemString>());
-        Transform trans = _interprocess->_map->at(name);
-        glm::mat4 transform = glm::make_mat4(trans.array);
-        node.second->worldTransform = transform;
-        _instances[_nodeNameToInstanceIndexMap[node.first]].transform = node.second->worldTransform; // move back into first loop when proper change of basis matrix
-    } 
-#endif // AVI_DISABLE_INTERCHANGE
+    _mainDrawContext.cameraPosition = glm::vec3(_sceneData.cameraPos);
+    _mainDrawContext.lodScale = _sceneData.proj[1][1] * 0.5f * (float)_drawExtent.height;
+    _mainDrawContext.lodErrorThreshold = _lodErrorThreshold;
 
     _loadedScenes[sceneString]->Draw(glm::mat4{ 1.0f }, _mainDrawContext);
-
-    auto end = std::chrono::system_clock::now();
-
-    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-    _stats.scene_update_time = elapsed.count() / 1000.0f;
 }
 
 VkSampleCountFlagBits VulkanEngine::getMaxUsableSampleCount()
@@ -1688,7 +2391,7 @@ void VulkanEngine::init_post_process_pipelines()
 
     pipelineBuilder._pipelineLayout = _postProcessingPipelineLayout;
 
-    VK_CHECK(pipelineBuilder.build_pipeline(_device, _postProcessingPipeline));
+    VK_CHECK(pipelineBuilder.build_pipeline(_device, _postProcessingPipeline, _pipelineCache));
 
     vkDestroyShaderModule(_device, postFragShader, nullptr);
     vkDestroyShaderModule(_device, postVertShader, nullptr);
@@ -1702,11 +2405,16 @@ void VulkanEngine::init_post_process_pipelines()
 
 void VulkanEngine::init_ray_tracing()
 {
+    // the blas builds read the vertex and index buffers directly
+    _uploader.wait(_uploader.flush());
     create_bottom_level_as();
+    create_top_level_as();
 }
 
 void VulkanEngine::cleanup_ray_tracing()
 {
+    destroy_accel_struct(_tlas);
+    destroy_buffer(_tlasScratchBuffer);
     for (auto& b : _blas) {
         destroy_accel_struct(b);
     }
@@ -1714,10 +2422,7 @@ void VulkanEngine::cleanup_ray_tracing()
 
 BLASInput VulkanEngine::mesh_to_vk_geometry(const MeshAsset &mesh)
 {
-    VkBufferDeviceAddressInfo indexAddressInfo{};
-    indexAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    indexAddressInfo.buffer = mesh.meshBuffers.indexBuffer.buffer;
-    VkDeviceAddress indexAddress = vkGetBufferDeviceAddress(_device, &indexAddressInfo);
+    VkDeviceAddress indexAddress = _indexArena.address(mesh.meshBuffers.indices);
     VkDeviceAddress vertexAddress = mesh.meshBuffers.vertexBufferAddress;
     uint32_t maxPrimitiveCount = mesh.indexCount / 3;
 
@@ -1725,9 +2430,10 @@ BLASInput VulkanEngine::mesh_to_vk_geometry(const MeshAsset &mesh)
     triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
     triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
     triangles.vertexData.deviceAddress = vertexAddress;
-    triangles.vertexStride = sizeof(Vertex);
+    // both formats start with a float3 position
+    triangles.vertexStride = mesh.meshBuffers.vertexFormat == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
     triangles.maxVertex = mesh.vertexCount - 1;
-    triangles.indexType = VK_INDEX_TYPE_UINT32;
+    triangles.indexType = mesh.meshBuffers.indexType;
     triangles.indexData.deviceAddress = indexAddress;
 
     VkAccelerationStructureGeometryKHR geom{};
@@ -1906,83 +2612,23 @@ void VulkanEngine::create_bottom_level_as()
     for (uint32_t i = 0; i < asBuilds.size(); i++) {
         _blas.emplace_back(asBuilds[i].as);
     }
-    for (auto node : _loadedScenes[sceneString]->meshNodes) {
-        MeshNode* meshNode = static_cast<MeshNode*>(node.second.get());
+    for (const MeshNode& meshNode : _loadedScenes[sceneString]->meshNodes) {
         MeshInstance instance;
-        instance.meshIndex = nameIndexMap[meshNode->mesh->name];
-        instance.transform = meshNode->worldTransform;
-        _nodeNameToInstanceIndexMap[node.first] = _instances.size();
+        instance.meshIndex = nameIndexMap[meshNode.mesh->name];
+        instance.transform = meshNode.node.worldTransform();
+        _nodeNameToInstanceIndexMap[meshNode.name] = _instances.size();
         _instances.emplace_back(instance);
     }
     vkDestroyQueryPool(_device, queryPool, nullptr);
     destroy_buffer(scratchBuffer);
 }
 
-VkDescriptorSet VulkanEngine::create_top_level_as()
+void VulkanEngine::create_top_level_as()
 {
-    std::vector<VkAccelerationStructureInstanceKHR> asInstances;
-    asInstances.reserve(_instances.size()); 
-    for (uint32_t i = 0; i < _instances.size(); i++) {
-        VkAccelerationStructureInstanceKHR rayInst{};
-        rayInst.transform = vkutil::toTransformMatrixKHR(_instances[i].transform);
-        rayInst.instanceCustomIndex = i;
-        rayInst.accelerationStructureReference = _blas[_instances[i].meshIndex].address;
-        rayInst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        rayInst.mask = 0xFF;
-        rayInst.instanceShaderBindingTableRecordOffset = 0; // all same hit group for now
-        asInstances.emplace_back(rayInst);
-    }
-
     uint32_t instanceCount = static_cast<uint32_t>(_instances.size());
-    size_t instanceBufferSize = _instances.size()*sizeof(MeshInstance);
-    AllocatedBuffer instancesBuffer = create_buffer(
-        instanceBufferSize,
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-        | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-        | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY
-    );
-
-    AllocatedBuffer staging = create_buffer(
-        instanceBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_CPU_ONLY
-    );
-
-    void* data = staging.allocation->GetMappedData();
-
-    memcpy(data, asInstances.data(), instanceBufferSize);
-
-    async_compute_submit([&](VkCommandBuffer cmd) { // usually put on a background thread that solely executes uploads, deleting/reusing the stageing buffers
-        VkBufferCopy bufferCopy{ 0 };
-        bufferCopy.dstOffset = 0;
-        bufferCopy.srcOffset = 0;
-        bufferCopy.size = instanceBufferSize;
-
-        vkCmdCopyBuffer(cmd, staging.buffer, instancesBuffer.buffer, 1, &bufferCopy);
-    }); // otherwise the cpu is waiting until the gpu is done 
-
-    destroy_buffer(staging);
-
-    VkBufferDeviceAddressInfo instancesBufferInfo{};
-    instancesBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    instancesBufferInfo.buffer = instancesBuffer.buffer;
-    VkDeviceAddress instancesBufferAddress = vkGetBufferDeviceAddress(_device, &instancesBufferInfo);
-
-    async_compute_submit([&](VkCommandBuffer cmd) {
-        VkMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 
-            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr
-        );
-    });
 
     VkAccelerationStructureGeometryInstancesDataKHR geomInstances{};
     geomInstances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-    geomInstances.data.deviceAddress = instancesBufferAddress;
 
     VkAccelerationStructureGeometryKHR topASGeom{};
     topASGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -1991,12 +2637,11 @@ VkDescriptorSet VulkanEngine::create_top_level_as()
 
     VkAccelerationStructureBuildGeometryInfoKHR buildInfo{};
     buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
     buildInfo.geometryCount = 1;
     buildInfo.pGeometries = &topASGeom;
     buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
     buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-    buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 
     VkAccelerationStructureBuildSizesInfoKHR sizeInfo{};
     sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
@@ -2008,45 +2653,140 @@ VkDescriptorSet VulkanEngine::create_top_level_as()
     createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
     createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
     createInfo.size = sizeInfo.accelerationStructureSize;
-    AllocatedAS tlas = create_accel_struct(createInfo); // only one tlas for now
-    get_current_frame()._deletionQueue.push_function([=, this]() {
-        destroy_accel_struct(tlas);
-    });
+    _tlas = create_accel_struct(createInfo); // only one tlas for now
 
-    AllocatedBuffer scratchBuffer = create_buffer(
-        sizeInfo.buildScratchSize,
+    // one scratch buffer serves both the initial build and every refit after it
+    VkDeviceSize scratchAlignment = _asProperties.minAccelerationStructureScratchOffsetAlignment;
+    VkDeviceSize scratchSize = std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize) + scratchAlignment;
+    _tlasScratchBuffer = create_buffer(
+        scratchSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY,
-        VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
+        VMA_MEMORY_USAGE_GPU_ONLY
     );
     VkBufferDeviceAddressInfo scratchBufferInfo{};
     scratchBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    scratchBufferInfo.buffer = scratchBuffer.buffer;
+    scratchBufferInfo.buffer = _tlasScratchBuffer.buffer;
     VkDeviceAddress scratchAddress = vkGetBufferDeviceAddress(_device, &scratchBufferInfo);
+    _tlasScratchAddress = (scratchAddress + scratchAlignment - 1) & ~(scratchAlignment - 1);
 
-    buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
-    buildInfo.dstAccelerationStructure = tlas.accel; // only one tlas for now
-    buildInfo.scratchData.deviceAddress = scratchAddress;
-
-    VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{instanceCount, 0, 0, 0};
-    const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+    _tlasInstanceCount = instanceCount;
+    _tlasNeedsBuild = true;
+}
 
-    async_compute_submit([&](VkCommandBuffer cmd) {
-        vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildInfo, &pBuildOffsetInfo);
-    });
+VkDescriptorSet VulkanEngine::update_top_level_as(VkCommandBuffer cmd)
+{
+    TRACE_FUNCTION();
+    if (_instances.size() != _tlasInstanceCount) {
+        // instance count changed, the tlas can't be refit so retire it once this frame is no longer in flight
+        _frameDeletionQueue.push_accel_struct(_tlas, frame_signal_value());
+        _frameDeletionQueue.push_buffer(_tlasScratchBuffer, frame_signal_value());
+        create_top_level_as();
+    }
 
-    destroy_buffer(scratchBuffer);
-    destroy_buffer(instancesBuffer);
+    // refits let the bvh drift away from where the instances moved to, a full build every so often restores it
+    if (_tlasDirty && _tlasRefitCount >= TLAS_REFITS_PER_REBUILD) {
+        _tlasNeedsBuild = true;
+    }
+    // nothing moved, the tlas built by an earlier frame is still valid as it is
+    if (_tlasDirty || _tlasNeedsBuild) {
+        build_top_level_as(cmd);
+    }
 
     VkDescriptorSet rtDescriptorSet =  get_current_frame()._frameDescriptors.allocate(_device, _rtDescriptorSetLayout);
 
     DescriptorWriter writer;
-    writer.write_accel_struct(0, tlas.accel);
+    writer.write_accel_struct(0, _tlas.accel);
     writer.write_image(1, _rtDrawImage.imageView, _defaultSamplerLinear, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
     writer.update_set(_device, rtDescriptorSet);
     return rtDescriptorSet;
 }
 
+void VulkanEngine::build_top_level_as(VkCommandBuffer cmd)
+{
+    uint32_t instanceCount = _tlasInstanceCount;
+    size_t instanceBufferSize = instanceCount * sizeof(VkAccelerationStructureInstanceKHR);
+
+    // instance data only has to live until this frame's build has executed
+    LinearBufferAllocator::Allocation instancesBuffer = get_current_frame()._frameBuffer.allocate(_allocator, instanceBufferSize);
+    VkAccelerationStructureInstanceKHR* asInstances = (VkAccelerationStructureInstanceKHR*)instancesBuffer.data;
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        VkAccelerationStructureInstanceKHR rayInst{};
+        rayInst.transform = vkutil::toTransformMatrixKHR(_instances[i].transform);
+        rayInst.instanceCustomIndex = i;
+        rayInst.accelerationStructureReference = _blas[_instances[i].meshIndex].address;
+        rayInst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+        rayInst.mask = 0xFF;
+        rayInst.instanceShaderBindingTableRecordOffset = 0; // all same hit group for now
+        asInstances[i] = rayInst;
+    }
+
+    VkBufferDeviceAddressInfo instancesBufferInfo{};
+    instancesBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    instancesBufferInfo.buffer = instancesBuffer.buffer;
+    VkDeviceAddress instancesBufferAddress = vkGetBufferDeviceAddress(_device, &instancesBufferInfo) + instancesBuffer.offset;
+
+    VkAccelerationStructureGeometryInstancesDataKHR geomInstances{};
+    geomInstances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geomInstances.data.deviceAddress = instancesBufferAddress;
+
+    VkAccelerationStructureGeometryKHR topASGeom{};
+    topASGeom.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    topASGeom.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    topASGeom.geometry.instances = geomInstances;
+
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo{};
+    buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &topASGeom;
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    if (_tlasNeedsBuild) {
+        buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+    }
+    else {
+        // only the transforms moved, refit in place
+        buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+        buildInfo.srcAccelerationStructure = _tlas.accel;
+    }
+    buildInfo.dstAccelerationStructure = _tlas.accel;
+    buildInfo.scratchData.deviceAddress = _tlasScratchAddress;
+
+    VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{instanceCount, 0, 0, 0};
+    const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+
+    {
+        // the previous frame may still be tracing against the tlas we are about to overwrite
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+    }
+
+    vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildInfo, &pBuildOffsetInfo);
+
+    {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(cmd,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
+        );
+    }
+
+    _tlasRefitCount = _tlasNeedsBuild ? 0 : _tlasRefitCount + 1;
+    _tlasNeedsBuild = false;
+    _tlasDirty = false;
+}
+
 void VulkanEngine::create_rt_descriptor_set()
 {
     DescriptorLayoutBuilder builder;
@@ -2065,17 +2805,28 @@ void VulkanEngine::create_rt_descriptor_set()
 }
 void VulkanEngine::init_interprocess()
 {
-    _interprocess = std::make_shared<Interprocess>(_loadedScenes[sceneString]->nodes);
+    // names are resolved here once, every frame after that only walks the slots in order
+    std::vector<std::pair<std::string, glm::mat4>> publishedTransforms;
+    _interprocessBindings.clear();
+    for (auto& node : _loadedScenes[sceneString]->nodes) {
+        publishedTransforms.emplace_back(node.first, node.second.worldTransform());
+
+        InterprocessBinding binding;
+        binding.node = node.second;
+        auto instance = _nodeNameToInstanceIndexMap.find(node.first);
+        binding.instanceIndex = instance != _nodeNameToInstanceIndexMap.end() ? (int32_t)instance->second : -1;
+        _interprocessBindings.push_back(binding);
+    }
+
+    _interprocess = std::make_shared<Interprocess>(publishedTransforms);
 }
 
 void GLTFMetallic_Roughness::build_pipelines(VulkanEngine* engine)
 {
-    VkShaderModule meshFragShader;
     if (!vkutil::load_shader_module("../shaders/pbr.frag.spv", engine->_device, &meshFragShader)) {
         std::cout << "Error when building the triangle fragment shader module" << std::endl;
     }
 
-    VkShaderModule meshVertShader;
     if (!vkutil::load_shader_module("../shaders/pbr.vert.spv", engine->_device, &meshVertShader)) {
         std::cout << "Error when building the triangle vertex shader module" << std::endl; 
     }
@@ -2085,22 +2836,8 @@ void GLTFMetallic_Roughness::build_pipelines(VulkanEngine* engine)
     matrixRange.size = sizeof(GPUDrawPushConstants);
     matrixRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-    DescriptorLayoutBuilder layoutBuilder;
-    layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    layoutBuilder.add_binding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-    materialLayout = layoutBuilder.build(
-        engine->_device, 
-        VK_SHADER_STAGE_VERTEX_BIT
-        | VK_SHADER_STAGE_FRAGMENT_BIT
-        | VK_SHADER_STAGE_RAYGEN_BIT_KHR
-        | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR
-    );
-
     // VkDescriptorSetLayout layouts[] = { engine->_gpuSceneDataDescriptorLayout, materialLayout};
-    VkDescriptorSetLayout layouts[] = { engine->_gpuSceneDataDescriptorLayout, materialLayout, engine->_rtDescriptorSetLayout };
+    VkDescriptorSetLayout layouts[] = { engine->_gpuSceneDataDescriptorLayout, engine->_materialTable.layout(), engine->_rtDescriptorSetLayout };
 
     VkPipelineLayoutCreateInfo mesh_layout_info = vkinit::pipeline_layout_create_info();
     // mesh_layout_info.setLayoutCount = 2;
@@ -2113,6 +2850,8 @@ void GLTFMetallic_Roughness::build_pipelines(VulkanEngine* engine)
 
     opaquePipeline.layout = gltfPipelineLayout;
     transparentPipeline.layout = gltfPipelineLayout;
+    // opaque is the generic pipeline every other variant stands in with
+    transparentPipeline.fallback = &opaquePipeline;
 
     PipelineBuilder pipelineBuilder;
     pipelineBuilder.set_shaders(meshVertShader, meshFragShader);
@@ -2127,15 +2866,12 @@ void GLTFMetallic_Roughness::build_pipelines(VulkanEngine* engine)
 
     pipelineBuilder._pipelineLayout = gltfPipelineLayout;
 
-    VK_CHECK(pipelineBuilder.build_pipeline(engine->_device, opaquePipeline.pipeline));
+    engine->_pipelineCompiler.compile(pipelineBuilder, &opaquePipeline);
     
     pipelineBuilder.enable_blending_additive(); 
     pipelineBuilder.enable_depth_test(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
 
-    VK_CHECK(pipelineBuilder.build_pipeline(engine->_device, transparentPipeline.pipeline));
-
-    vkDestroyShaderModule(engine->_device, meshFragShader, nullptr);
-    vkDestroyShaderModule(engine->_device, meshVertShader, nullptr);
+    engine->_pipelineCompiler.compile(pipelineBuilder, &transparentPipeline);
 }
 
 void GLTFMetallic_Roughness::clear_resources(VkDevice device)
@@ -2143,13 +2879,15 @@ void GLTFMetallic_Roughness::clear_resources(VkDevice device)
     vkDestroyPipeline(device, opaquePipeline.pipeline, nullptr);
     vkDestroyPipeline(device, transparentPipeline.pipeline, nullptr);
     vkDestroyPipelineLayout(device, gltfPipelineLayout, nullptr);
-    vkDestroyDescriptorSetLayout(device, materialLayout, nullptr);
+    vkDestroyShaderModule(device, meshFragShader, nullptr);
+    vkDestroyShaderModule(device, meshVertShader, nullptr);
 }
 
-MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocatorGrowable& descriptorAllocator)
+MaterialInstance GLTFMetallic_Roughness::write_material(BindlessMaterialTable& table, MaterialPass pass, const MaterialResources& resources)
 {
     MaterialInstance matData;
     matData.passType = pass;
+    matData.doubleSided = resources.doubleSided;
     if (pass == MaterialPass::Transparent) {
         matData.pipeline = &transparentPipeline;
     }
@@ -2158,44 +2896,18 @@ MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, Materia
     }
         matData.pipeline = &opaquePipeline; // DEBUGGGING PURPOSES
 
-    matData.materialSet = descriptorAllocator.allocate(device, materialLayout);
+    GPUMaterialData data{};
+    data.colorFactors = resources.colorFactors;
+    data.metalRoughFactors = resources.metalRoughFactors;
+    data.colorTexture = table.acquire_texture(resources.colorImage.imageView, resources.colorSampler);
+    data.metalRoughTexture = table.acquire_texture(resources.metalRoughImage.imageView, resources.metalRoughSampler);
+    data.normalTexture = table.acquire_texture(resources.normalImage.imageView, resources.normalSampler);
 
-    writer.clear();
-    writer.write_buffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.write_image(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_image(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_image(3, resources.normalImage.imageView, resources.normalSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-    writer.update_set(device, matData.materialSet);
+    matData.materialIndex = table.add_material(data);
 
     return matData;
 }
 
-void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
-{
-    glm::mat4 nodeMatrix = topMatrix * worldTransform;
-
-    for (auto& s : mesh->surfaces) {
-        RenderObject def;
-        def.indexCount = s.count;
-        def.firstIndex = s.startIndex;
-        def.indexBuffer = mesh->meshBuffers.indexBuffer.buffer;
-        def.material = &s.material->data;
-        def.bounds = s.bounds;
-        def.transform = nodeMatrix;
-        def.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress;
-
-        if (s.material->data.passType == MaterialPass::Transparent) {
-            ctx.TransparentSurfaces.push_back(def);
-        }
-        else {
-            ctx.OpaqueSurfaces.push_back(def); 
-        }
-    }
-
-    Node::Draw(topMatrix, ctx);
-}
-
 bool vkutil::is_visible(const RenderObject& obj, const glm::mat4& viewProj)
 {
     std::array<glm::vec3, 8> corners{
@@ -0,0 +1,144 @@
+#include "vk_geometry.h"
+#include "vk_engine.h"
+
+#include <cassert>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void FreeListAllocator::init(VkDeviceSize size)
+{
+	_freeRanges.clear();
+	_freeRanges[0] = size;
+	_size = size;
+	_used = 0;
+}
+
+VkDeviceSize FreeListAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	for (auto it = _freeRanges.begin(); it != _freeRanges.end(); ++it) {
+		VkDeviceSize rangeOffset = it->first;
+		VkDeviceSize rangeEnd = it->first + it->second;
+
+		VkDeviceSize offset = align_up(rangeOffset, alignment);
+		if (offset + size > rangeEnd) {
+			continue;
+		}
+
+		// the range is split into the padding in front, the allocation and what is left behind it
+		_freeRanges.erase(it);
+		if (offset > rangeOffset) {
+			_freeRanges[rangeOffset] = offset - rangeOffset;
+		}
+		if (offset + size < rangeEnd) {
+			_freeRanges[offset + size] = rangeEnd - (offset + size);
+		}
+
+		_used += size;
+		return offset;
+	}
+
+	return INVALID_OFFSET;
+}
+
+void FreeListAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+	assert(offset + size <= _size);
+	_used -= size;
+
+	auto next = _freeRanges.lower_bound(offset);
+	assert(next == _freeRanges.end() || next->first >= offset + size);
+
+	if (next != _freeRanges.end() && next->first == offset + size) {
+		size += next->second;
+		next = _freeRanges.erase(next);
+	}
+
+	if (next != _freeRanges.begin()) {
+		auto previous = std::prev(next);
+		assert(previous->first + previous->second <= offset);
+		if (previous->first + previous->second == offset) {
+			previous->second += size;
+			return;
+		}
+	}
+
+	_freeRanges[offset] = size;
+}
+
+void GeometryArena::init(VulkanEngine* engine, VkBufferUsageFlags usage, VkDeviceSize blockSize)
+{
+	_engine = engine;
+	_usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+	_blockSize = blockSize;
+}
+
+void GeometryArena::destroy()
+{
+	for (Block& block : _blocks) {
+		_engine->destroy_buffer(block.buffer);
+	}
+	_blocks.clear();
+}
+
+GeometryRange GeometryArena::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	// zero sized meshes still get a distinct range
+	size = std::max<VkDeviceSize>(size, alignment);
+
+	for (uint32_t i = 0; i < _blocks.size(); i++) {
+		VkDeviceSize offset = _blocks[i].allocator.allocate(size, alignment);
+		if (offset != FreeListAllocator::INVALID_OFFSET) {
+			return GeometryRange{ i, offset, size };
+		}
+	}
+
+	add_block(std::max(size, _blockSize));
+	uint32_t block = (uint32_t)_blocks.size() - 1;
+	VkDeviceSize offset = _blocks[block].allocator.allocate(size, alignment);
+	return GeometryRange{ block, offset, size };
+}
+
+void GeometryArena::free(const GeometryRange& range)
+{
+	if (range.size == 0) {
+		return;
+	}
+	_blocks[range.block].allocator.free(range.offset, range.size);
+}
+
+VkDeviceSize GeometryArena::used_bytes() const
+{
+	VkDeviceSize used = 0;
+	for (const Block& block : _blocks) {
+		used += block.allocator.used();
+	}
+	return used;
+}
+
+VkDeviceSize GeometryArena::capacity_bytes() const
+{
+	VkDeviceSize capacity = 0;
+	for (const Block& block : _blocks) {
+		capacity += block.allocator.size();
+	}
+	return capacity;
+}
+
+void GeometryArena::add_block(VkDeviceSize size)
+{
+	Block block;
+	block.buffer = _engine->create_device_buffer(size, _usage);
+
+	VkBufferDeviceAddressInfo addressInfo{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+		.buffer = block.buffer.buffer
+	};
+	block.address = vkGetBufferDeviceAddress(_engine->_device, &addressInfo);
+	block.allocator.init(size);
+
+	std::cout << "GeometryArena: added a block of " << (size >> 20) << " MB" << std::endl;
+	_blocks.push_back(std::move(block));
+}
@@ -154,3 +154,47 @@ void vkutil::generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D ima
 //
 //	vkCmdPipelineBarrier2(cmd, &depInfo);
 //}
+
+bool vkutil::is_block_compressed(VkFormat format)
+{
+	return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+VkDeviceSize vkutil::image_level_size(VkFormat format, VkExtent3D extent, uint32_t level)
+{
+	VkDeviceSize width = std::max(extent.width >> level, 1u);
+	VkDeviceSize height = std::max(extent.height >> level, 1u);
+	VkDeviceSize depth = std::max(extent.depth >> level, 1u);
+
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return ((width + 3) / 4) * ((height + 3) / 4) * depth * 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return ((width + 3) / 4) * ((height + 3) / 4) * depth * 16;
+	case VK_FORMAT_R8_UNORM:
+		return width * height * depth;
+	case VK_FORMAT_R8G8_UNORM:
+		return width * height * depth * 2;
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+		return width * height * depth * 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		return width * height * depth * 16;
+	default:
+		// every other format uploaded so far is 8 bit rgba or bgra
+		return width * height * depth * 4;
+	}
+}
@@ -2,10 +2,14 @@
 #include "vk_engine.h"
 #include "vk_initializers.h"
 #include "vk_types.h"
+#include "scene_cache.h"
+#include "mesh_optimizer.h"
+#include "cpu_trace.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <glm/gtx/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/parser.hpp>
 #include <fastgltf/tools.hpp>
@@ -13,11 +17,65 @@
 
 
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
  
+// the coarsest lod whose error, projected to the screen like the bounding sphere, stays under the context's threshold.
+// scale takes object space lengths to world space
+static const MeshLod& select_lod(const GeoSurface& surface, const glm::mat4& transform, float scale, const DrawContext& ctx)
+{
+	glm::vec3 center = transform * glm::vec4(surface.bounds.origin, 1.0f);
+	float radius = surface.bounds.sphereRadius * scale;
+	float distance = glm::length(center - ctx.cameraPosition);
+	if (surface.lodCount == 1 || radius <= 0.0f || distance <= radius) {
+		return surface.lods[0];
+	}
+
+	// radius in pixels, the errors scale with it
+	float projectedRadius = radius * ctx.lodScale / distance;
+	uint32_t selected = 0;
+	for (uint32_t i = 1; i < surface.lodCount; i++) {
+		if (surface.lods[i].error / surface.bounds.sphereRadius * projectedRadius > ctx.lodErrorThreshold) {
+			break;
+		}
+		selected = i;
+	}
+	return surface.lods[selected];
+}
+
 void LoadedGLTF::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
 {
-	for (auto& n : topNodes) {
-		n->Draw(topMatrix, ctx);
+	transforms.update();
+
+	for (const MeshNode& meshNode : meshNodes) {
+		glm::mat4 nodeMatrix = topMatrix * meshNode.node.worldTransform();
+		float scale = std::max({ glm::length(glm::vec3(nodeMatrix[0])), glm::length(glm::vec3(nodeMatrix[1])), glm::length(glm::vec3(nodeMatrix[2])) });
+
+		for (auto& s : meshNode.mesh->surfaces) {
+			const MeshLod& lod = select_lod(s, nodeMatrix, scale, ctx);
+
+			RenderObject def;
+			def.indexCount = lod.count;
+			def.firstIndex = meshNode.mesh->meshBuffers.firstIndex + lod.startIndex;
+			def.indexBlock = meshNode.mesh->meshBuffers.indices.block;
+			def.indexType = meshNode.mesh->meshBuffers.indexType;
+			def.material = &s.material->data;
+			def.bounds = s.bounds;
+			def.transform = nodeMatrix;
+			def.vertexBufferAddress = meshNode.mesh->meshBuffers.vertexBufferAddress;
+			def.vertexFormat = meshNode.mesh->meshBuffers.vertexFormat;
+			def.meshletBufferAddress = meshNode.mesh->meshBuffers.meshletBufferAddress;
+			def.firstMeshlet = lod.firstMeshlet;
+			def.meshletCount = lod.meshletCount;
+
+			if (s.material->data.passType == MaterialPass::Transparent) {
+				ctx.TransparentSurfaces.push_back(def);
+			}
+			else {
+				ctx.OpaqueSurfaces.push_back(def);
+			}
+		}
 	}
 }
 
@@ -25,8 +83,9 @@ void LoadedGLTF::clearAll()
 {
 	VkDevice dv = creator->_device;
 
-	descriptorPool.destroy_pools(dv);
-	creator->destroy_buffer(materialDataBuffer);
+	for (auto& [name, material] : materials) {
+		creator->_materialTable.remove_material(material->data.materialIndex);
+	}
 
 	// for (auto& [k, v] : meshes) {
 	// 	indexBuffersDestroyed++;
@@ -42,21 +101,375 @@ void LoadedGLTF::clearAll()
 
 		creator->destroy_image(image);
 	}
+	for (uint32_t handle : streamedTextures) {
+		creator->_textureStreamer.remove_texture(handle);
+	}
 
 	for (auto& sampler : samplers) {
 		vkDestroySampler(dv, sampler, nullptr);
 	}
 }
 
+static_assert(sizeof(PackedVertex) == sizeof(CookedVertex), "scene cache vertex layout is out of date");
+
+// one node as it appears in the source file, parentIndex is -1 for roots
+struct ImportedNode
+{
+	std::string name;
+	glm::mat4 localTransform;
+	int32_t parentIndex;
+	std::shared_ptr<MeshAsset> mesh;
+};
+
+// adds the nodes to the file's hierarchy sorted so that parents come first, then computes the world matrices once
+static void build_nodes(LoadedGLTF& file, const std::vector<ImportedNode>& importedNodes)
+{
+	std::vector<int32_t> parentIndices(importedNodes.size());
+	for (size_t i = 0; i < importedNodes.size(); i++) {
+		parentIndices[i] = importedNodes[i].parentIndex;
+	}
+
+	std::vector<uint32_t> order = TransformHierarchy::topological_order(parentIndices);
+	if (order.size() != importedNodes.size()) {
+		std::cout << "Skipping " << importedNodes.size() - order.size() << " nodes that are not reachable from a root" << std::endl;
+	}
+
+	// file index to hierarchy index
+	std::vector<uint32_t> remap(importedNodes.size(), TransformHierarchy::NO_PARENT);
+	for (uint32_t source : order) {
+		const ImportedNode& imported = importedNodes[source];
+		uint32_t parent = imported.parentIndex >= 0 ? remap[imported.parentIndex] : TransformHierarchy::NO_PARENT;
+		remap[source] = file.transforms.add(parent, imported.localTransform);
+
+		Node node{ &file.transforms, remap[source] };
+		file.nodes[imported.name] = node;
+		if (imported.mesh) {
+			file.meshNodes.push_back(MeshNode{ imported.name, node, imported.mesh });
+		}
+	}
+
+	file.transforms.update();
+}
+
+// the bc formats map one to one, anything else is rgba8
+static VkFormat texture_vk_format(TextureFormat format)
+{
+	switch (format) {
+	case TextureFormat::BC1: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case TextureFormat::BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case TextureFormat::BC7: return VK_FORMAT_BC7_UNORM_BLOCK;
+	default: return VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+// ktx2 files bring their own format and mip chain, stb decoded pixels get their mips blitted on the gpu
+static AllocatedImage create_decoded_image(VulkanEngine* engine, DecodedImage& decoded)
+{
+	if (decoded.pixels == nullptr) {
+		return engine->create_image_with_mips(
+			decoded.texture.texels.data(),
+			decoded.texture.texels.size(),
+			decoded.extent,
+			texture_vk_format(decoded.texture.format),
+			VK_IMAGE_USAGE_SAMPLED_BIT,
+			decoded.texture.mipLevels
+		);
+	}
+
+	AllocatedImage newImage = engine->create_image(
+		decoded.pixels,
+		decoded.extent,
+		VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_USAGE_SAMPLED_BIT,
+		true
+	);
+	stbi_image_free(decoded.pixels);
+	return newImage;
+}
+
+// a KHR_texture_basisu source can't be transcoded here, the texture falls back to its plain source
+static size_t texture_image_index(const fastgltf::Texture& texture, const std::vector<bool>& loaded)
+{
+	size_t image = texture.imageIndex.value();
+	if (!loaded[image] && texture.fallbackImageIndex.has_value()) {
+		image = texture.fallbackImageIndex.value();
+	}
+	return image;
+}
+
+// builds the scene from a cache written by nu-cook. everything is read in place from the mapping,
+// the only per-element work left is creating the vulkan objects. a streamed texture keeps the cache
+// mapped, its finer levels are read from it whenever they stream in
+static std::optional<std::shared_ptr<LoadedGLTF>> load_cooked_gltf(VulkanEngine* engine, std::shared_ptr<const SceneCacheView> cacheOwner)
+{
+	TRACE_FUNCTION();
+	const SceneCacheView& cache = *cacheOwner;
+	const SceneCacheHeader& header = cache.header();
+	auto cookedSamplers = cache.section<CookedSampler>(header.samplers);
+	auto cookedImages = cache.section<CookedImage>(header.images);
+	auto cookedMaterials = cache.section<CookedMaterial>(header.materials);
+	auto cookedSurfaces = cache.section<CookedSurface>(header.surfaces);
+	auto cookedMeshes = cache.section<CookedMesh>(header.meshes);
+	auto cookedNodes = cache.section<CookedNode>(header.nodes);
+	auto cookedVertices = cache.section<PackedVertex>(header.vertices);
+	auto cookedIndices = cache.section<uint32_t>(header.indices);
+	auto cookedMeshlets = cache.section<Meshlet>(header.meshlets);
+
+	std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
+	scene->creator = engine;
+	LoadedGLTF& file = *scene.get();
+
+	for (const CookedSampler& sampler : cookedSamplers) {
+		VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr };
+		sampl.maxLod = VK_LOD_CLAMP_NONE;
+		sampl.minLod = 0;
+
+		sampl.magFilter = vkutil::extract_filter(fastgltf::Filter(sampler.magFilter));
+		sampl.minFilter = vkutil::extract_filter(fastgltf::Filter(sampler.minFilter));
+
+		sampl.mipmapMode = vkutil::extract_mipmap_mode(fastgltf::Filter(sampler.minFilter));
+
+		sampl.anisotropyEnable = true;
+		sampl.maxAnisotropy = engine->_gpuProperties.limits.maxSamplerAnisotropy;
+
+		VkSampler newSampler;
+		vkCreateSampler(engine->_device, &sampl, nullptr, &newSampler);
+
+		file.samplers.push_back(newSampler);
+	}
+
+	std::vector<AllocatedImage> images;
+	for (const CookedImage& image : cookedImages) {
+		if (image.width == 0) {
+			images.push_back(engine->_errorCheckerboardImage);
+			continue;
+		}
+
+		VkExtent3D extent{ image.width, image.height, 1 };
+		VkFormat format = texture_vk_format(static_cast<TextureFormat>(image.format));
+		if (engine->_textureStreaming) {
+			uint32_t handle = engine->_textureStreamer.add_texture(cacheOwner, cache.texels(image.texelOffset), extent, format, image.mipLevels);
+			images.push_back(engine->_textureStreamer.image(handle));
+			file.streamedTextures.push_back(handle);
+			continue;
+		}
+
+		AllocatedImage newImage = engine->create_image_with_mips(
+			cache.texels(image.texelOffset),
+			image.texelSize,
+			extent,
+			format,
+			VK_IMAGE_USAGE_SAMPLED_BIT,
+			image.mipLevels
+		);
+		images.push_back(newImage);
+		file.images.push_back(newImage);
+	}
+
+	std::vector<std::shared_ptr<GLTFMaterial>> materials;
+	for (size_t i = 0; i < cookedMaterials.size(); i++) {
+		const CookedMaterial& mat = cookedMaterials[i];
+
+		std::shared_ptr<GLTFMaterial> newMat = std::make_shared<GLTFMaterial>();
+		materials.push_back(newMat);
+		file.materials[cache.string(mat.nameOffset)] = newMat;
+
+		GLTFMetallic_Roughness::MaterialResources materialResources;
+		materialResources.colorFactors = glm::make_vec4(mat.colorFactors);
+		materialResources.metalRoughFactors = glm::make_vec4(mat.metalRoughFactors);
+		materialResources.colorImage = mat.colorImage != SCENE_CACHE_NONE ? images[mat.colorImage] : engine->_whiteImage;
+		materialResources.colorSampler = mat.colorSampler != SCENE_CACHE_NONE ? file.samplers[mat.colorSampler] : engine->_defaultSamplerLinear;
+		materialResources.metalRoughImage = mat.metalRoughImage != SCENE_CACHE_NONE ? images[mat.metalRoughImage] : engine->_whiteImage;
+		materialResources.metalRoughSampler = mat.metalRoughSampler != SCENE_CACHE_NONE ? file.samplers[mat.metalRoughSampler] : engine->_defaultSamplerLinear;
+		materialResources.normalImage = mat.normalImage != SCENE_CACHE_NONE ? images[mat.normalImage] : engine->_whiteImage;
+		materialResources.normalSampler = mat.normalSampler != SCENE_CACHE_NONE ? file.samplers[mat.normalSampler] : engine->_defaultSamplerLinear;
+		materialResources.doubleSided = mat.doubleSided != 0;
+
+		newMat->data = engine->_metalRoughMaterial.write_material(engine->_materialTable, (MaterialPass)mat.passType, materialResources);
+	}
+
+	std::vector<std::shared_ptr<MeshAsset>> meshes;
+	for (const CookedMesh& mesh : cookedMeshes) {
+		std::shared_ptr<MeshAsset> newMesh = std::make_shared<MeshAsset>();
+		meshes.push_back(newMesh);
+		newMesh->name = cache.string(mesh.nameOffset);
+		file.meshes[newMesh->name] = newMesh;
+
+		for (const CookedSurface& surface : cookedSurfaces.subspan(mesh.firstSurface, mesh.surfaceCount)) {
+			GeoSurface newSurface;
+			newSurface.startIndex = surface.startIndex;
+			newSurface.count = surface.count;
+			newSurface.lodCount = surface.lodCount;
+			std::copy(surface.lods, surface.lods + surface.lodCount, newSurface.lods);
+			newSurface.bounds.origin = glm::make_vec3(surface.origin);
+			newSurface.bounds.extents = glm::make_vec3(surface.extents);
+			newSurface.bounds.sphereRadius = surface.sphereRadius;
+			newSurface.material = materials[surface.materialIndex];
+			newMesh->surfaces.push_back(newSurface);
+		}
+
+		newMesh->meshBuffers = engine->uploadMesh(
+			cookedIndices.subspan(mesh.firstIndex, mesh.indexCount),
+			cookedVertices.subspan(mesh.firstVertex, mesh.vertexCount),
+			cookedMeshlets.subspan(mesh.firstMeshlet, mesh.meshletCount)
+		);
+		engine->meshesToDelete.emplace_back(newMesh->meshBuffers);
+		newMesh->vertexCount = mesh.vertexCount;
+		newMesh->indexCount = mesh.baseIndexCount;
+	}
+
+	std::vector<ImportedNode> importedNodes;
+	importedNodes.reserve(cookedNodes.size());
+	for (const CookedNode& node : cookedNodes) {
+		ImportedNode& imported = importedNodes.emplace_back();
+		imported.name = cache.string(node.nameOffset);
+		imported.localTransform = glm::make_mat4(node.localTransform);
+		imported.parentIndex = node.parentIndex;
+		if (node.meshIndex != SCENE_CACHE_NONE) {
+			imported.mesh = meshes[node.meshIndex];
+		}
+	}
+
+	build_nodes(file, importedNodes);
+
+	engine->_uploader.flush();
+
+	return scene;
+}
+
+// cpu side result of converting one gltf mesh, uploaded once every mesh is done
+struct ImportedMesh
+{
+	std::vector<uint32_t> indices;
+	std::vector<Vertex> vertices;
+	std::vector<GeoSurface> surfaces;
+	std::vector<size_t> materialIndices;
+	std::vector<Meshlet> meshlets;
+	// indices of lod 0, the lower lods are appended after them
+	uint32_t baseIndexCount{ 0 };
+};
+
+// runs task(i) for every i in [0, count) on the pool's workers and returns when all are done.
+// the workers pull indices from one counter, so uneven tasks still spread over all of them
+static void parallel_for(WorkerPool& pool, size_t count, const std::function<void(size_t)>& task)
+{
+	std::atomic<size_t> next{ 0 };
+
+	pool.run([&](uint32_t) {
+		TRACE_ZONE("parallel_for");
+		for (size_t i = next++; i < count; i = next++) {
+			task(i);
+		}
+	});
+}
+
+static void import_mesh(const fastgltf::Asset& gltf, const fastgltf::Mesh& mesh, bool optimize, ImportedMesh& out)
+{
+	TRACE_FUNCTION();
+	std::vector<uint32_t>& indices = out.indices;
+	std::vector<Vertex>& vertices = out.vertices;
+
+	for (auto&& p : mesh.primitives) {
+		GeoSurface newSurface;
+		newSurface.startIndex = (uint32_t)indices.size();
+		newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+		newSurface.lods[0] = MeshLod{ newSurface.startIndex, newSurface.count, 0.0f, 0, 0 };
+		newSurface.lodCount = 1;
+
+		size_t initial_vtx = vertices.size();
+
+		{
+			const fastgltf::Accessor& indexAccessor = gltf.accessors[p.indicesAccessor.value()];
+			indices.reserve(indices.size() + indexAccessor.count);
+
+			fastgltf::iterateAccessor<std::uint32_t>(gltf, indexAccessor, [&](std::uint32_t idx) {
+				indices.push_back(idx + initial_vtx);
+			});
+		}
+		{
+			const fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
+			vertices.resize(vertices.size() + posAccessor.count);
+
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
+				Vertex newVtx;
+				newVtx.position = v;
+				newVtx.normal = { 1, 0, 0 };
+				newVtx.color = glm::vec4{ 1.0f };
+				newVtx.uv_x = 0;
+				newVtx.uv_y = 0;
+				vertices[initial_vtx + index] = newVtx;
+			});
+		}
+
+		auto normals = p.findAttribute("NORMAL");
+		if (normals != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second], [&](glm::vec3 v, size_t index) {
+				vertices[initial_vtx + index].normal = v;
+			});
+		}
+
+		auto uv = p.findAttribute("TEXCOORD_0");
+		if (uv != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second], [&](glm::vec2 v, size_t index) {
+				vertices[initial_vtx + index].uv_x = v.x;
+				vertices[initial_vtx + index].uv_y = v.y;
+			});
+		}
+
+		auto colors = p.findAttribute("COLOR_0");
+		if (colors != p.attributes.end()) {
+
+			fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second], [&](glm::vec4 v, size_t index) {
+				vertices[initial_vtx + index].color = v;
+			});
+		}
+
+		out.materialIndices.push_back(p.materialIndex.value_or(0));
+
+		glm::vec3 minPos = vertices[initial_vtx].position;
+		glm::vec3 maxPos = vertices[initial_vtx].position;
+		for (int i = initial_vtx; i < vertices.size(); i++) {
+			minPos = glm::min(minPos, vertices[i].position);
+			maxPos = glm::max(maxPos, vertices[i].position);
+		}
+
+		newSurface.bounds.origin = (maxPos + minPos) / 2.0f;
+		newSurface.bounds.extents = (maxPos - minPos) / 2.0f;
+		newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
+
+		out.surfaces.push_back(newSurface);
+	}
+
+	out.baseIndexCount = (uint32_t)indices.size();
+	if (optimize) {
+		meshopt::optimize_mesh(indices, vertices, out.surfaces);
+		meshopt::generate_lods(indices, vertices, out.surfaces);
+		meshopt::generate_meshlets(indices, vertices, out.surfaces, out.meshlets);
+	}
+}
+
 std::optional<std::shared_ptr<LoadedGLTF>> vkutil::load_gltf(VulkanEngine* engine, std::string_view filePath)
 {
+	TRACE_FUNCTION();
 	std::cout << "Loading GLTF: " << filePath << std::endl;
 
+	// a cache cooked from the same version of this file skips parsing and decoding entirely
+	{
+		std::shared_ptr<SceneCacheView> cache = std::make_shared<SceneCacheView>();
+		if (cache->open(scenecache::cache_path(filePath), filePath)) {
+			std::cout << "Using scene cache for " << filePath << std::endl;
+			return load_cooked_gltf(engine, cache);
+		}
+	}
+
 	std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
 	scene->creator = engine;
 	LoadedGLTF& file = *scene.get();
 
-	fastgltf::Parser parser{};
+	// quantized attributes come out of iterateAccessor as floats already, the normalized ones rescaled
+	fastgltf::Parser parser{ fastgltf::Extensions::KHR_mesh_quantization | fastgltf::Extensions::KHR_texture_basisu };
 
 	constexpr auto gltfOptions =
 		fastgltf::Options::DontRequireValidAssetMember |
@@ -98,14 +511,6 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkutil::load_gltf(VulkanEngine* engin
 		return {};
 	}
 
-	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
-	};
-
-	file.descriptorPool.init(engine->_device, gltf.materials.size(), sizes);
-
 	for (fastgltf::Sampler& sampler : gltf.samplers) {
 
 		VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr };
@@ -127,48 +532,66 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkutil::load_gltf(VulkanEngine* engin
 	}
 
 	std::vector<std::shared_ptr<MeshAsset>> meshes;
-	std::vector<std::shared_ptr<Node>> nodes;
+	std::vector<ImportedNode> importedNodes;
 	std::vector<AllocatedImage> images;
 	std::vector<std::shared_ptr<GLTFMaterial>> materials;
 
-	for (fastgltf::Image& image : gltf.images) {
-		std::optional<AllocatedImage> img = vkutil::load_image(engine, gltf, image);
+	// image decode and mesh conversion only read the parsed asset, so all of it runs on the engine's worker
+	// pool. scenes load on the thread that records frames, so the pool is idle while it is borrowed here.
+	// the vulkan objects are created afterwards on this thread
+	std::vector<std::optional<DecodedImage>> decodedImages(gltf.images.size());
+	std::vector<ImportedMesh> importedMeshes(gltf.meshes.size());
+
+	bool streamTextures = engine->_textureStreaming;
+	parallel_for(engine->_workers, gltf.images.size() + gltf.meshes.size(), [&](size_t i) {
+		if (i < gltf.images.size()) {
+			decodedImages[i] = vkutil::decode_image(gltf, gltf.images[i]);
+
+			// the streamer uploads levels from memory, so the mips are built here instead of blitted on the gpu
+			std::optional<DecodedImage>& decoded = decodedImages[i];
+			if (streamTextures && decoded.has_value() && decoded->pixels != nullptr) {
+				texcodec::build_mips(decoded->pixels, decoded->extent.width, decoded->extent.height, decoded->texture);
+				stbi_image_free(decoded->pixels);
+				decoded->pixels = nullptr;
+			}
+		}
+		else {
+			size_t meshIndex = i - gltf.images.size();
+			import_mesh(gltf, gltf.meshes[meshIndex], engine->_optimizeMeshes, importedMeshes[meshIndex]);
+		}
+	});
 
-		if (img.has_value()) {
-			images.push_back(*img);
-			file.images.push_back(*img);
+	std::vector<bool> loadedImages(gltf.images.size(), false);
+	for (size_t i = 0; i < gltf.images.size(); i++) {
+		std::optional<DecodedImage>& decoded = decodedImages[i];
+
+		if (decoded.has_value() && streamTextures) {
+			std::shared_ptr<TextureData> texture = std::make_shared<TextureData>(std::move(decoded->texture));
+			uint32_t handle = engine->_textureStreamer.add_texture(texture, texture->texels.data(), decoded->extent,
+				texture_vk_format(texture->format), texture->mipLevels);
+			loadedImages[i] = true;
+
+			images.push_back(engine->_textureStreamer.image(handle));
+			file.streamedTextures.push_back(handle);
+		}
+		else if (decoded.has_value()) {
+			AllocatedImage img = create_decoded_image(engine, decoded.value());
+			loadedImages[i] = true;
+
+			images.push_back(img);
+			file.images.push_back(img);
 		}
 		else {
 			images.push_back(engine->_errorCheckerboardImage);
-			std::cout << "gltf failed to load texture " << image.name << std::endl;
+			std::cout << "gltf failed to load texture " << gltf.images[i].name << std::endl;
 		}
 	}
 
-	
-	file.materialDataBuffer = engine->create_buffer(
-		sizeof(GLTFMetallic_Roughness::MaterialConstants) * gltf.materials.size(),
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU
-	);
-	int data_index = 0;
-	GLTFMetallic_Roughness::MaterialConstants* sceneMaterialConstants =
-		(GLTFMetallic_Roughness::MaterialConstants*)file.materialDataBuffer.info.pMappedData;
-
 	for (fastgltf::Material& mat : gltf.materials) {
 		std::shared_ptr<GLTFMaterial> newMat = std::make_shared<GLTFMaterial>();
 		materials.push_back(newMat);
 		file.materials[mat.name.c_str()] = newMat;
 
-		GLTFMetallic_Roughness::MaterialConstants constants;
-		constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
-		constants.colorFactors.y = mat.pbrData.baseColorFactor[1];
-		constants.colorFactors.z = mat.pbrData.baseColorFactor[2];
-		constants.colorFactors.w = mat.pbrData.baseColorFactor[3];
-
-		constants.metal_rough_factors.x = mat.pbrData.metallicFactor;
-		constants.metal_rough_factors.y = mat.pbrData.roughnessFactor;
-		
-		sceneMaterialConstants[data_index] = constants;
-
 		MaterialPass passType = MaterialPass::MainColor;
 		if (mat.alphaMode == fastgltf::AlphaMode::Blend) {
 			passType = MaterialPass::Transparent;
@@ -182,148 +605,79 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkutil::load_gltf(VulkanEngine* engin
 		materialResources.metalRoughSampler = engine->_defaultSamplerLinear;
 		materialResources.normalImage = engine->_whiteImage;
 		materialResources.normalSampler = engine->_defaultSamplerLinear; 
-		
-		materialResources.dataBuffer = file.materialDataBuffer.buffer;
-		materialResources.dataBufferOffset = data_index * sizeof(GLTFMetallic_Roughness::MaterialConstants);
+
+		materialResources.colorFactors.x = mat.pbrData.baseColorFactor[0];
+		materialResources.colorFactors.y = mat.pbrData.baseColorFactor[1];
+		materialResources.colorFactors.z = mat.pbrData.baseColorFactor[2];
+		materialResources.colorFactors.w = mat.pbrData.baseColorFactor[3];
+
+		materialResources.metalRoughFactors = glm::vec4(0.0f);
+		materialResources.metalRoughFactors.x = mat.pbrData.metallicFactor;
+		materialResources.metalRoughFactors.y = mat.pbrData.roughnessFactor;
+		materialResources.doubleSided = mat.doubleSided;
 
 		if (mat.pbrData.baseColorTexture.has_value()) {
-			size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
+			size_t img = texture_image_index(gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex], loadedImages);
 			size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
 
 			materialResources.colorImage = images[img];
 			materialResources.colorSampler = file.samplers[sampler];
 		}
 		if (mat.pbrData.metallicRoughnessTexture.has_value()) {
-			size_t img = gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex].imageIndex.value();
+			size_t img = texture_image_index(gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex], loadedImages);
 			size_t sampler = gltf.textures[mat.pbrData.metallicRoughnessTexture.value().textureIndex].samplerIndex.value();
 
 			materialResources.metalRoughImage = images[img];
 			materialResources.metalRoughSampler = file.samplers[sampler];
 		}
 		if (mat.normalTexture.has_value()) {
-			size_t img = gltf.textures[mat.normalTexture.value().textureIndex].imageIndex.value();
+			size_t img = texture_image_index(gltf.textures[mat.normalTexture.value().textureIndex], loadedImages);
 			size_t sampler = gltf.textures[mat.normalTexture.value().textureIndex].samplerIndex.value();
 
 			materialResources.normalImage = images[img];
 			materialResources.normalSampler = file.samplers[sampler];
 		}
 
-		newMat->data = engine->_metalRoughMaterial.write_material(engine->_device, passType, materialResources, file.descriptorPool);
-
-		data_index++;
+		newMat->data = engine->_metalRoughMaterial.write_material(engine->_materialTable, passType, materialResources);
 	}
 
-	std::vector<uint32_t> indices;
-	std::vector<Vertex> vertices;
+	// uploads only copy into the staging ring, the transfers go out together on the flush below
+	for (size_t m = 0; m < gltf.meshes.size(); m++) {
+		fastgltf::Mesh& mesh = gltf.meshes[m];
+		ImportedMesh& imported = importedMeshes[m];
 
-	for (fastgltf::Mesh& mesh : gltf.meshes) {
 		std::shared_ptr<MeshAsset> newMesh = std::make_shared<MeshAsset>();
 		meshes.push_back(newMesh);
 		file.meshes[mesh.name.c_str()] = newMesh;
 		newMesh->name = mesh.name;
 
-		indices.clear();
-		vertices.clear();
-
-		for (auto&& p : mesh.primitives) {
-			GeoSurface newSurface;
-			newSurface.startIndex = (uint32_t)indices.size();
-			newSurface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
-
-			size_t initial_vtx = vertices.size();
-
-			{
-				fastgltf::Accessor& indexAccessor = gltf.accessors[p.indicesAccessor.value()];
-				indices.reserve(indices.size() + indexAccessor.count);
-
-				fastgltf::iterateAccessor<std::uint32_t>(gltf, indexAccessor, [&](std::uint32_t idx) {
-					indices.push_back(idx + initial_vtx);
-				});
-			}
-			{
-				fastgltf::Accessor& posAccessor = gltf.accessors[p.findAttribute("POSITION")->second];
-				vertices.resize(vertices.size() + posAccessor.count);
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, posAccessor, [&](glm::vec3 v, size_t index) {
-					Vertex newVtx;
-					newVtx.position = v;
-					newVtx.normal = { 1, 0, 0 };
-					newVtx.color = glm::vec4{ 1.0f };
-					newVtx.uv_x = 0;
-					newVtx.uv_y = 0;
-					vertices[initial_vtx + index] = newVtx;
-				});
-			}
-
-			auto normals = p.findAttribute("NORMAL");
-			if (normals != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).second], [&](glm::vec3 v, size_t index) {
-					vertices[initial_vtx + index].normal = v;
-				});
-			}
-
-			auto uv = p.findAttribute("TEXCOORD_0");
-			if (uv != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).second], [&](glm::vec2 v, size_t index) {
-					vertices[initial_vtx + index].uv_x = v.x;
-					vertices[initial_vtx + index].uv_y = v.y;
-				});
-			}
-
-			auto colors = p.findAttribute("COLOR_0");
-			if (colors != p.attributes.end()) {
-
-				fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).second], [&](glm::vec4 v, size_t index) {
-					vertices[initial_vtx + index].color = v;
-				});
-			}
-
-			if (p.materialIndex.has_value()) {
-				newSurface.material = materials[p.materialIndex.value()];
-			}
-			else {
-				newSurface.material = materials[0];
-			}
-
-			glm::vec3 minPos = vertices[initial_vtx].position;
-			glm::vec3 maxPos = vertices[initial_vtx].position;
-			for (int i = initial_vtx; i < vertices.size(); i++) {
-				minPos = glm::min(minPos, vertices[i].position);
-				maxPos = glm::max(maxPos, vertices[i].position);
-			}
-
-			newSurface.bounds.origin = (maxPos + minPos) / 2.0f;
-			newSurface.bounds.extents = (maxPos - minPos) / 2.0f;
-			newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
-
-			newMesh->surfaces.push_back(newSurface);
+		newMesh->surfaces = std::move(imported.surfaces);
+		for (size_t i = 0; i < newMesh->surfaces.size(); i++) {
+			newMesh->surfaces[i].material = materials[imported.materialIndices[i]];
 		}
 
-		newMesh->meshBuffers = engine->uploadMesh(indices, vertices);
+		newMesh->meshBuffers = engine->uploadMesh(imported.indices, imported.vertices, imported.meshlets);
 		engine->meshesToDelete.emplace_back(newMesh->meshBuffers);
-		newMesh->vertexCount = vertices.size();
-		newMesh->indexCount = indices.size();
+		newMesh->vertexCount = imported.vertices.size();
+		newMesh->indexCount = imported.baseIndexCount;
+
+		imported = {};
 	}
 
+	importedNodes.reserve(gltf.nodes.size());
 	for (fastgltf::Node& node : gltf.nodes) {
-		std::shared_ptr<Node> newNode;
+		ImportedNode& newNode = importedNodes.emplace_back();
+		newNode.name = node.name.c_str();
+		newNode.parentIndex = -1;
 
 		if (node.meshIndex.has_value()) {
-			newNode = std::make_shared<MeshNode>();
-			static_cast<MeshNode*>(newNode.get())->mesh = meshes[*node.meshIndex];
-		}
-		else {
-			newNode = std::make_shared<Node>();
+			newNode.mesh = meshes[*node.meshIndex];
 		}
 
-		nodes.push_back(newNode);
-
 		std::visit(
 			fastgltf::visitor{
 				[&](fastgltf::Node::TransformMatrix matrix) {
-					memcpy(&newNode->localTransform, matrix.data(), sizeof(matrix));
+					memcpy(&newNode.localTransform, matrix.data(), sizeof(matrix));
 				},
 				[&](fastgltf::Node::TRS transform) {
 					glm::vec3 tl(
@@ -347,126 +701,76 @@ std::optional<std::shared_ptr<LoadedGLTF>> vkutil::load_gltf(VulkanEngine* engin
 					glm::mat4 rm = glm::toMat4(rot);
 					glm::mat4 sm = glm::scale(glm::mat4(1.0f), sc);
 
-					newNode->localTransform = tm * rm * sm;
+					newNode.localTransform = tm * rm * sm;
 				} 
 			},
 			node.transform
 		);
-		file.nodes[node.name.c_str()] = newNode;
-		if (node.meshIndex.has_value()) {
-			file.meshNodes[node.name.c_str()] = newNode;
-		}
 	}
 
 	for (int i = 0; i < gltf.nodes.size(); i++) {
-		fastgltf::Node& node = gltf.nodes[i];
-		std::shared_ptr<Node>& sceneNode = nodes[i];
-
-		for (auto& c : node.children) {
-			sceneNode->children.push_back(nodes[c]);
-			nodes[c]->parent = sceneNode;
+		for (auto& c : gltf.nodes[i].children) {
+			importedNodes[c].parentIndex = i;
 		}
 	}
 
-	for (auto& node : nodes) {
-		if (node->parent.lock() == nullptr) {
-			file.topNodes.push_back(node);
-			node->refreshTransform(glm::mat4{ 1.0f });
-		}
-	}
+	build_nodes(file, importedNodes);
+
+	// start the transfers for everything this file queued instead of waiting for the next frame
+	engine->_uploader.flush();
 
 	return scene;
 }
 std::optional<AllocatedImage> vkutil::load_image(VulkanEngine* engine, fastgltf::Asset& asset, fastgltf::Image& image)
 {
-	AllocatedImage newImage{};
+	std::optional<DecodedImage> decoded = decode_image(asset, image);
+	if (!decoded.has_value()) {
+		return {};
+	}
 
+	return create_decoded_image(engine, decoded.value());
+}
+std::optional<DecodedImage> vkutil::decode_image(const fastgltf::Asset& asset, const fastgltf::Image& image)
+{
+	TRACE_FUNCTION();
+	unsigned char* data = nullptr;
 	int width, height, nrChannels;
+	TextureData texture;
+	bool failed = false;
+
+	// ktx2 containers are recognized by their identifier, everything else goes to stb
+	auto decode = [&](const uint8_t* bytes, size_t size) {
+		if (texcodec::is_ktx2(bytes, size)) {
+			failed = !texcodec::load_ktx2(bytes, size, texture);
+			return;
+		}
+		data = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &nrChannels, 4);
+	};
 
 	std::visit(
 		fastgltf::visitor{
 			[](auto& arg) {},
-			[&](fastgltf::sources::URI& filePath) {
+			[&](const fastgltf::sources::URI& filePath) {
 				assert(filePath.fileByteOffset == 0);
 				assert(filePath.uri.isLocalPath());
 
 				const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
-				unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-				if (data) {
-					VkExtent3D imageSize;
-					imageSize.width = width;
-					imageSize.height = height;
-					imageSize.depth = 1;
-
-					newImage = engine->create_image(
-						data,
-						imageSize,
-						VK_FORMAT_R8G8B8A8_UNORM,
-						VK_IMAGE_USAGE_SAMPLED_BIT,
-						true
-					);
-
-					stbi_image_free(data);
-				}
+				std::ifstream file(path, std::ios::binary);
+				std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+				decode(bytes.data(), bytes.size());
 			},
-			[&](fastgltf::sources::Vector& vector) {
-				unsigned char* data = stbi_load_from_memory(
-					vector.bytes.data(),
-					static_cast<int>(vector.bytes.size()),
-					&width,
-					&height,
-					&nrChannels,
-					4
-				);
-				if (data) {
-					VkExtent3D imageSize;
-					imageSize.width = width;
-					imageSize.height = height;
-					imageSize.depth = 1;
-
-					newImage = engine->create_image(
-						data,
-						imageSize,
-						VK_FORMAT_R8G8B8A8_UNORM,
-						VK_IMAGE_USAGE_SAMPLED_BIT,
-						true
-					);
-
-					stbi_image_free(data);
-				}
+			[&](const fastgltf::sources::Vector& vector) {
+				decode(vector.bytes.data(), vector.bytes.size());
 			},
-			[&](fastgltf::sources::BufferView& view) {
+			[&](const fastgltf::sources::BufferView& view) {
 				auto& bufferView = asset.bufferViews[view.bufferViewIndex];
 				auto& buffer = asset.buffers[bufferView.bufferIndex];
 
 				std::visit(
 					fastgltf::visitor{
 						[](auto& arg) {},
-						[&](fastgltf::sources::Vector& vector) {
-							unsigned char* data = stbi_load_from_memory(
-								vector.bytes.data() + bufferView.byteOffset,
-								static_cast<int>(bufferView.byteLength),
-								&width,
-								&height,
-								&nrChannels,
-								4
-							);
-							if (data) {
-								VkExtent3D imageSize;
-								imageSize.width = width;
-								imageSize.height = height;
-								imageSize.depth = 1;
-
-								newImage = engine->create_image(
-									data,
-									imageSize,
-									VK_FORMAT_R8G8B8A8_UNORM,
-									VK_IMAGE_USAGE_SAMPLED_BIT,
-									true
-								);
-
-								stbi_image_free(data);
-							}
+						[&](const fastgltf::sources::Vector& vector) {
+							decode(vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
 						}
 					},
 					buffer.data
@@ -476,12 +780,23 @@ std::optional<AllocatedImage> vkutil::load_image(VulkanEngine* engine, fastgltf:
 		image.data
 	);
 
-	if (newImage.image == VK_NULL_HANDLE) {
+	if (failed) {
 		return {};
 	}
+
+	DecodedImage decoded;
+	decoded.pixels = data;
+	if (data != nullptr) {
+		decoded.extent = VkExtent3D{ (uint32_t)width, (uint32_t)height, 1 };
+	}
+	else if (!texture.texels.empty()) {
+		decoded.extent = VkExtent3D{ texture.width, texture.height, 1 };
+		decoded.texture = std::move(texture);
+	}
 	else {
-		return newImage;
+		return {};
 	}
+	return decoded;
 }
 VkFilter vkutil::extract_filter(fastgltf::Filter filter)
 {
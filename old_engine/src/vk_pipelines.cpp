@@ -1,6 +1,7 @@
 ﻿#include "vk_pipelines.h"
 #include "vk_initializers.h" 
 
+#include <cstring>
 #include <fstream>
 
 bool vkutil::load_shader_module(std::filesystem::path filePath, VkDevice device, VkShaderModule* outShaderModule)
@@ -38,6 +39,75 @@ bool vkutil::load_shader_module(std::filesystem::path filePath, VkDevice device,
 	return true;
 }
 
+VkPipelineCache vkutil::load_pipeline_cache(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::filesystem::path& filePath)
+{
+	std::vector<char> data;
+
+	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+	if (file.is_open()) {
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+		file.close();
+
+		// a cache from another gpu or driver version would be thrown away by the driver anyway, or worse
+		VkPipelineCacheHeaderVersionOne header{};
+		bool valid = data.size() >= sizeof(header);
+		if (valid) {
+			memcpy(&header, data.data(), sizeof(header));
+			valid = header.headerSize >= sizeof(header)
+				&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+				&& header.vendorID == properties.vendorID
+				&& header.deviceID == properties.deviceID
+				&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+		if (!valid) {
+			std::cout << filePath << " was written by a different device or driver, starting with an empty pipeline cache" << std::endl;
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkPipelineCache cache;
+	if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VK_SUCCESS) {
+		// the driver can still reject data that passed the header check
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+		VK_CHECK(vkCreatePipelineCache(device, &createInfo, nullptr, &cache));
+	}
+	return cache;
+}
+
+void vkutil::save_pipeline_cache(VkDevice device, VkPipelineCache cache, const std::filesystem::path& filePath)
+{
+	size_t dataSize = 0;
+	VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, nullptr));
+
+	std::vector<char> data(dataSize);
+	VK_CHECK(vkGetPipelineCacheData(device, cache, &dataSize, data.data()));
+
+	// written next to the final file and renamed so a crash mid write never leaves a truncated cache
+	std::filesystem::path tempPath = filePath;
+	tempPath += ".tmp";
+
+	std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cout << tempPath << " failed to open." << std::endl;
+		return;
+	}
+	file.write(data.data(), dataSize);
+	file.close();
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, filePath, ec);
+	if (ec) {
+		std::cout << "Failed to move " << tempPath << " to " << filePath << ": " << ec.message() << std::endl;
+	}
+}
+
 void PipelineBuilder::clear()
 {
 	_inputAssembly = { .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
@@ -165,7 +235,7 @@ void PipelineBuilder::enable_blending_alphablend()
 	_colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
-VkResult PipelineBuilder::build_pipeline(VkDevice device, VkPipeline& pipeline)
+VkResult PipelineBuilder::build_pipeline(VkDevice device, VkPipeline& pipeline, VkPipelineCache cache)
 {
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -184,10 +254,16 @@ VkResult PipelineBuilder::build_pipeline(VkDevice device, VkPipeline& pipeline)
 	colorBlending.pAttachments = &_colorBlendAttachment;
 
 	VkPipelineVertexInputStateCreateInfo _vertexInputInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+
+	// the builder may have been copied, so the format pointer is taken from this instance
+	VkPipelineRenderingCreateInfo renderInfo = _renderInfo;
+	if (renderInfo.colorAttachmentCount > 0) {
+		renderInfo.pColorAttachmentFormats = &_colorAttachmentFormat;
+	}
 	
 	VkGraphicsPipelineCreateInfo pipelineInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 
-	pipelineInfo.pNext = &_renderInfo;
+	pipelineInfo.pNext = &renderInfo;
 
 	pipelineInfo.stageCount = (uint32_t)_shaderStages.size();
 	pipelineInfo.pStages = _shaderStages.data();
@@ -208,5 +284,79 @@ VkResult PipelineBuilder::build_pipeline(VkDevice device, VkPipeline& pipeline)
 
 	pipelineInfo.pDynamicState = &dynamicInfo;
 
-	return vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+	return vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline);
+}
+
+VkResult PipelineBuilder::build_library(VkDevice device, VkGraphicsPipelineLibraryFlagsEXT parts, VkPipeline& library, VkPipelineCache cache)
+{
+	VkPipelineViewportStateCreateInfo viewportState = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending = { .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &_colorBlendAttachment;
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+
+	VkPipelineRenderingCreateInfo renderInfo = _renderInfo;
+	if (renderInfo.colorAttachmentCount > 0) {
+		renderInfo.pColorAttachmentFormats = &_colorAttachmentFormat;
+	}
+
+	VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+	libraryInfo.pNext = &renderInfo;
+	libraryInfo.flags = parts;
+
+	// state outside the requested parts is ignored by the driver, only the stages have to be filtered
+	std::vector<VkPipelineShaderStageCreateInfo> stages;
+	for (const VkPipelineShaderStageCreateInfo& stage : _shaderStages) {
+		bool fragment = stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT;
+		if ((fragment && (parts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT))
+			|| (!fragment && (parts & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT))) {
+			stages.push_back(stage);
+		}
+	}
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipelineInfo.pNext = &libraryInfo;
+	// keeping the intermediate representation is what allows an optimized link later
+	pipelineInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+	pipelineInfo.stageCount = (uint32_t)stages.size();
+	pipelineInfo.pStages = stages.data();
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &_inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &_rasterizer;
+	pipelineInfo.pMultisampleState = &_multisampling;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDepthStencilState = &_depthStencil;
+	pipelineInfo.layout = _pipelineLayout;
+
+	VkDynamicState state[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dynamicInfo.pDynamicStates = &state[0];
+	dynamicInfo.dynamicStateCount = 2;
+
+	pipelineInfo.pDynamicState = &dynamicInfo;
+
+	return vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &library);
+}
+
+VkResult PipelineBuilder::link_libraries(VkDevice device, std::span<const VkPipeline> libraries, VkPipelineLayout layout, bool optimize, VkPipeline& pipeline, VkPipelineCache cache)
+{
+	VkPipelineLibraryCreateInfoKHR libraryInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+	libraryInfo.libraryCount = (uint32_t)libraries.size();
+	libraryInfo.pLibraries = libraries.data();
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = { .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipelineInfo.pNext = &libraryInfo;
+	pipelineInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+	pipelineInfo.layout = layout;
+
+	return vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline);
 } 
\ No newline at end of file
@@ -0,0 +1,482 @@
+#include "vk_upload.h"
+#include "vk_engine.h"
+#include "vk_images.h"
+#include "vk_initializers.h"
+#include "cpu_trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void UploadService::init(VulkanEngine* engine, VkQueue queue, uint32_t queueFamily, std::mutex* queueMutex, VkDeviceSize stagingSize)
+{
+	_engine = engine;
+	_device = engine->_device;
+	_queue = queue;
+	_queueFamily = queueFamily;
+	_graphicsQueueFamily = engine->_graphicsQueueFamily;
+	_queueMutex = queueMutex;
+	_separateFamily = _queueFamily != _graphicsQueueFamily;
+
+	VkSemaphoreTypeCreateInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+	semaphoreInfo.pNext = &timelineInfo;
+	VK_CHECK(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_timeline));
+
+	_ring = engine->create_buffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	_ringSize = stagingSize;
+
+	_openBatch.value = 1;
+	_stop = false;
+	_worker = std::thread(&UploadService::worker_loop, this);
+}
+
+void UploadService::destroy()
+{
+	uint64_t last = flush();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_workAvailable.notify_all();
+	_worker.join();
+
+	wait(last);
+
+	for (auto& [pool, cmd] : _freeCommandBuffers) {
+		vkDestroyCommandPool(_device, pool, nullptr);
+	}
+	_freeCommandBuffers.clear();
+
+	_engine->destroy_buffer(_ring);
+	vkDestroySemaphore(_device, _timeline, nullptr);
+}
+
+uint64_t UploadService::upload_buffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	StagingAllocation staging = reserve(lock, size, 4);
+	memcpy(staging.data, data, size);
+
+	BufferCopy copy;
+	copy.dst = dst;
+	copy.src = staging.buffer;
+	copy.region = VkBufferCopy{ .srcOffset = staging.offset, .dstOffset = dstOffset, .size = size };
+	_openBatch.bufferCopies.push_back(copy);
+
+	return _openBatch.value;
+}
+
+uint64_t UploadService::upload_image(const AllocatedImage& image, const void* data, VkDeviceSize size, bool mipmapped)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	StagingAllocation staging = reserve(lock, size, 16);
+	memcpy(staging.data, data, size);
+
+	ImageCopy copy;
+	copy.image = image.image;
+	copy.extent = image.imageExtent;
+	copy.generateMips = mipmapped;
+	copy.src = staging.buffer;
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = staging.offset;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = image.imageExtent;
+	copy.regions.push_back(region);
+	_openBatch.imageCopies.push_back(std::move(copy));
+
+	return _openBatch.value;
+}
+
+uint64_t UploadService::upload_image_levels(const AllocatedImage& image, const void* data, VkDeviceSize size, uint32_t mipLevels)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	StagingAllocation staging = reserve(lock, size, 16);
+	memcpy(staging.data, data, size);
+
+	ImageCopy copy;
+	copy.image = image.image;
+	copy.extent = image.imageExtent;
+	copy.generateMips = false;
+	copy.src = staging.buffer;
+
+	VkDeviceSize levelOffset = 0;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		VkExtent3D levelExtent{
+			std::max(image.imageExtent.width >> level, 1u),
+			std::max(image.imageExtent.height >> level, 1u),
+			1
+		};
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = staging.offset + levelOffset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = levelExtent;
+		copy.regions.push_back(region);
+
+		levelOffset += vkutil::image_level_size(image.imageFormat, image.imageExtent, level);
+	}
+	assert(levelOffset <= size);
+	_openBatch.imageCopies.push_back(std::move(copy));
+
+	return _openBatch.value;
+}
+
+uint64_t UploadService::flush()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return flush_locked();
+}
+
+uint64_t UploadService::flush_locked()
+{
+	if (_openBatch.bufferCopies.empty() && _openBatch.imageCopies.empty()) {
+		return _openBatch.value - 1;
+	}
+
+	uint64_t value = _openBatch.value;
+	_closedBatches.push_back(std::move(_openBatch));
+
+	_openBatch = Batch{};
+	_openBatch.value = value + 1;
+
+	_workAvailable.notify_one();
+	return value;
+}
+
+void UploadService::wait(uint64_t value)
+{
+	TRACE_FUNCTION();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (value >= _openBatch.value) {
+			flush_locked();
+		}
+		if (value <= _completedValue) {
+			return;
+		}
+	}
+
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &_timeline;
+	waitInfo.pValues = &value;
+	VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	retire(value);
+}
+
+bool UploadService::is_complete(uint64_t value)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (value <= _completedValue) {
+		return true;
+	}
+
+	uint64_t completed;
+	VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &completed));
+	retire(completed);
+
+	return value <= _completedValue;
+}
+
+bool UploadService::is_ready_for_graphics(uint64_t value)
+{
+	if (!is_complete(value)) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	return !_separateFamily || value <= _graphicsWaitedValue;
+}
+
+uint64_t UploadService::record_graphics_work(VkCommandBuffer cmd)
+{
+	std::vector<ImageCopy> work;
+	uint64_t value;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_submittedValue <= _graphicsWaitedValue) {
+			return 0;
+		}
+		work.swap(_pendingGraphicsWork);
+		value = _submittedValue;
+		_graphicsWaitedValue = value;
+	}
+
+	for (auto& copy : work) {
+		// matching acquire for the release recorded on the transfer queue
+		VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+		imageBarrier.pNext = nullptr;
+		imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		imageBarrier.srcAccessMask = VK_ACCESS_2_NONE;
+		imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.srcQueueFamilyIndex = _queueFamily;
+		imageBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+		vkutil::transition_image(cmd, copy.image, imageBarrier);
+
+		record_image_finish(cmd, copy);
+	}
+
+	return value;
+}
+
+UploadService::StagingAllocation UploadService::reserve(std::unique_lock<std::mutex>& lock, VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (size > _ringSize) {
+		// never fits in the ring, give it its own staging buffer that is released with the batch
+		AllocatedBuffer staging = _engine->create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+		_openBatch.dedicatedStaging.push_back(staging);
+		return StagingAllocation{ staging.buffer, 0, staging.info.pMappedData };
+	}
+
+	while (true) {
+		if (_ringUsed == 0) {
+			_ringHead = 0;
+			_ringTail = 0;
+		}
+
+		VkDeviceSize offset = align_up(_ringHead, alignment);
+		VkDeviceSize consumed = 0;
+		bool fits = false;
+
+		if (_ringUsed > 0 && _ringHead == _ringTail) {
+			fits = false;
+		}
+		else if (_ringHead >= _ringTail) {
+			if (offset + size <= _ringSize) {
+				consumed = offset + size - _ringHead;
+				fits = true;
+			}
+			else if (size <= _ringTail) {
+				// wrap around, the skipped tail end of the ring is retired together with this batch
+				consumed = (_ringSize - _ringHead) + size;
+				offset = 0;
+				fits = true;
+			}
+		}
+		else if (offset + size <= _ringTail) {
+			consumed = offset + size - _ringHead;
+			fits = true;
+		}
+
+		if (fits) {
+			_ringHead = offset + size;
+			_ringUsed += consumed;
+			_openBatch.ringBytes += consumed;
+			_openBatch.ringEnd = _ringHead;
+			return StagingAllocation{ _ring.buffer, offset, (char*)_ring.info.pMappedData + offset };
+		}
+
+		// ring is full, get the open batch going and wait for the oldest one to retire
+		flush_locked();
+
+		if (!_inFlightBatches.empty()) {
+			uint64_t value = _inFlightBatches.front().value;
+			lock.unlock();
+
+			VkSemaphoreWaitInfo waitInfo{};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &_timeline;
+			waitInfo.pValues = &value;
+			VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+
+			lock.lock();
+			retire(value);
+		}
+		else {
+			_batchRetired.wait(lock);
+		}
+	}
+}
+
+void UploadService::retire(uint64_t completedValue)
+{
+	_completedValue = std::max(_completedValue, completedValue);
+
+	bool retired = false;
+	while (!_inFlightBatches.empty() && _inFlightBatches.front().value <= _completedValue) {
+		Batch& batch = _inFlightBatches.front();
+		if (batch.ringBytes > 0) {
+			_ringUsed -= batch.ringBytes;
+			_ringTail = batch.ringEnd;
+		}
+		release_batch_resources(batch);
+		_inFlightBatches.pop_front();
+		retired = true;
+	}
+
+	if (retired) {
+		_batchRetired.notify_all();
+	}
+}
+
+void UploadService::release_batch_resources(Batch& batch)
+{
+	for (auto& staging : batch.dedicatedStaging) {
+		_engine->destroy_buffer(staging);
+	}
+	batch.dedicatedStaging.clear();
+
+	if (batch.pool != VK_NULL_HANDLE) {
+		VK_CHECK(vkResetCommandPool(_device, batch.pool, 0));
+		_freeCommandBuffers.emplace_back(batch.pool, batch.cmd);
+		batch.pool = VK_NULL_HANDLE;
+		batch.cmd = VK_NULL_HANDLE;
+	}
+}
+
+void UploadService::worker_loop()
+{
+	cputrace::set_thread_name("upload");
+
+	while (true) {
+		Batch batch;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_workAvailable.wait(lock, [&]() { return _stop || !_closedBatches.empty(); });
+			if (_closedBatches.empty()) {
+				return;
+			}
+
+			batch = std::move(_closedBatches.front());
+			_closedBatches.pop_front();
+
+			if (!_freeCommandBuffers.empty()) {
+				batch.pool = _freeCommandBuffers.back().first;
+				batch.cmd = _freeCommandBuffers.back().second;
+				_freeCommandBuffers.pop_back();
+			}
+		}
+
+		if (batch.pool == VK_NULL_HANDLE) {
+			VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(_queueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &batch.pool));
+			VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(batch.pool, 1);
+			VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &batch.cmd));
+		}
+
+		record_and_submit(batch);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_separateFamily) {
+				_pendingGraphicsWork.insert(_pendingGraphicsWork.end(), batch.imageCopies.begin(), batch.imageCopies.end());
+			}
+			_submittedValue = batch.value;
+			_inFlightBatches.push_back(std::move(batch));
+
+			uint64_t completed;
+			VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &completed));
+			retire(completed);
+		}
+		_batchRetired.notify_all();
+	}
+}
+
+void UploadService::record_and_submit(Batch& batch)
+{
+	TRACE_FUNCTION();
+	VkCommandBuffer cmd = batch.cmd;
+	VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+	for (auto& copy : batch.bufferCopies) {
+		vkCmdCopyBuffer(cmd, copy.src, copy.dst, 1, &copy.region);
+	}
+
+	for (auto& copy : batch.imageCopies) {
+		{
+			VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+			imageBarrier.pNext = nullptr;
+			imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+			imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			vkutil::transition_image(cmd, copy.image, imageBarrier);
+		}
+		vkCmdCopyBufferToImage(cmd, copy.src, copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copy.regions.size(), copy.regions.data());
+
+		if (_separateFamily) {
+			// transfer queues can't blit, hand the image over to graphics to finish it
+			VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+			imageBarrier.pNext = nullptr;
+			imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+			imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+			imageBarrier.dstAccessMask = VK_ACCESS_2_NONE;
+			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			imageBarrier.srcQueueFamilyIndex = _queueFamily;
+			imageBarrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+			vkutil::transition_image(cmd, copy.image, imageBarrier);
+		}
+		else {
+			record_image_finish(cmd, copy);
+		}
+	}
+
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(cmd);
+	VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timeline);
+	signalInfo.value = batch.value;
+	VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, &signalInfo, nullptr);
+
+	if (_queueMutex) {
+		std::lock_guard<std::mutex> queueLock(*_queueMutex);
+		VK_CHECK(vkQueueSubmit2(_queue, 1, &submit, VK_NULL_HANDLE));
+	}
+	else {
+		VK_CHECK(vkQueueSubmit2(_queue, 1, &submit, VK_NULL_HANDLE));
+	}
+}
+
+void UploadService::record_image_finish(VkCommandBuffer cmd, const ImageCopy& copy)
+{
+	if (copy.generateMips) {
+		vkutil::generate_mipmaps(cmd, copy.image, VkExtent2D{ copy.extent.width, copy.extent.height });
+	}
+	else {
+		VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+		imageBarrier.pNext = nullptr;
+		imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
+		imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkutil::transition_image(cmd, copy.image, imageBarrier);
+	}
+}
@@ -0,0 +1,72 @@
+#include "worker_pool.h"
+#include "cpu_trace.h"
+
+void WorkerPool::init(uint32_t threadCount)
+{
+	_quit = false;
+	for (uint32_t i = 0; i < threadCount; i++) {
+		_threads.emplace_back(&WorkerPool::worker_loop, this, i + 1);
+	}
+}
+
+void WorkerPool::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_taskAvailable.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+	_threads.clear();
+}
+
+void WorkerPool::run(const std::function<void(uint32_t worker)>& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_pending = (uint32_t)_threads.size();
+		_taskGeneration++;
+	}
+	_taskAvailable.notify_all();
+
+	task(0);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_taskFinished.wait(lock, [&]() { return _pending == 0; });
+	_task = nullptr;
+}
+
+void WorkerPool::worker_loop(uint32_t worker)
+{
+	cputrace::set_thread_name("worker pool");
+
+	uint64_t seenGeneration = 0;
+
+	while (true) {
+		const std::function<void(uint32_t)>* task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_taskAvailable.wait(lock, [&]() { return _quit || _taskGeneration != seenGeneration; });
+			if (_quit) {
+				return;
+			}
+			seenGeneration = _taskGeneration;
+			task = _task;
+		}
+
+		(*task)(worker);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			last = --_pending == 0;
+		}
+		if (last) {
+			_taskFinished.notify_one();
+		}
+	}
+}